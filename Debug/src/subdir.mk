@@ -4,14 +4,30 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 CPP_SRCS += \
+../src/crc16.cpp \
 ../src/hw_config.cpp \
+../src/lm75.cpp \
 ../src/main.cpp \
 ../src/msf.cpp \
+../src/msf_hal.cpp \
+../src/msfcapture.cpp \
+../src/msfclassify.cpp \
+../src/msffll.cpp \
+../src/msfglitch.cpp \
+../src/msfholdover.cpp \
+../src/msfmarker.cpp \
+../src/msfphase.cpp \
+../src/msfreport.cpp \
+../src/msfsampler.cpp \
+../src/msftune.cpp \
 ../src/msg.cpp \
+../src/rtcbackup.cpp \
+../src/samplepool.cpp \
 ../src/stm3210b_lctech.cpp \
 ../src/stm32_it.cpp \
 ../src/system_stm32f10x.cpp \
 ../src/systick.cpp \
+../src/timesource.cpp \
 ../src/usb_desc.cpp \
 ../src/usb_endp.cpp \
 ../src/usb_istr.cpp \
@@ -22,15 +38,31 @@ S_SRCS += \
 ../src/startup_stm32f10x_md.s 
 
 OBJS += \
+./src/crc16.o \
 ./src/hw_config.o \
+./src/lm75.o \
 ./src/main.o \
 ./src/msf.o \
+./src/msf_hal.o \
+./src/msfcapture.o \
+./src/msfclassify.o \
+./src/msffll.o \
+./src/msfglitch.o \
+./src/msfholdover.o \
+./src/msfmarker.o \
+./src/msfphase.o \
+./src/msfreport.o \
+./src/msfsampler.o \
+./src/msftune.o \
 ./src/msg.o \
+./src/rtcbackup.o \
+./src/samplepool.o \
 ./src/startup_stm32f10x_md.o \
 ./src/stm3210b_lctech.o \
 ./src/stm32_it.o \
 ./src/system_stm32f10x.o \
 ./src/systick.o \
+./src/timesource.o \
 ./src/usb_desc.o \
 ./src/usb_endp.o \
 ./src/usb_istr.o \
@@ -38,14 +70,30 @@ OBJS += \
 ./src/usb_pwr.o 
 
 CPP_DEPS += \
+./src/crc16.d \
 ./src/hw_config.d \
+./src/lm75.d \
 ./src/main.d \
 ./src/msf.d \
+./src/msf_hal.d \
+./src/msfcapture.d \
+./src/msfclassify.d \
+./src/msffll.d \
+./src/msfglitch.d \
+./src/msfholdover.d \
+./src/msfmarker.d \
+./src/msfphase.d \
+./src/msfreport.d \
+./src/msfsampler.d \
+./src/msftune.d \
 ./src/msg.d \
+./src/rtcbackup.d \
+./src/samplepool.d \
 ./src/stm3210b_lctech.d \
 ./src/stm32_it.d \
 ./src/system_stm32f10x.d \
 ./src/systick.d \
+./src/timesource.d \
 ./src/usb_desc.d \
 ./src/usb_endp.d \
 ./src/usb_istr.d \
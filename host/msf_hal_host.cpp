@@ -0,0 +1,134 @@
+/*
+ * msf_hal_host.cpp
+ *
+ * Host PC implementation of the MSF receiver hardware abstraction and of
+ * the system tick counter.
+ *
+ */
+#include <stdint.h>
+#include "msf_hal.h"
+#include "systick.h"
+#include "usb_endp.h"
+#include "spscring.h"
+#include "msf_hal_host.h"
+
+/*! The MSF level returned by msfSample() */
+static int hostLevel = 1;
+/*! The tick count returned by SysTick_readTicks() */
+static uint32_t hostTicks = 0;
+/*! The tick clock correction set by SysTick_setCorrection() */
+static int32_t hostCorrection = 0;
+/*! The receiver enable state */
+static bool hostReceiverEnabled = false;
+/*! The USB serial transmit ring, as the firmware's */
+static SPSC_RING<uint8_t, USB_TX_BUFF_SIZE> hostTx;
+/*! The free space of hostTx is claimed by a writer (see USBClaimTx) */
+static bool hostTxClaimed = false;
+
+/*!
+ * Sets the MSF level that the next msfSample() call returns
+ * @param level the MSF level (0/1)
+ */
+void HostHAL_setLevel(int level) {
+    hostLevel = level ? 1 : 0;
+}
+
+/*!
+ * Gives the tick clock correction last set
+ * @return the correction in ppb
+ */
+int32_t HostHAL_readCorrection(void) {
+    return hostCorrection;
+}
+
+/*!
+ * Sets the value returned by SysTick_readTicks()
+ * @param ticks the system tick count (10ms units)
+ */
+void HostHAL_setTicks(uint32_t ticks) {
+    hostTicks = ticks;
+}
+
+/*!
+ * Reads what has been sent to the USB serial port, as the host PC would
+ * @param pBuffer receives the data
+ * @param bufferLength the size of pBuffer
+ * @return the number of bytes read
+ */
+uint32_t HostHAL_readSerial(uint8_t* pBuffer, uint32_t bufferLength) {
+    return hostTx.read(pBuffer, bufferLength);
+}
+
+uint32_t USBPutSerial(const uint8_t* pBuffer, uint32_t length) {
+    if (hostTxClaimed) {
+        return 0;
+    }
+    return hostTx.write(pBuffer, length);
+}
+
+uint32_t USBGetSerial(uint8_t* pBuffer, uint32_t bufferLength) {
+    (void)pBuffer;
+    (void)bufferLength;
+    return 0;
+}
+
+uint8_t* USBClaimTx(uint32_t* pStart) {
+    if (hostTxClaimed) {
+        return 0;
+    }
+    hostTxClaimed = true;
+    *pStart = hostTx.head;
+    return hostTx.items;
+}
+
+uint32_t USBFreeTx(void) {
+    return hostTx.space();
+}
+
+void USBCommitTx(uint32_t length) {
+    if (hostTxClaimed) {
+        hostTx.commitWrite(length);
+    }
+    hostTxClaimed = false;
+}
+
+bool isMSFReceiverEnabled(void) {
+    return hostReceiverEnabled;
+}
+
+void enableMSFReceiver(void) {
+    hostReceiverEnabled = true;
+}
+
+void disableMSFReceiver(void) {
+    hostReceiverEnabled = false;
+}
+
+void configureMSFIO(void) {
+}
+
+int msfSample(void) {
+    return hostLevel;
+}
+
+uint32_t SysTick_readTicks(void) {
+    return hostTicks;
+}
+
+uint64_t SysTick_readTicks64(void) {
+    return hostTicks;
+}
+
+uint64_t SysTick_readMicros(void) {
+    return (uint64_t)hostTicks*SYSTICK_US_PER_TICK;
+}
+
+uint64_t msfSamplerToLocal(uint32_t samplerTime) {
+    /* Sampler times are the low 32 bits of the tick count in us */
+    uint64_t local = SysTick_readMicros();
+    return local - (uint32_t)((uint32_t)local - samplerTime);
+}
+
+void SysTick_setCorrection(int32_t correction) {
+    hostCorrection = correction;
+}
@@ -0,0 +1,20 @@
+/*
+ * msf_hal_host.h
+ *
+ * Host PC implementation of the MSF hardware abstraction. Rather than
+ * reading a GPIO and counting SysTick interrupts, the MSF level and the
+ * system tick count are simply set by the host program, and what the
+ * firmware sends over the USB serial port is read back by it.
+ */
+
+#ifndef MSF_HAL_HOST_H_
+#define MSF_HAL_HOST_H_
+
+#include <stdint.h>
+
+void HostHAL_setLevel(int level);
+void HostHAL_setTicks(uint32_t ticks);
+int32_t HostHAL_readCorrection(void);
+uint32_t HostHAL_readSerial(uint8_t* pBuffer, uint32_t bufferLength);
+
+#endif /* MSF_HAL_HOST_H_ */
@@ -0,0 +1,686 @@
+/*
+ * msfdecode.cpp
+ *
+ * Host PC driver for the MSF decoder core. Feeds recorded (or generated)
+ * MSF data through the same sampler and decoder code that runs on the
+ * board and reports each decoded minute, along with the time spent
+ * decoding.
+ *
+ * Input is read from a file (or stdin) and may hold either:
+ *   - a level stream: one '0'/'1' character per 10ms system tick, with
+ *     white space and '#' comment lines ignored; this is run through the
+ *     sampler state machine and then the decoder.
+ *   - the "MSF Bit Periods: idx:level:period|..." dumps the firmware sends
+ *     when a decode fails; each dump is loaded straight into a sample
+ *     buffer and decoded.
+ *
+ * Usage: msfdecode [-q] [-p] [-b] [-e] [-c ppm] [-t degC] [-r repeat]
+ *                  [-g minutes] [-d dut1] [file]
+ *   -q          only print the summary
+ *   -b          send the binary decode reports (see msfreport.h) rather
+ *               than the text ones, and print what is decoded from them
+ *   -p          also print the minute start fitted from the second edges,
+ *               the clock correction worked out from them and the UTC time
+ *               (at the decode) from the time source, and each change of
+ *               the holdover correction and of the classifier tuning
+ *   -e          feed the level stream to the sampler as timestamped edges,
+ *               as the timer capture backend does, rather than levels
+ *   -c ppm      with -e, make the edge timestamp clock run this many ppm
+ *               fast
+ *   -t degC     the board temperature the holdover model learns and
+ *               predicts at (default 25)
+ *   -r repeat   decode the input this many times (for benchmarking)
+ *   -g minutes  ignore the input and generate this many minutes of clean
+ *               level stream starting at 01/01/15 00:00 GMT
+ *   -d dut1     the DUT1 of the generated minutes, in 100ms (-8..8)
+ *   -s seconds  drop this many seconds from the start of the level stream,
+ *               to start part way through a minute
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "crc16.h"
+#include "msf.h"
+#include "msffll.h"
+#include "msfholdover.h"
+#include "msfreport.h"
+#include "msftune.h"
+#include "timesource.h"
+#include "msg.h"
+#include "msfsampler.h"
+#include "samplebuffer.h"
+#include "samplepool.h"
+#include "systick.h"
+#include "usb_endp.h"
+#include "msf_hal_host.h"
+
+/*!
+ * Decode statistics
+ */
+struct DECODE_STATS {
+    uint64_t goodCount;
+    uint64_t badCount;
+    uint64_t decodeNs;
+    uint32_t firstFixTicks;     /*!< When the first good decode came, or 0 */
+};
+
+static bool quiet = false;
+static bool feedEdges = false;
+static bool showPhase = false;
+static bool binaryReports = false;
+static long edgeClockPpm = 0;
+static int boardTemperature = 25 * 256;
+
+/*!
+ * Gives the steady clock time in ns
+ */
+static uint64_t nowNs(void) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*!
+ * Reads a 4 character hex-ascii field of a message frame
+ * @param pField the field
+ * @param pValue receives the value
+ * @return false if the field is not 4 hex digits
+ */
+static bool readHex16(
+    const uint8_t* pField,
+    uint32_t* pValue
+) {
+    char hexStr[5];
+    char* pEnd;
+    memcpy(hexStr, pField, 4);
+    hexStr[4] = '\0';
+    *pValue = (uint32_t)strtoul(hexStr, &pEnd, 16);
+    return (pEnd == hexStr + 4);
+}
+
+/*!
+ * Reads the messages the decoder has sent to the USB serial port, checks
+ * their framing and prints their content. A message with a bad CRC is
+ * reported as such and not printed.
+ * @param pLabel printed before the content of each message
+ */
+static void printSerial(
+    const char* pLabel
+) {
+    static uint8_t serial[USB_TX_BUFF_SIZE];
+    uint32_t serialLength = HostHAL_readSerial(serial, sizeof(serial));
+    uint32_t idx = 0;
+    /* {ACK|NAK}LLLL header, CCCC{CR} trailer */
+    while (idx + 10 <= serialLength) {
+        uint32_t msgLength;
+        uint32_t msgCRC;
+        if (!readHex16(serial + idx + 1, &msgLength) ||
+            (idx + msgLength + 10 > serialLength) ||
+            !readHex16(serial + idx + msgLength + 5, &msgCRC)) {
+            fprintf(stderr, "Bad message frame\n");
+            return;
+        }
+        const uint8_t* pBody = serial + idx + 5;
+        if (CRC16_addBlock(CRC16_INIT, pBody, msgLength) != msgCRC) {
+            fprintf(stderr, "Message CRC error\n");
+        } else if (!quiet) {
+            printf("%s %.*s\n", pLabel, (int)msgLength, (const char*)pBody);
+        }
+        idx += msgLength + 10;
+    }
+}
+
+/*!
+ * Reads the binary reports the decoder has sent to the USB serial port and
+ * prints what they hold. Anything between the zero bytes that is not a
+ * report is reported as such.
+ */
+static void printReports(void) {
+    static uint8_t serial[USB_TX_BUFF_SIZE];
+    uint32_t serialLength = HostHAL_readSerial(serial, sizeof(serial));
+    uint32_t start = 0;
+    for (uint32_t idx = 0; idx <= serialLength; ++idx) {
+        if ((idx < serialLength) && (serial[idx] != 0)) {
+            continue;
+        }
+        struct MSF_REPORT report;
+        if (idx == start) {
+            /* Nothing between the zero bytes */
+        } else if (!MSFReport_decode(serial + start, idx - start, report)) {
+            fprintf(stderr, "Bad report frame\n");
+        } else if (!quiet) {
+            printf("%s %u|%u.%06u|%s|DUT1=%d|flags %02X|%u,%u\n",
+                   (report.type == MSF_REPORT_GOOD) ? "ACK" : "NAK",
+                   (unsigned)report.minuteTime, (unsigned)report.utcSeconds,
+                   (unsigned)report.utcMicros,
+                   (report.flags & MSF_REPORT_BST) ? "BST" : "GMT",
+                   report.dut1, (unsigned)report.flags,
+                   (unsigned)report.goodCount, (unsigned)report.badCount);
+        }
+        start = idx + 1;
+    }
+}
+
+/*!
+ * Sends the result of decoding one minute as a binary report, and prints
+ * what the host decodes from it
+ * @param decodeOK true if the decode was good
+ * @param dateTime the decoded date/time, if decodeOK
+ * @param stats the statistics so far
+ */
+static void sendBinaryReport(
+    bool decodeOK,
+    const struct MSF_DATE_TIME& dateTime,
+    const DECODE_STATS& stats
+) {
+    struct MSF_REPORT report;
+    uint8_t frame[MSF_REPORT_FRAME_SIZE];
+    MSFReport_setTime(report, decodeOK, dateTime);
+    report.goodCount = (uint32_t)stats.goodCount;
+    report.badCount = (uint32_t)stats.badCount;
+    for (unsigned idx = 0; idx < 6; ++idx) {
+        report.recent[idx] = 0;
+    }
+    USBPutSerial(frame, (uint32_t)MSFReport_encode(report, frame));
+    printReports();
+}
+
+/*!
+ * Reports the result of decoding one minute
+ * @param decodeOK true if the decode was good
+ * @param dateTime the decoded date/time, if decodeOK
+ * @param decodeMsg the decode message
+ * @param stats the statistics we update
+ */
+static void reportDecode(
+    bool decodeOK,
+    const struct MSF_DATE_TIME& dateTime,
+    CMsg& decodeMsg,
+    DECODE_STATS& stats
+) {
+    bool retuned = false;
+    if (decodeOK) {
+        if (stats.goodCount == 0) {
+            stats.firstFixTicks = SysTick_readTicks();
+        }
+        ++stats.goodCount;
+        if (MSFFLL_update(dateTime)) {
+            SysTick_setCorrection(MSFFLL_readCorrection());
+            MSFHoldover_learn(MSFFLL_readClockError());
+        }
+        MSFHoldover_fix((dateTime.usAtTimeError != 0) ?
+                        dateTime.usAtTimeError : SYSTICK_US_PER_TICK);
+        TimeSource_setMinute(dateTime);
+        retuned = MSFTune_update();
+    } else {
+        ++stats.badCount;
+    }
+    if (binaryReports) {
+        decodeMsg.clear();
+        sendBinaryReport(decodeOK, dateTime, stats);
+    } else {
+        if (decodeOK) {
+            formatMSFDateTime(dateTime, decodeMsg);
+            decodeMsg.sendMsg();
+        } else {
+            decodeMsg.sendErrorMsg();
+        }
+        printSerial(decodeOK ? "ACK" : "NAK");
+    }
+    if (!quiet) {
+        if (showPhase && decodeOK && (dateTime.usAtTimeError != 0)) {
+            uint64_t utcTime = 0;
+            TimeSource_readUTC(utcTime);
+            printf("PHASE %u +-%uus clock %dppb FLL %dppb UTC %llu.%06llu "
+                   "marker %u\n",
+                   dateTime.usAtTime, dateTime.usAtTimeError,
+                   dateTime.clockError, HostHAL_readCorrection(),
+                   (unsigned long long)(utcTime/1000000),
+                   (unsigned long long)(utcTime%1000000),
+                   (unsigned)dateTime.markerScore);
+        }
+        if (showPhase && retuned) {
+            static CMsg tuneMsg;
+            MSFTune_format(tuneMsg);
+            tuneMsg.sendMsg();
+            printSerial("TUNE");
+        }
+    }
+}
+
+/*!
+ * Decodes one sample buffer, timing the decode and reporting the result
+ * @param pSampleBuffer the sample buffer to decode
+ * @param stats the statistics we update
+ */
+static void decodeBuffer(
+    struct MSF_SAMPLE_BUFFER* pSampleBuffer,
+    DECODE_STATS& stats
+) {
+    static CMsg decodeMsg;
+    struct MSF_DATE_TIME dateTime;
+    decodeMsg.clear();
+    uint64_t t0 = nowNs();
+    bool decodeOK = decodeMSFSampleBuffer(pSampleBuffer, dateTime, decodeMsg);
+    stats.decodeNs += nowNs() - t0;
+    reportDecode(decodeOK, dateTime, decodeMsg, stats);
+}
+
+/*!
+ * Passes the board temperature to the holdover model and steers the tick
+ * clock from it while in holdover, as the firmware main loop does once a
+ * second. With -p, reports each change of the holdover correction.
+ */
+static void serviceHoldover(void) {
+    MSFHoldover_setTemperature((int16_t)boardTemperature);
+    if (MSFHoldover_service()) {
+        SysTick_setCorrection(MSFHoldover_readCorrection());
+        MSFFLL_setCorrection(MSFHoldover_readCorrection());
+        if (showPhase && !quiet) {
+            printf("HOLDOVER %dppb +-%uus\n", MSFHoldover_readCorrection(),
+                   MSFHoldover_readErrorBound());
+        }
+    }
+}
+
+/*!
+ * Runs a level stream through the sampler, passing its events to the
+ * stream decoder as the firmware main loop does. The decode time is the
+ * time spent handling events.
+ * @param levels the level stream, one entry per 10ms tick
+ * @param stats the statistics we update
+ */
+static void runLevelStream(
+    const std::vector<uint8_t>& levels,
+    DECODE_STATS& stats
+) {
+    static struct MSF_STREAM_DECODER decoder;
+    static CMsg decodeMsg;
+    uint32_t ticks = 0;
+    uint8_t lastLevel = 1;
+    MSFSampler_init();
+    /* Nothing here applies the correction to the sampler clock */
+    MSFFLL_init(false);
+    TimeSource_init();
+    MSFHoldover_init();
+    SysTick_setCorrection(0);
+    msfStreamInit(decoder);
+    MSFTune_init();
+    for (size_t idx = 0; idx < levels.size(); ++idx) {
+        HostHAL_setLevel(levels[idx]);
+        HostHAL_setTicks(++ticks);
+        if (!feedEdges) {
+            MSFSampler_sample(ticks, levels[idx]);
+        } else {
+            if (levels[idx] != lastLevel) {
+                /* The edge came somewhere within the last tick */
+                int64_t edgeTime = (int64_t)ticks*SYSTICK_US_PER_TICK -
+                                   SYSTICK_US_PER_TICK/2;
+                edgeTime += edgeTime*edgeClockPpm/1000000;
+                MSFSampler_edge((uint32_t)edgeTime, ticks, levels[idx]);
+            }
+            int64_t pollTime = (int64_t)ticks*SYSTICK_US_PER_TICK;
+            pollTime += pollTime*edgeClockPpm/1000000;
+            MSFSampler_poll((uint32_t)pollTime, ticks);
+        }
+        lastLevel = levels[idx];
+        if (ticks % SYSTICK_ONESEC == 0) {
+            serviceHoldover();
+        }
+        struct MSF_PERIOD_EVENT event;
+        while (MSFSampler_getEvent(event)) {
+            uint64_t t0 = nowNs();
+            bool ended = false;
+            bool decodeOK = false;
+            struct MSF_DATE_TIME dateTime;
+            struct MSF_SAMPLE_BUFFER* pRecord;
+            switch (event.type) {
+            case MSF_EVENT_MINUTE_START:
+            case MSF_EVENT_PARTIAL_START:
+                pRecord = SamplePool_find(event.value);
+                decodeMsg.clear();
+                if (pRecord != 0) {
+                    msfStreamStart(decoder, pRecord,
+                                   event.type == MSF_EVENT_PARTIAL_START);
+                } else {
+                    msfStreamAbort(decoder);
+                }
+                break;
+            case MSF_EVENT_PERIOD:
+                /* Completes any partial minute before this one */
+                decodeOK = msfStreamPeriod(decoder, dateTime);
+                ended = decodeOK;
+                break;
+            case MSF_EVENT_RETRACT:
+                msfStreamRetract(decoder);
+                break;
+            case MSF_EVENT_MINUTE_END:
+                if (decoder.active &&
+                    SamplePool_claim(decoder.pRecord, decoder.sequence)) {
+                    decodeOK = msfStreamEnd(decoder, event.value,
+                                            dateTime, decodeMsg);
+                    SamplePool_release(decoder.pRecord);
+                    /* A partial minute is reported once completed */
+                    ended = !decoder.extract.partial;
+                    if (!ended) {
+                        decodeMsg.clear();
+                    }
+                } else {
+                    msfStreamAbort(decoder);
+                }
+                break;
+            default:
+                msfStreamAbort(decoder);
+                break;
+            }
+            stats.decodeNs += nowNs() - t0;
+            if (ended) {
+                reportDecode(decodeOK, dateTime, decodeMsg, stats);
+                if (event.type == MSF_EVENT_PERIOD) {
+                    decodeMsg.clear();
+                }
+            }
+        }
+    }
+}
+
+/*!
+ * Decodes each of the bit period dumps
+ * @param dumps the bit period dumps, one sample buffer per entry
+ * @param stats the statistics we update
+ */
+static void runPeriodDumps(
+    const std::vector<std::vector<uint8_t> >& dumps,
+    DECODE_STATS& stats
+) {
+    static struct MSF_SAMPLE_BUFFER sampleBuffer;
+    for (size_t idx = 0; idx < dumps.size(); ++idx) {
+        sampleBuffer.setEmpty();
+        sampleBuffer.setEdgeStart(0);
+        sampleBuffer.markerScore = 0;
+        const std::vector<uint8_t>& dump = dumps[idx];
+        /* A dump has no edge times; second 1 starts a second in */
+        unsigned endTime = SYSTICK_ONESEC;
+        for (size_t pIdx = 0; pIdx < dump.size(); ++pIdx) {
+            endTime += dump[pIdx];
+            if (!sampleBuffer.isFull()) {
+                sampleBuffer.store(dump[pIdx], (uint16_t)endTime);
+            }
+        }
+        sampleBuffer.setStartTime(0);
+        decodeBuffer(&sampleBuffer, stats);
+    }
+}
+
+/*!
+ * Parses one "MSF Bit Periods: idx:level:period|..." dump
+ * @param pText points just after the "MSF Bit Periods: " text
+ * @param dump assigned the period values
+ */
+static void parsePeriodDump(
+    const char* pText,
+    std::vector<uint8_t>& dump
+) {
+    unsigned sampleIdx;
+    int level;
+    unsigned period;
+    int used;
+    while (sscanf(pText, " %u:%d:%u%n", &sampleIdx, &level, &period, &used) == 3) {
+        dump.push_back((uint8_t)period);
+        pText += used;
+        if (*pText != '|')
+            break;
+        ++pText;
+    }
+}
+
+/*!
+ * Reads the input file into either a level stream or a set of period dumps
+ * @param pFile the input file
+ * @param levels assigned any level stream found
+ * @param dumps assigned any period dumps found
+ */
+static void readInput(
+    FILE* pFile,
+    std::vector<uint8_t>& levels,
+    std::vector<std::vector<uint8_t> >& dumps
+) {
+    static const char DUMP_TAG[] = "MSF Bit Periods:";
+    std::string line;
+    int ch;
+    do {
+        ch = fgetc(pFile);
+        if ((ch == '\n') || (ch == '\r') || (ch == EOF)) {
+            const char* pDump = strstr(line.c_str(), DUMP_TAG);
+            if (pDump != 0) {
+                dumps.push_back(std::vector<uint8_t>());
+                parsePeriodDump(pDump + sizeof(DUMP_TAG) - 1, dumps.back());
+            } else if (!line.empty() && (line[0] != '#')) {
+                for (size_t idx = 0; idx < line.size(); ++idx) {
+                    if ((line[idx] == '0') || (line[idx] == '1')) {
+                        levels.push_back((uint8_t)(line[idx] - '0'));
+                    }
+                }
+            }
+            line.clear();
+        } else {
+            line += (char)ch;
+        }
+    } while (ch != EOF);
+}
+
+/*!
+ * Simple minute counter used to generate a run of MSF frames
+ */
+struct GEN_TIME {
+    int year;
+    int month;
+    int day;
+    int dayOfWeek;
+    int hour;
+    int min;
+};
+
+/*!
+ * Advances a GEN_TIME by one minute
+ * @param t the time to advance
+ */
+static void genNextMinute(
+    GEN_TIME& t
+) {
+    static const int daysInMonth[12] = {
+        31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+    };
+    if (++t.min < 60)
+        return;
+    t.min = 0;
+    if (++t.hour < 24)
+        return;
+    t.hour = 0;
+    t.dayOfWeek = (t.dayOfWeek + 1) % 7;
+    int monthDays = daysInMonth[t.month - 1];
+    if ((t.month == 2) && ((t.year % 4) == 0))
+        monthDays = 29;
+    if (++t.day <= monthDays)
+        return;
+    t.day = 1;
+    if (++t.month <= 12)
+        return;
+    t.month = 1;
+    t.year = (t.year + 1) % 100;
+}
+
+/*!
+ * Writes a value as a big-endian BCD bit field into a bit array
+ * @param bits the bit array indexed 1..59 as per the MSF spec
+ * @param startBit the first (most significant) bit of the field
+ * @param bitCount the number of bits in the field
+ * @param value the decimal value to write
+ */
+static void genBCDField(
+    uint8_t bits[],
+    int startBit,
+    int bitCount,
+    int value
+) {
+    unsigned bcd = ((value / 10) << 4) | (value % 10);
+    for (int idx = 0; idx < bitCount; ++idx) {
+        bits[startBit + idx] = (bcd >> (bitCount - 1 - idx)) & 1;
+    }
+}
+
+/*!
+ * Calculates an odd parity bit for a run of bits
+ * @param bits the bit array indexed 1..59
+ * @param startBit the first bit covered
+ * @param bitCount the number of bits covered
+ * @return the parity bit value that makes the total count of 1s odd
+ */
+static uint8_t genOddParity(
+    const uint8_t bits[],
+    int startBit,
+    int bitCount
+) {
+    uint8_t parity = 1;
+    for (int idx = 0; idx < bitCount; ++idx) {
+        parity ^= bits[startBit + idx];
+    }
+    return parity;
+}
+
+/*!
+ * Generates a clean level stream for a run of minutes
+ * @param minutes the number of minutes to generate
+ * @param dut1 the DUT1 to send, in 100ms (-8..8)
+ * @param levels assigned the level stream
+ */
+static void genLevelStream(
+    unsigned minutes,
+    int dut1,
+    std::vector<uint8_t>& levels
+) {
+    GEN_TIME t = { 15, 1, 1, 4, 0, 0 };
+    /* A one second lead in of carrier before the first minute marker */
+    levels.assign(SYSTICK_ONESEC, 1);
+    for (unsigned minute = 0; minute <= minutes; ++minute) {
+        uint8_t A[60];
+        uint8_t B[60];
+        memset(A, 0, sizeof(A));
+        memset(B, 0, sizeof(B));
+        genBCDField(A, 17, 8, t.year);
+        genBCDField(A, 25, 5, t.month);
+        genBCDField(A, 30, 6, t.day);
+        genBCDField(A, 36, 3, t.dayOfWeek);
+        genBCDField(A, 39, 6, t.hour);
+        genBCDField(A, 45, 7, t.min);
+        for (int idx = 53; idx <= 58; ++idx) {
+            A[idx] = 1;
+        }
+        B[54] = genOddParity(A, 17, 8);
+        B[55] = genOddParity(A, 25, 11);
+        B[56] = genOddParity(A, 36, 3);
+        B[57] = genOddParity(A, 39, 13);
+        /* DUT1 is a count of ones in B1..8 if positive, B9..16 if not */
+        for (int idx = 0; idx < ((dut1 < 0) ? -dut1 : dut1); ++idx) {
+            B[((dut1 < 0) ? 9 : 1) + idx] = 1;
+        }
+        /* The zero second marker */
+        levels.insert(levels.end(), SYSTICK_ONESEC / 2, 0);
+        levels.insert(levels.end(), SYSTICK_ONESEC / 2, 1);
+        for (int sec = 1; sec < 60; ++sec) {
+            levels.insert(levels.end(), SYSTICK_ONESEC / 10, 0);
+            levels.insert(levels.end(), SYSTICK_ONESEC / 10, A[sec] ? 0 : 1);
+            levels.insert(levels.end(), SYSTICK_ONESEC / 10, B[sec] ? 0 : 1);
+            levels.insert(levels.end(), 7 * SYSTICK_ONESEC / 10, 1);
+        }
+        genNextMinute(t);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    unsigned repeat = 1;
+    unsigned genMinutes = 0;
+    int genDUT1 = 0;
+    unsigned skipSeconds = 0;
+    const char* pFileName = 0;
+    for (int argIdx = 1; argIdx < argc; ++argIdx) {
+        if (strcmp(argv[argIdx], "-q") == 0) {
+            quiet = true;
+        } else if (strcmp(argv[argIdx], "-p") == 0) {
+            showPhase = true;
+        } else if (strcmp(argv[argIdx], "-b") == 0) {
+            binaryReports = true;
+        } else if (strcmp(argv[argIdx], "-e") == 0) {
+            feedEdges = true;
+        } else if ((strcmp(argv[argIdx], "-c") == 0) && (argIdx + 1 < argc)) {
+            edgeClockPpm = strtol(argv[++argIdx], 0, 0);
+        } else if ((strcmp(argv[argIdx], "-t") == 0) && (argIdx + 1 < argc)) {
+            boardTemperature = (int)(strtod(argv[++argIdx], 0) * 256);
+        } else if ((strcmp(argv[argIdx], "-r") == 0) && (argIdx + 1 < argc)) {
+            repeat = (unsigned)strtoul(argv[++argIdx], 0, 0);
+        } else if ((strcmp(argv[argIdx], "-g") == 0) && (argIdx + 1 < argc)) {
+            genMinutes = (unsigned)strtoul(argv[++argIdx], 0, 0);
+        } else if ((strcmp(argv[argIdx], "-d") == 0) && (argIdx + 1 < argc)) {
+            genDUT1 = (int)strtol(argv[++argIdx], 0, 0);
+            if ((genDUT1 < -8) || (genDUT1 > 8)) {
+                fprintf(stderr, "DUT1 must be -8..8\n");
+                return 2;
+            }
+        } else if ((strcmp(argv[argIdx], "-s") == 0) && (argIdx + 1 < argc)) {
+            skipSeconds = (unsigned)strtoul(argv[++argIdx], 0, 0);
+        } else if (argv[argIdx][0] == '-') {
+            fprintf(stderr,
+                "Usage: %s [-q] [-p] [-b] [-e] [-c ppm] [-t degC] [-r repeat] "
+                "[-g minutes] [-d dut1] [-s seconds] [file]\n",
+                argv[0]);
+            return 2;
+        } else {
+            pFileName = argv[argIdx];
+        }
+    }
+    std::vector<uint8_t> levels;
+    std::vector<std::vector<uint8_t> > dumps;
+    if (genMinutes > 0) {
+        genLevelStream(genMinutes, genDUT1, levels);
+    } else {
+        FILE* pFile = stdin;
+        if (pFileName != 0) {
+            pFile = fopen(pFileName, "r");
+            if (pFile == 0) {
+                perror(pFileName);
+                return 1;
+            }
+        }
+        readInput(pFile, levels, dumps);
+        if (pFile != stdin) {
+            fclose(pFile);
+        }
+    }
+    size_t skipLevels = (size_t)skipSeconds*SYSTICK_ONESEC;
+    levels.erase(levels.begin(),
+                 levels.begin() + ((skipLevels < levels.size()) ?
+                                   skipLevels : levels.size()));
+    DECODE_STATS stats = { 0, 0, 0, 0 };
+    for (unsigned pass = 0; pass < repeat; ++pass) {
+        if (!levels.empty()) {
+            runLevelStream(levels, stats);
+        }
+        if (!dumps.empty()) {
+            runPeriodDumps(dumps, stats);
+        }
+    }
+    uint64_t total = stats.goodCount + stats.badCount;
+    printf("minutes=%llu good=%llu bad=%llu decode=%.3fms (%.0fns/minute) "
+           "first fix %u.%02us\n",
+           (unsigned long long)total,
+           (unsigned long long)stats.goodCount,
+           (unsigned long long)stats.badCount,
+           stats.decodeNs / 1e6,
+           total ? (double)stats.decodeNs / total : 0.0,
+           stats.firstFixTicks / SYSTICK_ONESEC,
+           stats.firstFixTicks % SYSTICK_ONESEC);
+    return (stats.badCount == 0) ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+/*
+ * crc16.h
+ *
+ * CRC-16/CCITT (polynomial 0x1021), worked out a byte at a time from a
+ * table as the data is added. This is the CRC that frames the messages
+ * sent to the host (see msg.h), so the host uses it too to check them.
+ */
+
+#ifndef CRC16_H_
+#define CRC16_H_
+
+#include <stdint.h>
+
+/*!
+ * Selects the CRC table. If non-zero, a 16 entry table is used a nibble
+ * at a time, which is 32 bytes of flash rather than 512 for two lookups a
+ * byte rather than one.
+ */
+#ifndef CRC16_NIBBLE_TABLE
+#define CRC16_NIBBLE_TABLE 0
+#endif
+
+/*!
+ * The initial CRC value. The message CRC has always been worked out by
+ * shifting the data bits in at the bottom of a register that starts at
+ * 0xFFFF, and then shifting 16 zero bits through; starting at 0x1D0F
+ * (0xFFFF with 16 zero bits shifted through) and xoring each byte in at
+ * the top gives the same result without the 16 bits at the end.
+ */
+const uint16_t CRC16_INIT = 0x1D0F;
+
+uint16_t CRC16_add(uint16_t crc, uint8_t data);
+uint16_t CRC16_addBlock(uint16_t crc, const uint8_t* pData, uint32_t length);
+
+#endif /* CRC16_H_ */
@@ -0,0 +1,20 @@
+/*
+ * lm75.h
+ *
+ * Reads the board temperature from the LM75 sensor on I2C1.
+ */
+
+#ifndef LM75_H_
+#define LM75_H_
+
+#include <stdint.h>
+
+/*! The LM75 I2C address (A0..A2 tied low), as sent on the bus */
+const uint8_t LM75_ADDRESS = 0x90;
+/*! The I2C clock, in Hz */
+const uint32_t LM75_I2C_SPEED = 100000;
+
+void LM75_init(void);
+bool LM75_readTemperature(int16_t& temperature);
+
+#endif /* LM75_H_ */
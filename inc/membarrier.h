@@ -0,0 +1,45 @@
+/*
+ * membarrier.h
+ *
+ * A full memory barrier and a compare-and-swap, used where data is handed
+ * between interrupt and main line code without disabling interrupts.
+ */
+
+#ifndef MEMBARRIER_H_
+#define MEMBARRIER_H_
+
+#if defined(__CC_ARM)
+#define MEMORY_BARRIER() __dmb(0xF)
+#elif defined(__GNUC__)
+#define MEMORY_BARRIER() __sync_synchronize()
+#else
+#error "No MEMORY_BARRIER() for this compiler"
+#endif
+
+#include <stdint.h>
+
+/*!
+ * Sets *pValue to desired if it holds expected, as one atomic operation.
+ * @return true if the swap was made
+ */
+inline bool atomicCompareAndSwap(
+    volatile uint32_t* pValue,
+    uint32_t expected,
+    uint32_t desired
+) {
+#if defined(__CC_ARM)
+    /* An interrupt between the LDREX and STREX makes the STREX fail */
+    do {
+        if (__ldrex(pValue) != expected) {
+            __clrex();
+            return false;
+        }
+    } while (__strex(desired, pValue) != 0);
+    MEMORY_BARRIER();
+    return true;
+#else
+    return __sync_bool_compare_and_swap(pValue, expected, desired);
+#endif
+}
+
+#endif /* MEMBARRIER_H_ */
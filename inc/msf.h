@@ -10,11 +10,25 @@
 #include <stddef.h>
 #include "msg.h"
 #include "samplebuffer.h"
+#include "msfframe.h"
+#include "msfclassify.h"
 /*!
  * The format of a decoded MSF date/time record
  */
 struct MSF_DATE_TIME {
 	uint32_t ticksAtTime;
+	/*!
+	 * The start of the minute fitted from the second edges, in sampler us
+	 * (see msfphase.h). Only valid if usAtTimeError is not 0.
+	 */
+	uint32_t usAtTime;
+	uint32_t usAtTimeError;     /*!< 1 sigma uncertainty of usAtTime in us */
+	int32_t clockError;         /*!< Sampler clock error in ppb */
+	/*!
+	 * How well the minute marker ending the minute matched, 0..100 (see
+	 * msfmarker.h). 0 if the minute was ended on the second grid alone.
+	 */
+	uint8_t markerScore;
 	int		DUT1;
 	uint8_t	year;
 	uint8_t	month;
@@ -23,12 +37,96 @@ struct MSF_DATE_TIME {
 	uint8_t hour;
 	uint8_t min;
 	bool    BST;
+	/*!
+	 * Confirmed by matching the minute predicted from the last good one,
+	 * rather than decoded on its own
+	 */
+	bool    predicted;
+};
+/*! The most minutes we predict ahead from the last good decode */
+const uint32_t MSF_PREDICT_MAX_MINUTES = 60;
+/*! What each received bit disagreeing with the prediction costs */
+const int MSF_PREDICT_MISMATCH_COST = 8;
+/*!
+ * The least agreement score (bits agreeing, less the mismatch costs) for
+ * a minute to be confirmed against the prediction
+ */
+const int MSF_PREDICT_MIN_SCORE = 40;
+/*! Seconds start at even period offsets, so there is a node per pair */
+const size_t MSF_SEGMENT_NODES = MSF_SAMPLE_BYTE_COUNT/2 + 1;
+/*! The cost of a segmentation node that no segmentation reaches */
+const uint16_t MSF_SEGMENT_UNREACHED = 0xFFFF;
+/*!
+ * What skipping the periods before a node costs, per node, where a
+ * partial minute starts part way through a second
+ */
+const uint32_t MSF_SKIP_COST = MSF_ERASURE_COST;
+/*! The most seconds we keep a confidence for */
+const size_t MSF_FRAME_SECONDS = 60;
+/*!
+ * The best way found to split the periods before an even period offset
+ * into seconds
+ */
+struct MSF_SEGMENT_NODE {
+	uint16_t cost;              /*!< The summed cost of those seconds */
+	uint8_t span;               /*!< The periods in the last of them */
+	uint8_t seconds;            /*!< The seconds those periods cover */
+	uint8_t type;               /*!< Its MSF_SECOND_TYPE, or NO_MATCH */
+	uint8_t guess;              /*!< Its closest MSF_SECOND_TYPE */
+	uint8_t aConfidence;        /*!< Its A bit match confidence */
+	uint8_t bConfidence;        /*!< Its B bit match confidence */
+};
+/*!
+ * How far extracting the A/B bits from a minute's bit periods has got.
+ * The periods are split into seconds by finding the lowest total cost
+ * way through them (see extractABBits()), one node at a time as the
+ * periods arrive.
+ */
+struct MSF_EXTRACT_STATE {
+	/*! The periods start part way through the minute */
+	bool partial;
+	struct MSF_FRAME frame;     /*!< The A/B bits extracted */
+	/*! The A/B bits of frame too uncertain to use (erasures) */
+	struct MSF_FRAME erased;
+	size_t secsCount;           /*!< The number of seconds extracted */
+	size_t usedCount;           /*!< The number of periods looked at */
+	size_t nodeCount;           /*!< The segmentation nodes worked out */
+	size_t erasureCount;        /*!< The seconds matching no pattern */
+	size_t erasureOffset;       /*!< The period offset of the first */
+	/*!
+	 * The match confidence of each second (the lower of its A and B bit
+	 * confidences), 0 for an erasure
+	 */
+	uint8_t confidence[MSF_FRAME_SECONDS];
+	struct MSF_SEGMENT_NODE nodes[MSF_SEGMENT_NODES];
+	bool failed;                /*!< A second failed to match */
+	size_t failOffset;          /*!< The period offset of that second */
+	uint8_t failPeriods[4];     /*!< The periods of that second */
+	struct MSF_SECOND_SCORES failScores; /*!< and their match scores */
+};
+/*!
+ * Decodes a minute one bit period at a time, as the sampler records the
+ * periods, so that the result is ready as soon as the minute ends.
+ */
+struct MSF_STREAM_DECODER {
+	bool active;                        /*!< A minute is being decoded */
+	struct MSF_SAMPLE_BUFFER* pRecord;  /*!< Where the minute is recorded */
+	uint32_t sequence;                  /*!< The minute's sequence number */
+	size_t storedCount;                 /*!< The periods recorded so far */
+	struct MSF_EXTRACT_STATE extract;   /*!< A/B bits extracted so far */
+	bool lastValid;                     /*!< lastGood holds a decode */
+	struct MSF_DATE_TIME lastGood;      /*!< The last good decode */
+	/*!
+	 * The held fields keep the end of a partial minute, to be completed
+	 * from the first seconds of the minute after
+	 */
+	bool heldValid;
+	uint32_t heldSequence;              /*!< The partial minute's sequence */
+	uint32_t heldMarkerTime;            /*!< The ticker time of its end */
+	size_t heldMissing;                 /*!< The seconds missing at its start */
+	struct MSF_FRAME heldFrame;         /*!< Its A/B bits */
+	struct MSF_FRAME heldErased;        /*!< and those erased */
 };
-bool isMSFReceiverEnabled(void);
-void enableMSFReceiver(void);
-void disableMSFReceiver(void);
-void configureMSFIO(void);
-int msfSample(void);
 bool msfPeriodLengthMatch(
 	unsigned length,
 	unsigned matchLength
@@ -38,6 +136,30 @@ bool decodeMSFSampleBuffer(
 	struct MSF_DATE_TIME &dateTime,
 	CMsg& decodeMsg
 );
+void msfStreamInit(
+	struct MSF_STREAM_DECODER& decoder
+);
+void msfStreamStart(
+	struct MSF_STREAM_DECODER& decoder,
+	struct MSF_SAMPLE_BUFFER* pRecord,
+	bool partial
+);
+void msfStreamAbort(
+	struct MSF_STREAM_DECODER& decoder
+);
+bool msfStreamPeriod(
+	struct MSF_STREAM_DECODER& decoder,
+	struct MSF_DATE_TIME &dateTime
+);
+void msfStreamRetract(
+	struct MSF_STREAM_DECODER& decoder
+);
+bool msfStreamEnd(
+	struct MSF_STREAM_DECODER& decoder,
+	uint32_t markerTime,
+	struct MSF_DATE_TIME &dateTime,
+	CMsg& decodeMsg
+);
 void formatMSFDateTime(
 	const struct MSF_DATE_TIME& dateTime,
 	CMsg& output
@@ -0,0 +1,34 @@
+/*
+ * msf_hal.h
+ *
+ * The hardware abstraction used by the MSF decoder core. The decoder,
+ * sampler state machine and message code only touch the hardware through
+ * the functions declared here (and the SysTick_read...() functions from
+ * systick.h), so
+ * they can be built for the target or for a host PC. The target versions
+ * live in msf_hal.cpp, the host versions in host/msf_hal_host.cpp.
+ */
+
+#ifndef MSF_HAL_H_
+#define MSF_HAL_H_
+
+#include <stdint.h>
+
+/*!
+ * Selects how the MSF receiver output is sampled. If non-zero, PB0 is
+ * routed to TIM3 input capture and both edges are timestamped to 1us by
+ * DMA (see msfcapture.h). If zero, PB0 is polled from the SysTick IRQ
+ * every 10ms.
+ */
+#ifndef MSF_EDGE_CAPTURE
+#define MSF_EDGE_CAPTURE 1
+#endif
+
+bool isMSFReceiverEnabled(void);
+void enableMSFReceiver(void);
+void disableMSFReceiver(void);
+void configureMSFIO(void);
+int msfSample(void);
+uint64_t msfSamplerToLocal(uint32_t samplerTime);
+
+#endif /* MSF_HAL_H_ */
@@ -0,0 +1,27 @@
+/*
+ * msfcapture.h
+ *
+ * Timestamps the MSF receiver output edges with TIM3 input capture. PB0
+ * is TIM3_CH3: CH3 captures the rising edges and CH4 (mapped onto the same
+ * TI3 input) the falling edges, each into a circular DMA buffer. The
+ * timer counts at 1MHz and its update IRQ extends the count to 32 bits
+ * and passes the captured edges to the MSF sampler, so the CPU is only
+ * interrupted every 65.536ms rather than every 10ms.
+ */
+
+#ifndef MSFCAPTURE_H_
+#define MSFCAPTURE_H_
+
+#include <stdint.h>
+
+/*!
+ * The number of edges of each direction held in the DMA buffers. The
+ * buffers are emptied at each timer update, so this allows for noise
+ * giving up to this many edges of each direction per 65.536ms.
+ */
+const uint32_t MSF_CAPTURE_BUFFER_SIZE = 16;
+
+void MSFCapture_init(void);
+uint64_t MSFCapture_toLocal(uint32_t captureTime);
+
+#endif /* MSFCAPTURE_H_ */
@@ -0,0 +1,189 @@
+/*
+ * msfclassify.h
+ *
+ * Classifies the bit periods making up one MSF second.
+ */
+
+#ifndef MSFCLASSIFY_H_
+#define MSFCLASSIFY_H_
+
+#include <stdint.h>
+
+/*!
+ * The period patterns a MSF second (other than the minute marker) can
+ * take, named after the period lengths in ms. Each one gives a A/B bit
+ * pair.
+ */
+enum MSF_SECOND_TYPE {
+    MSF_SEC_300_700,            /*!< A = 1, B = 1 */
+    MSF_SEC_200_800,            /*!< A = 1, B = 0 */
+    MSF_SEC_100_900,            /*!< A = 0, B = 0 */
+    MSF_SEC_100_100_100_700,    /*!< A = 0, B = 1 */
+    MSF_SEC_NO_MATCH            /*!< None of the above */
+};
+
+/*!
+ * The error scores for each of the second patterns. 0 is a perfect match,
+ * anything over MSF_MAX_SECOND_ERROR is no match at all.
+ */
+struct MSF_SECOND_SCORES {
+    uint32_t err_300_700;
+    uint32_t err_200_800;
+    uint32_t err_100_900;
+    uint32_t err_100_100_100_700;
+};
+
+/*!
+ * Error scores at or above this are never accepted as a match. The
+ * classifier's tuning may lower the limit (see MSF_CLASSIFY_TUNING).
+ */
+const uint32_t MSF_MAX_SECOND_ERROR = 300;
+/*! The lowest the tuned match error limit goes */
+const uint32_t MSF_MIN_SECOND_ERROR = 150;
+
+/*!
+ * The A bit value for each MSF_SECOND_TYPE (other than MSF_SEC_NO_MATCH)
+ */
+inline unsigned msfSecondABit(
+    enum MSF_SECOND_TYPE type
+) {
+    return (type == MSF_SEC_300_700) || (type == MSF_SEC_200_800);
+}
+
+/*!
+ * The B bit value for each MSF_SECOND_TYPE (other than MSF_SEC_NO_MATCH)
+ */
+inline unsigned msfSecondBBit(
+    enum MSF_SECOND_TYPE type
+) {
+    return (type == MSF_SEC_300_700) || (type == MSF_SEC_100_100_100_700);
+}
+
+/*! The base cost of reading a short pulse within a second as noise */
+const uint32_t MSF_GLITCH_COST = 40;
+/*! The cost of a second which matches no pattern (an erasure) */
+const uint32_t MSF_ERASURE_COST = MSF_MAX_SECOND_ERROR;
+/*!
+ * An erasure's periods must add up to within this many ticks of one
+ * second
+ */
+const int MSF_ERASURE_SLACK = 10;
+/*!
+ * A/B bits decided by a confidence margin below this are taken as
+ * erasures, to be worked out from the parity bits if they can be
+ */
+const uint8_t MSF_LOW_CONFIDENCE = 30;
+/*! The most periods (glitches included) classified as one second */
+const unsigned MSF_MAX_SPAN_PERIODS = 6;
+
+/*!
+ * How a span of periods matches as one second
+ */
+struct MSF_SPAN_MATCH {
+    /*! The matching pattern, or MSF_SEC_NO_MATCH for an erasure */
+    enum MSF_SECOND_TYPE type;
+    /*! The closest pattern, even if it is not a match */
+    enum MSF_SECOND_TYPE guess;
+    /*!
+     * The seconds the span covers: 1, or 2 for an erasure which lost the
+     * start of the second second
+     */
+    uint8_t seconds;
+    /*! The match error score, including any glitches */
+    uint16_t cost;
+    /*!
+     * How much worse the closest pattern with the other A bit value
+     * scores (0..255). 0 for an erasure.
+     */
+    uint8_t aConfidence;
+    /*! As aConfidence, for the B bit */
+    uint8_t bConfidence;
+};
+
+/*!
+ * How one second reads from the level within its window on the second
+ * grid
+ */
+struct MSF_GRID_SECOND {
+    uint8_t aBit;               /*!< The A bit value (0/1) */
+    uint8_t bBit;               /*!< The B bit value (0/1) */
+    /*!
+     * How clearly the A bit window was low or high (0..100). 0 if the
+     * second does not look like a MSF second at all.
+     */
+    uint8_t aConfidence;
+    uint8_t bConfidence;        /*!< As aConfidence, for the B bit */
+};
+
+/*!
+ * Grid classified A/B bits with a confidence below this are taken as
+ * erasures
+ */
+const uint8_t MSF_GRID_LOW_CONFIDENCE = 50;
+
+/*!
+ * The classes of period the patterns are made of, by MSF level and ideal
+ * length in ms. A receiver stretches or shrinks each class by its own
+ * amount.
+ */
+enum MSF_PERIOD_CLASS {
+    MSF_PERIOD_LOW_100,
+    MSF_PERIOD_LOW_200,
+    MSF_PERIOD_LOW_300,
+    MSF_PERIOD_HIGH_100,
+    MSF_PERIOD_HIGH_700,
+    MSF_PERIOD_HIGH_800,
+    MSF_PERIOD_HIGH_900,
+    MSF_PERIOD_CLASS_COUNT
+};
+
+/*!
+ * How the classifier is tuned to the receiver. Untuned, each class is
+ * centred on its ideal length and the match error limit is
+ * MSF_MAX_SECOND_ERROR.
+ */
+struct MSF_CLASSIFY_TUNING {
+    /*!
+     * How far (in ticks) each class of period is centred from its ideal
+     * length, positive if the receiver stretches it
+     */
+    int8_t centre[MSF_PERIOD_CLASS_COUNT];
+    /*! Error scores at or above this are not a match */
+    uint16_t maxError;
+};
+
+/*! The most a class of period may be re-centred by, in ticks */
+const int8_t MSF_MAX_CENTRE_SHIFT = 4;
+
+void msfClassifySetTuning(
+    const struct MSF_CLASSIFY_TUNING& tuning
+);
+
+void msfClassifyReadTuning(
+    struct MSF_CLASSIFY_TUNING& tuning
+);
+
+enum MSF_SECOND_TYPE msfClassifySecond(
+    uint8_t p0,
+    uint8_t p1,
+    uint8_t p2,
+    uint8_t p3,
+    bool have4Periods,
+    struct MSF_SECOND_SCORES& scores
+);
+
+bool msfClassifySpan(
+    const uint8_t* pPeriods,
+    unsigned count,
+    struct MSF_SPAN_MATCH& match
+);
+
+void msfClassifyGridSecond(
+    const uint8_t* pPeriods,
+    const uint16_t* pEnds,
+    unsigned count,
+    uint32_t secondStart,
+    struct MSF_GRID_SECOND& result
+);
+
+#endif /* MSFCLASSIFY_H_ */
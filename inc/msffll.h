@@ -0,0 +1,28 @@
+/*
+ * msffll.h
+ *
+ * A frequency locked loop which measures the local clock against the
+ * MSF minute boundaries and works out the correction needed to keep the
+ * system tick on frequency.
+ */
+
+#ifndef MSFFLL_H_
+#define MSFFLL_H_
+
+#include <stdint.h>
+#include "msf.h"
+
+/*! The longest span (in minutes) between fixes that we measure over */
+const uint32_t MSF_FLL_MAX_SPAN = 60;
+/*! Measured clock errors larger than this (in ppb) are ignored */
+const int32_t MSF_FLL_MAX_ERROR = 200000;
+/*! Each measurement moves the correction by 1/MSF_FLL_GAIN of its error */
+const int32_t MSF_FLL_GAIN = 4;
+
+void MSFFLL_init(bool samplerCorrected);
+bool MSFFLL_update(const struct MSF_DATE_TIME& dateTime);
+int32_t MSFFLL_readCorrection(void);
+int32_t MSFFLL_readClockError(void);
+void MSFFLL_setCorrection(int32_t correction);
+
+#endif /* MSFFLL_H_ */
@@ -0,0 +1,246 @@
+/*
+ * msfframe.h
+ *
+ * A bit-packed form of the A and B bits of one MSF minute, along with the
+ * layout of the fields held in them.
+ */
+
+#ifndef MSFFRAME_H_
+#define MSFFRAME_H_
+
+#include <stdint.h>
+
+/*!
+ * One minute's worth of A or B bits. The MSF spec numbers the bits from
+ * 1 (first second after the minute marker) to 59; bit n is held at bit
+ * position (63 - n) so that every multi-bit field reads MSB first and can
+ * be pulled out with a single shift and mask.
+ */
+typedef uint64_t MSF_BITS;
+
+/*!
+ * The A and B bits for one minute
+ */
+struct MSF_FRAME {
+    MSF_BITS A;
+    MSF_BITS B;
+};
+
+/*!
+ * Describes a field within a MSF_BITS value
+ */
+struct MSF_FIELD {
+    uint8_t startBit;   /*!< First (most significant) bit, 1.. based */
+    uint8_t bitCount;   /*!< Number of bits [1..31] */
+};
+
+/*!
+ * Indexes into MSF_FIELD_LAYOUT[]
+ */
+enum MSF_FIELD_ID {
+    MSF_FIELD_DUT1_POS,     /*!< B1..B8 unary +ve DUT1 */
+    MSF_FIELD_DUT1_NEG,     /*!< B9..B16 unary -ve DUT1 */
+    MSF_FIELD_YEAR,         /*!< A17..A24 BCD year */
+    MSF_FIELD_MONTH,        /*!< A25..A29 BCD month */
+    MSF_FIELD_DAY,          /*!< A30..A35 BCD day of month */
+    MSF_FIELD_DAY_OF_WEEK,  /*!< A36..A38 BCD day of week */
+    MSF_FIELD_HOUR,         /*!< A39..A44 BCD hour */
+    MSF_FIELD_MIN,          /*!< A45..A51 BCD minute */
+    MSF_FIELD_MARKER,       /*!< A52..A59 fixed 01111110 */
+    MSF_FIELD_COUNT
+};
+
+/*!
+ * Where each field lives, indexed by MSF_FIELD_ID
+ */
+static const MSF_FIELD MSF_FIELD_LAYOUT[MSF_FIELD_COUNT] = {
+    {  1, 8 },
+    {  9, 8 },
+    { 17, 8 },
+    { 25, 5 },
+    { 30, 6 },
+    { 36, 3 },
+    { 39, 6 },
+    { 45, 7 },
+    { 52, 8 }
+};
+
+/*! The value of the A52..A59 field in every valid minute */
+const uint8_t MSF_MARKER_CODE = 0x7E;
+
+/*!
+ * Describes an odd parity group: B(parityBit) makes the count of 1s in
+ * A(startBit)..A(startBit+bitCount-1) plus itself odd
+ */
+struct MSF_PARITY_GROUP {
+    MSF_FIELD field;
+    uint8_t parityBit;
+};
+
+const unsigned MSF_PARITY_GROUP_COUNT = 4;
+
+/*!
+ * The four odd parity groups, B54..B57
+ */
+static const MSF_PARITY_GROUP MSF_PARITY_GROUPS[MSF_PARITY_GROUP_COUNT] = {
+    { { 17,  8 }, 54 },
+    { { 25, 11 }, 55 },
+    { { 36,  3 }, 56 },
+    { { 39, 13 }, 57 }
+};
+
+/*! The B bit that flags BST is in force */
+const uint8_t MSF_BST_BIT = 58;
+
+/*!
+ * Gives the mask for a single bit
+ * @param bit the bit number, 1.. based as per the MSF spec
+ */
+inline MSF_BITS msfBitMask(
+    unsigned bit
+) {
+    return (MSF_BITS)1 << (63 - bit);
+}
+
+/*!
+ * Gives the mask covering a field
+ * @param field the field
+ */
+inline MSF_BITS msfFieldMask(
+    const MSF_FIELD& field
+) {
+    return (((MSF_BITS)1 << field.bitCount) - 1) <<
+           (64 - field.startBit - field.bitCount);
+}
+
+/*!
+ * Extracts a field value
+ * @param bits the A or B bits
+ * @param field the field to extract
+ * @return the field value with its first bit as the MSB
+ */
+inline uint32_t msfFieldValue(
+    MSF_BITS bits,
+    const MSF_FIELD& field
+) {
+    return (uint32_t)(bits >> (64 - field.startBit - field.bitCount)) &
+           ((1UL << field.bitCount) - 1);
+}
+
+/*!
+ * Reads a single bit
+ * @param bits the A or B bits
+ * @param bit the bit number, 1.. based as per the MSF spec
+ * @return 0/1
+ */
+inline uint8_t msfBitValue(
+    MSF_BITS bits,
+    unsigned bit
+) {
+    return (uint8_t)((bits >> (63 - bit)) & 1);
+}
+
+/*!
+ * Sets a single bit to the given value
+ * @param bits the A or B bits to update
+ * @param bit the bit number, 1.. based as per the MSF spec
+ * @param value 0/1
+ */
+inline void msfSetBit(
+    MSF_BITS& bits,
+    unsigned bit,
+    unsigned value
+) {
+    bits = (bits & ~msfBitMask(bit)) | ((MSF_BITS)(value & 1) << (63 - bit));
+}
+
+/*!
+ * Sets a field to the given value
+ * @param bits the A or B bits to update
+ * @param field the field to set
+ * @param value the field value with its first bit as the MSB
+ */
+inline void msfSetField(
+    MSF_BITS& bits,
+    const MSF_FIELD& field,
+    uint32_t value
+) {
+    MSF_BITS mask = msfFieldMask(field);
+    bits = (bits & ~mask) |
+           (((MSF_BITS)value << (64 - field.startBit - field.bitCount)) & mask);
+}
+
+/*!
+ * Counts the 1 bits in a value
+ */
+inline unsigned msfPopCount(
+    MSF_BITS bits
+) {
+#if defined(__GNUC__)
+    return (unsigned)__builtin_popcountll(bits);
+#else
+    uint32_t lo = (uint32_t)bits;
+    uint32_t hi = (uint32_t)(bits >> 32);
+    lo = lo - ((lo >> 1) & 0x55555555UL);
+    hi = hi - ((hi >> 1) & 0x55555555UL);
+    lo = (lo & 0x33333333UL) + ((lo >> 2) & 0x33333333UL);
+    hi = (hi & 0x33333333UL) + ((hi >> 2) & 0x33333333UL);
+    lo = (lo + (lo >> 4)) & 0x0F0F0F0FUL;
+    hi = (hi + (hi >> 4)) & 0x0F0F0F0FUL;
+    return (unsigned)(((lo + hi) * 0x01010101UL) >> 24);
+#endif
+}
+
+/*!
+ * Counts the leading zero bits in a 32 bit value
+ * @return [0..32]
+ */
+inline unsigned msfCountLeadingZeros(
+    uint32_t value
+) {
+#if defined(__CC_ARM)
+    return __clz(value);
+#elif defined(__GNUC__)
+    return value ? (unsigned)__builtin_clz(value) : 32;
+#else
+    unsigned count = 0;
+    while ((count < 32) && !(value & 0x80000000UL)) {
+        value <<= 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+/*!
+ * Counts the consecutive 1 bits at the start (MSB end) of a field
+ * @param bits the A or B bits
+ * @param field the field to scan
+ * @return [0..field.bitCount]
+ */
+inline unsigned msfFieldLeading1Bits(
+    MSF_BITS bits,
+    const MSF_FIELD& field
+) {
+    uint32_t inverted = ~msfFieldValue(bits, field) <<
+                        (32 - field.bitCount);
+    unsigned count = msfCountLeadingZeros(inverted);
+    /* All ones leaves only the zero padding, which counts to 32 */
+    return (count < field.bitCount) ? count : field.bitCount;
+}
+
+/*!
+ * Checks an odd parity group
+ * @param frame the A/B bits
+ * @param group the parity group to check
+ * @return true if parity is good
+ */
+inline bool msfParityGood(
+    const MSF_FRAME& frame,
+    const MSF_PARITY_GROUP& group
+) {
+    return ((msfPopCount(frame.A & msfFieldMask(group.field)) +
+             msfBitValue(frame.B, group.parityBit)) & 1) == 1;
+}
+
+#endif /* MSFFRAME_H_ */
@@ -0,0 +1,81 @@
+/*
+ * msfglitch.h
+ *
+ * The glitch filter in front of the MSF sampler state machine. It is an
+ * integrating debouncer whose hold time follows how often glitches are
+ * seen.
+ */
+
+#ifndef MSFGLITCH_H_
+#define MSFGLITCH_H_
+
+#include <stdint.h>
+
+/*!
+ * The shortest hold time, in us, used on a clean signal. This is just over
+ * a tick, so that a single sample spike is always dropped.
+ */
+const uint32_t MSF_GLITCH_MIN_HOLD = 15000;
+/*!
+ * The longest hold time, in us. This stays well short of the shortest
+ * MSF period (100ms, less the receiver's jitter). Levels held for less
+ * than this are counted as glitches.
+ */
+const uint32_t MSF_GLITCH_MAX_HOLD = 40000;
+/*! How long (in us) glitches are counted for between hold time updates */
+const uint32_t MSF_GLITCH_ADAPT_PERIOD = 10000000;
+/*!
+ * How much (in us) the hold time grows for each glitch per adapt period
+ * in the smoothed glitch count
+ */
+const uint32_t MSF_GLITCH_HOLD_STEP = 1500;
+
+/*!
+ * A MSF edge that got through the filter
+ */
+struct MSF_GLITCH_EDGE {
+    uint32_t time;          /*!< The sampler time of the edge, in us */
+    uint32_t ticks;         /*!< The ticker time of the edge */
+    uint8_t level;          /*!< The MSF level (0/1) following the edge */
+};
+
+/*!
+ * The glitch filter state
+ */
+struct MSF_GLITCH_FILTER {
+    /*!
+     * How long (in us) the level has been high, less how long it has been
+     * low, held between 0 and holdTime. The filtered level only changes
+     * when this reaches one of the limits.
+     */
+    uint32_t integral;
+    /*! The time (in us) integral must move through to change the level */
+    uint32_t holdTime;
+    /*! The time (in us) the filter was last fed */
+    uint32_t lastTime;
+    /*! The time (in us) and ticker time of the last unfiltered edge */
+    uint32_t edgeTime;
+    uint32_t edgeTicks;
+    /*! The start (in us) of the current adapt period */
+    uint32_t adaptStart;
+    /*! The glitches seen in the current adapt period */
+    uint32_t glitchCount;
+    /*! The smoothed glitches per adapt period, scaled by 4 */
+    uint32_t glitchRate;
+    uint8_t rawLevel;       /*!< The unfiltered MSF level */
+    uint8_t level;          /*!< The filtered MSF level */
+};
+
+void msfGlitchInit(
+    struct MSF_GLITCH_FILTER& filter,
+    uint32_t time
+);
+bool msfGlitchFeed(
+    struct MSF_GLITCH_FILTER& filter,
+    uint32_t time,
+    uint32_t ticks,
+    int msfLevel,
+    struct MSF_GLITCH_EDGE& edge
+);
+
+#endif /* MSFGLITCH_H_ */
@@ -0,0 +1,41 @@
+/*
+ * msfholdover.h
+ *
+ * Keeps the local clock on frequency while MSF is lost. While reception is
+ * good, each frequency locked loop measurement of the crystal error is
+ * filed against the board temperature, building a frequency against
+ * temperature model. Once the decodes stop, the clock correction is taken
+ * from that model as the temperature changes, and an error bound on the
+ * local time is grown from how well the model is known.
+ */
+
+#ifndef MSFHOLDOVER_H_
+#define MSFHOLDOVER_H_
+
+#include <stdint.h>
+
+/*! The temperature (in degrees C) of the lowest model bin */
+const int32_t MSF_HOLDOVER_MIN_TEMP = -20;
+/*! The number of model bins, each 1 degree C wide */
+const uint32_t MSF_HOLDOVER_BINS = 90;
+/*! Minutes without a good decode before holdover starts */
+const uint32_t MSF_HOLDOVER_DELAY = 3;
+/*! The rate uncertainty (in ppb) of even a well learnt bin */
+const uint32_t MSF_HOLDOVER_BASE_ERROR = 20;
+/*! The extra rate uncertainty (in ppb) per degree C from a learnt bin */
+const uint32_t MSF_HOLDOVER_SLOPE_ERROR = 200;
+/*! The rate uncertainty (in ppb) when nothing has been learnt */
+const uint32_t MSF_HOLDOVER_NO_MODEL_ERROR = 5000;
+/*! Measurements beyond this (in ppb) from a bin's mean are not learnt */
+const int32_t MSF_HOLDOVER_MAX_JUMP = 20000;
+
+void MSFHoldover_init(void);
+void MSFHoldover_learn(int32_t clockError);
+void MSFHoldover_fix(uint32_t uncertainty);
+void MSFHoldover_setTemperature(int16_t temperature);
+bool MSFHoldover_service(void);
+bool MSFHoldover_isActive(void);
+int32_t MSFHoldover_readCorrection(void);
+uint32_t MSFHoldover_readErrorBound(void);
+
+#endif /* MSFHOLDOVER_H_ */
@@ -0,0 +1,87 @@
+/*
+ * msfmarker.h
+ *
+ * Finds the MSF minute marker by correlating the recent MSF edges against
+ * the marker's template, rather than testing single period lengths.
+ */
+
+#ifndef MSFMARKER_H_
+#define MSFMARKER_H_
+
+#include <stdint.h>
+
+/*!
+ * The number of edges held. This covers the template (about 2.2s, or
+ * around 8 edges of a clean signal) with room for noise.
+ */
+const uint32_t MSF_MARKER_HISTORY_SIZE = 24;
+/*!
+ * The least score (0..100) a marker must correlate to. A data second,
+ * whose low periods are 300ms at most, scores about 60 or less.
+ */
+const uint8_t MSF_MARKER_MIN_SCORE = 90;
+/*!
+ * The least score for a marker just where the second grid expects one,
+ * where it is far more likely to be a marker hit by noise than a data
+ * second
+ */
+const uint8_t MSF_MARKER_GRID_SCORE = 50;
+
+/*!
+ * A MSF edge, with where the sampler had got to at the time
+ */
+struct MSF_MARKER_EDGE {
+    uint32_t time;          /*!< The sampler time of the edge, in us */
+    uint32_t ticks;         /*!< The ticker time of the edge */
+    /*! The periods held in the minute being recorded after the edge */
+    uint16_t offset;
+    /*! The second start edges held in the minute being recorded after it */
+    uint8_t edgeCount;
+    uint8_t level;          /*!< The MSF level (0/1) following the edge */
+};
+
+/*!
+ * The last few MSF edges, oldest first
+ */
+struct MSF_MARKER_HISTORY {
+    struct MSF_MARKER_EDGE edges[MSF_MARKER_HISTORY_SIZE];
+    /*! The index of the oldest edge */
+    uint32_t first;
+    /*! The number of edges held */
+    uint32_t count;
+
+    void init(void) { first = 0; count = 0; }
+    uint32_t size(void) const { return count; }
+    /*! Gives an edge, 0 being the oldest held */
+    const struct MSF_MARKER_EDGE& at(uint32_t idx) const {
+        return edges[(first + idx) % MSF_MARKER_HISTORY_SIZE];
+    }
+    /*! Adds the newest edge, dropping the oldest if full */
+    void push(const struct MSF_MARKER_EDGE& edge) {
+        if (count < MSF_MARKER_HISTORY_SIZE) {
+            edges[(first + count++) % MSF_MARKER_HISTORY_SIZE] = edge;
+        } else {
+            edges[first] = edge;
+            first = (first + 1) % MSF_MARKER_HISTORY_SIZE;
+        }
+    }
+};
+
+/*!
+ * The best marker found
+ */
+struct MSF_MARKER_MATCH {
+    /*! The low edge starting the marker */
+    struct MSF_MARKER_EDGE edge;
+    /*! How well the edges matched the template, 0..100 */
+    uint8_t score;
+};
+
+bool msfFindMarker(
+    const struct MSF_MARKER_HISTORY& history,
+    uint32_t time,
+    uint8_t minScore,
+    struct MSF_MARKER_MATCH& match
+);
+
+#endif /* MSFMARKER_H_ */
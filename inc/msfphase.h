@@ -0,0 +1,44 @@
+/*
+ * msfphase.h
+ *
+ * Estimates where the MSF second grid lies from the low edges that start
+ * each second of a minute.
+ */
+
+#ifndef MSFPHASE_H_
+#define MSFPHASE_H_
+
+#include <stdint.h>
+#include "samplebuffer.h"
+
+/*!
+ * The result of fitting the second grid to a minute's edges
+ */
+struct MSF_PHASE_ESTIMATE {
+    /*!
+     * The estimated time (in sampler us) of the low edge at the minute
+     * marker that ended the minute
+     */
+    uint32_t minuteEndTime;
+    /*! The 1 sigma uncertainty of minuteEndTime, in us */
+    uint32_t uncertainty;
+    /*!
+     * The length of a MSF second as measured by the sampler clock, less
+     * one second, in ns (which is the sampler clock error in ppb)
+     */
+    int32_t rateError;
+    /*! The number of edges the fit used */
+    uint8_t edgeCount;
+    /*! The number of edges rejected as not being a second start */
+    uint8_t rejectCount;
+};
+
+/*! The fewest second start edges we will fit a grid to */
+const uint32_t MSF_PHASE_MIN_EDGES = 8;
+
+bool msfEstimatePhase(
+    const struct MSF_SAMPLE_BUFFER* pSampleBuffer,
+    struct MSF_PHASE_ESTIMATE& estimate
+);
+
+#endif /* MSFPHASE_H_ */
@@ -0,0 +1,80 @@
+/*
+ * msfreport.h
+ *
+ * The binary form of the decode report, for hosts that ask for it rather
+ * than the ACK/NAK text messages (see msg.h). The report is a fixed layout
+ * struct, sent as it is held in memory: little endian, as both the board
+ * and the PCs it talks to are. It is followed by the CRC-16 of its bytes
+ * (see crc16.h), low byte first, and the whole is COBS encoded so that it
+ * holds no zero bytes, with a zero byte before and after it. A text
+ * message sent between reports therefore shows up as a frame that does
+ * not decode, and does not lose the reports either side of it.
+ */
+
+#ifndef MSFREPORT_H_
+#define MSFREPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "msf.h"
+
+/*! The report types */
+enum MSF_REPORT_TYPE {
+	MSF_REPORT_GOOD = 1,        /*!< A good decode */
+	MSF_REPORT_BAD = 2          /*!< A failed decode */
+};
+
+/*! The report flags */
+enum MSF_REPORT_FLAG {
+	MSF_REPORT_BST = 0x01,          /*!< The minute was in BST */
+	MSF_REPORT_PREDICTED = 0x02,    /*!< Confirmed against the prediction */
+	MSF_REPORT_UTC_VALID = 0x04,    /*!< utcSeconds/utcMicros are valid */
+	MSF_REPORT_APPROXIMATE = 0x08,  /*!< from the RTC, not a decode */
+	MSF_REPORT_HOLDOVER = 0x10      /*!< The clock is in holdover */
+};
+
+/*!
+ * A decode report. The fields are ordered so that none needs padding.
+ */
+struct MSF_REPORT {
+	uint8_t type;           /*!< MSF_REPORT_TYPE */
+	uint8_t flags;          /*!< MSF_REPORT_FLAG bits */
+	int16_t dut1;           /*!< DUT1 in ms, if good */
+	uint32_t minuteTime;    /*!< The UTC seconds of the minute, if good */
+	uint32_t utcSeconds;    /*!< The UTC seconds when the report was made */
+	uint32_t utcMicros;     /*!< and the us into that second */
+	uint32_t goodCount;     /*!< The total good reads */
+	uint32_t badCount;      /*!< The total bad reads */
+	/*! The good and bad reads in the last 10, 60 and 1440 minutes */
+	uint16_t recent[6];
+};
+
+/*! The length of the report and its CRC */
+const size_t MSF_REPORT_CRC_SIZE = sizeof(struct MSF_REPORT) + 2;
+/*!
+ * The most bytes an encoded report takes: COBS adds a byte to anything
+ * under 254 bytes long, and there are the zero bytes either side
+ */
+const size_t MSF_REPORT_FRAME_SIZE = MSF_REPORT_CRC_SIZE + 3;
+
+/*! The character the host sends to ask for binary reports */
+const char MSF_REPORT_SELECT_BINARY = 'B';
+/*! The character the host sends to ask for text reports */
+const char MSF_REPORT_SELECT_TEXT = 'A';
+
+void MSFReport_setTime(
+	struct MSF_REPORT& report,
+	bool decodeOK,
+	const struct MSF_DATE_TIME& dateTime
+);
+size_t MSFReport_encode(
+	const struct MSF_REPORT& report,
+	uint8_t* pFrame
+);
+bool MSFReport_decode(
+	const uint8_t* pData,
+	size_t length,
+	struct MSF_REPORT& report
+);
+
+#endif /* MSFREPORT_H_ */
@@ -0,0 +1,22 @@
+/*
+ * msfsampler.h
+ *
+ * The MSF sampler state machine. It is fed either one MSF level per
+ * system tick or timestamped MSF edges, and sends the bit periods of each
+ * minute to the decoder through a lock free queue. It has no hardware
+ * dependencies of its own; the caller supplies the times and levels.
+ */
+
+#ifndef MSFSAMPLER_H_
+#define MSFSAMPLER_H_
+
+#include <stdint.h>
+#include "periodqueue.h"
+
+void MSFSampler_init(void);
+void MSFSampler_sample(uint32_t tickCount, int msfLevel);
+void MSFSampler_edge(uint32_t edgeTime, uint32_t edgeTicks, int msfLevel);
+void MSFSampler_poll(uint32_t time, uint32_t ticks);
+bool MSFSampler_getEvent(struct MSF_PERIOD_EVENT& event);
+
+#endif /* MSFSAMPLER_H_ */
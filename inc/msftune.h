@@ -0,0 +1,57 @@
+/*
+ * msftune.h
+ *
+ * Tunes the second classifier to the receiver. The period lengths of the
+ * seconds of good decodes are learnt into a histogram for each class of
+ * period, and the classifier's targets and match error limit are worked
+ * out again from them after each good decode.
+ */
+
+#ifndef MSFTUNE_H_
+#define MSFTUNE_H_
+
+#include <stdint.h>
+#include "msg.h"
+#include "msfclassify.h"
+
+/*!
+ * Each period histogram has a bin per tick of difference from the ideal
+ * length, from -MSF_TUNE_BIN_OFFSET ticks up. Periods further out are
+ * counted in the end bins.
+ */
+const uint32_t MSF_TUNE_BINS = 16;
+/*! The bin of a period of exactly the ideal length */
+const int MSF_TUNE_BIN_OFFSET = 8;
+/*!
+ * The periods a class must have learnt to be centred from its own
+ * histogram. Until then it is centred from those of its level together.
+ */
+const uint32_t MSF_TUNE_MIN_COUNT = 32;
+/*!
+ * A histogram is halved once it has learnt this many periods, so it
+ * follows a receiver that drifts, say with temperature
+ */
+const uint32_t MSF_TUNE_MAX_COUNT = 512;
+/*! The width of each match error histogram bin */
+const uint32_t MSF_TUNE_COST_BIN_WIDTH = 16;
+/*! The match error histogram covers errors up to MSF_MAX_SECOND_ERROR */
+const uint32_t MSF_TUNE_COST_BINS =
+    (MSF_MAX_SECOND_ERROR + MSF_TUNE_COST_BIN_WIDTH - 1) /
+    MSF_TUNE_COST_BIN_WIDTH;
+/*!
+ * The match error limit is twice the error that this percentage of the
+ * seconds learnt come in under
+ */
+const uint32_t MSF_TUNE_COST_PERCENTILE = 95;
+
+void MSFTune_init(void);
+void MSFTune_addSecond(
+    enum MSF_SECOND_TYPE type,
+    const uint8_t* pPeriods,
+    unsigned count,
+    uint32_t cost
+);
+bool MSFTune_update(void);
+void MSFTune_format(CMsg& output);
+
+#endif /* MSFTUNE_H_ */
@@ -4,28 +4,44 @@
 #ifndef MSG_H_
 #define MSG_H_
 
+#include <stddef.h>
 #include <stdint.h>
 /*!
  * Class to build a message with the following form:
  * <ACK|NAK><length.16>*{msg.8}<CRC.16><CR>
  * where length.16 is 4 hex-ascii characters HHLL
  *       CRC.16 is 4 hex-ascii characters HHLL
+ *
+ * The message is written straight into the free space of the USB serial
+ * transmit ring (see USBClaimTx()), with its length and CRC kept as it
+ * grows. Sending it fills in the header and trailer and hands it to the
+ * USB stack, so it is never copied. Only one message can be written at a
+ * time: the ring is claimed from the first append until the message is
+ * sent or cleared.
  */
 class CMsg {
 public:
 	CMsg();
+	~CMsg();
 	void append(const char* pMsg, const char* pSep= ", ");
 	void clear();
-	const char* getErrorMsg(size_t* pTotalLength = 0);
-    const char* getMsg(size_t* pTotalLength = 0);
+	size_t sendErrorMsg();
+    size_t sendMsg();
 private:
-    uint16_t calcCRC();
-    void formMsg();
+    bool claim();
+    size_t send(char type);
 
 private:
-	static const size_t size = 2048;
-	size_t length;
-	char message[size];
+    /*! The transmit ring, while claimed, or 0 */
+    uint8_t* pRing;
+    /*! The ring index of the message header */
+    uint32_t start;
+    /*! The length of the message body so far */
+    size_t length;
+    /*! The CRC-16 of the message body so far */
+    uint16_t crc;
+    /*! The ring could not be claimed, so appends are dropped */
+    bool dropped;
 };
 
 #endif /* MSG_H_ */
@@ -0,0 +1,55 @@
+/*
+ * periodqueue.h
+ *
+ * A lock-free single producer/single consumer queue carrying MSF period
+ * events from the sampler (in the SysTick IRQ) to the decoder (in main).
+ */
+
+#ifndef INC_PERIODQUEUE_H_
+#define INC_PERIODQUEUE_H_
+
+#include <stdint.h>
+#include "spscring.h"
+
+/*!
+ * What a MSF_PERIOD_EVENT reports
+ */
+enum MSF_EVENT_TYPE {
+    MSF_EVENT_MINUTE_START, /*!< A minute marker has been seen, periods follow */
+    /*! Periods follow from part way through a minute, up to its marker */
+    MSF_EVENT_PARTIAL_START,
+    MSF_EVENT_PERIOD,       /*!< A bit period has been recorded */
+    MSF_EVENT_RETRACT,      /*!< The last bit period was noise, drop it */
+    MSF_EVENT_MINUTE_END,   /*!< The next minute marker has been seen */
+    MSF_EVENT_ABORT         /*!< The current minute has been abandoned */
+};
+
+/*!
+ * An event passed from the sampler to the decoder
+ */
+struct MSF_PERIOD_EVENT {
+    /*!
+     * For MSF_EVENT_MINUTE_START and MSF_EVENT_PARTIAL_START, the sequence
+     * number of the sample pool buffer the minute is recorded in. For MSF_EVENT_MINUTE_END, the
+     * ticker time of the minute marker.
+     */
+    uint32_t value;
+    /*! What the event reports (an MSF_EVENT_TYPE) */
+    uint8_t type;
+};
+
+/*!
+ * The number of events the queue holds. Must be a power of 2. There are
+ * at most 4 periods per second, so this gives the decoder several seconds
+ * to catch up.
+ */
+const uint32_t MSF_PERIOD_QUEUE_SIZE = 32;
+
+/*!
+ * The period event queue
+ */
+struct MSF_PERIOD_QUEUE :
+    public SPSC_RING<struct MSF_PERIOD_EVENT, MSF_PERIOD_QUEUE_SIZE> {
+};
+
+#endif /* INC_PERIODQUEUE_H_ */
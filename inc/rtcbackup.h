@@ -0,0 +1,44 @@
+/*
+ * rtcbackup.h
+ *
+ * Keeps the time and the state worth having after a reset in the battery
+ * backed RTC domain. The RTC counts UTC seconds since 1970, set from each
+ * good decode, and the backup registers hold the clock correction and the
+ * read totals.
+ */
+
+#ifndef RTCBACKUP_H_
+#define RTCBACKUP_H_
+
+#include <stdint.h>
+
+/*! Marks the backup registers as holding our state (DR1) */
+const uint16_t RTC_BACKUP_MAGIC = 0x4D53;
+/*! The most LSE start polls before we give up on the RTC */
+const uint32_t RTC_BACKUP_LSE_TIMEOUT = 0x200000;
+/*!
+ * The most polls for an RTC register write or resync before we give up on
+ * the RTC. Either takes a few LSE cycles, around 100us.
+ */
+const uint32_t RTC_BACKUP_WRITE_TIMEOUT = 0x20000;
+/*! The LSE frequency tolerance, in ppm: how fast the RTC time drifts */
+const uint32_t RTC_BACKUP_LSE_PPM = 50;
+/*! The longest, in seconds, since the last fix that the RTC time is used */
+const uint32_t RTC_BACKUP_MAX_FIX_AGE = 30*24*60*60;
+
+/*!
+ * The state restored from the backup domain
+ */
+struct RTC_BACKUP_STATE {
+	uint32_t unixTime;      /*!< The RTC time now, in seconds since 1970 */
+	uint32_t fixAge;        /*!< The seconds since the RTC was last set */
+	int32_t correction;     /*!< The clock correction, in ppb */
+	uint32_t goodCount;     /*!< The total good reads */
+	uint32_t badCount;      /*!< The total bad reads */
+};
+
+bool RTCBackup_init(struct RTC_BACKUP_STATE& state);
+void RTCBackup_saveFix(uint32_t unixTime, int32_t correction);
+void RTCBackup_saveStats(uint32_t goodCount, uint32_t badCount);
+
+#endif /* RTCBACKUP_H_ */
@@ -9,6 +9,8 @@
 #define INC_SAMPLEBUFFER_H_
 
 #include <stddef.h>
+#include <stdint.h>
+#include "membarrier.h"
 
 /*!
  * The number of period samples. For a normal sample set
@@ -17,6 +19,18 @@
  * 'special' times a leap second can be added on).
  */
 const size_t MSF_SAMPLE_BYTE_COUNT = 60*4;
+/*!
+ * The number of second start edge times held. There are normally 61 per
+ * minute (including the minute markers at each end) plus a leap second,
+ * leaving a few spare for noise.
+ */
+const size_t MSF_EDGE_COUNT = 64;
+/*!
+ * Low edges further than this (in us) from a whole second after the
+ * minute marker are not second starts, so are not held. This drops the
+ * B bit low edge at +200ms.
+ */
+const uint32_t MSF_EDGE_GATE = 100000;
 /*!
  * MSF data sample buffer
  */
@@ -26,7 +40,14 @@ struct MSF_SAMPLE_BUFFER {
         MSF_NOONE,      /*!< Buffer is free for use */
         MSF_SAMPLER,    /*!< Owned by the IRQ sampler code */
         MSF_PROCESSER   /*!< Owned by the client processing code */
-    } sampleOwner;
+    };
+    /*! The ownership token, a SAMPLE_OWNER value */
+    volatile uint32_t sampleOwner;
+    /*!
+     * The number of the minute held, counting up from 1 as the sampler
+     * starts each minute. 0 if the buffer has never been used.
+     */
+    volatile uint32_t sampleSequence;
     /*! The ticker time associated with 0 secs */
     uint32_t sampleStartTime;
     /*!
@@ -41,21 +62,79 @@ struct MSF_SAMPLE_BUFFER {
     uint8_t* pWPtr;
     /*! The period samples */
     uint8_t sampleData[MSF_SAMPLE_BYTE_COUNT];
+    /*!
+     * The time (in ticks after edgeStartTime) each period in sampleData
+     * ended. Unlike a sum of the periods, these do not gather rounding
+     * errors along the minute.
+     */
+    uint16_t periodEnds[MSF_SAMPLE_BYTE_COUNT];
+    /*! The sampler time (in us) of the low edge starting the minute marker */
+    uint32_t edgeStartTime;
+    /*!
+     * How well the minute marker ending the minute matched, 0..100 (see
+     * msfFindMarker()). 0 if it was not seen.
+     */
+    uint8_t markerScore;
+    /*! The number of entries in edgeOffsets */
+    uint32_t edgeCount;
+    /*!
+     * The times (in us after edgeStartTime) of the low edges seen while
+     * sampling that lie within MSF_EDGE_GATE of a whole second. These are
+     * the start of each second plus any noise. edgeOffsets[0] is the
+     * minute marker that started the minute, the last entry normally the
+     * one that ended it.
+     */
+    uint32_t edgeOffsets[MSF_EDGE_COUNT];
 
     bool isEmpty(void) const { return pWPtr == sampleData; }
     bool isFull(void) const { return pWPtr >= sampleData+sizeof(sampleData); }
     void setEmpty(void) { pWPtr = sampleData; }
-    void store(uint8_t period) { *pWPtr++ = period; }
+    void store(uint8_t period, uint16_t endTime) {
+        periodEnds[pWPtr - sampleData] = endTime;
+        *pWPtr++ = period;
+    }
     uint8_t unstore() {
         if (pWPtr > sampleData)
             return *--pWPtr;
         return 0;
     }
     void setOwner(enum SAMPLE_OWNER owner) { sampleOwner = owner; }
-    enum SAMPLE_OWNER getOwner(void) const { return sampleOwner; }
+    enum SAMPLE_OWNER getOwner(void) const {
+        return (enum SAMPLE_OWNER)sampleOwner;
+    }
+    /*!
+     * Moves the buffer from one owner to another, if it still has the
+     * expected owner. Safe against the other side doing the same.
+     * @return true if the ownership changed
+     */
+    bool changeOwner(enum SAMPLE_OWNER from, enum SAMPLE_OWNER to) {
+        return atomicCompareAndSwap(&sampleOwner, from, to);
+    }
     void setStartTime(uint32_t time) { sampleStartTime = time; }
+    void setEdgeStart(uint32_t time) { edgeStartTime = time; edgeCount = 0; }
+    /*!
+     * Stores a low edge time if it could be a second start
+     * @return true if stored
+     */
+    bool storeEdge(uint32_t time) {
+        uint32_t offset = time - edgeStartTime;
+        uint32_t fraction = offset % 1000000UL;
+        if ((edgeCount < MSF_EDGE_COUNT) &&
+            ((fraction < MSF_EDGE_GATE) ||
+             (fraction > 1000000UL - MSF_EDGE_GATE))) {
+            edgeOffsets[edgeCount++] = offset;
+            return true;
+        }
+        return false;
+    }
+    void unstoreEdge(void) {
+        /* The minute marker is never dropped */
+        if (edgeCount > 1)
+            --edgeCount;
+    }
     void resetRead(void) { this->pRPtr = this->sampleData; }
     size_t getReadOffset() { return this->pRPtr - this->sampleData; }
+    size_t getWriteOffset() const { return this->pWPtr - this->sampleData; }
     bool readNext(
         uint8_t& data
     ) {
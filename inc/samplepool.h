@@ -0,0 +1,30 @@
+/*
+ * samplepool.h
+ *
+ * A pool of MSF sample buffers shared between the sampler (in the SysTick
+ * IRQ) and the decoder (in main). The sampler records each minute into
+ * the buffer holding the oldest minute, so the most recent minutes are
+ * kept for as long as possible.
+ */
+
+#ifndef INC_SAMPLEPOOL_H_
+#define INC_SAMPLEPOOL_H_
+
+#include <stdint.h>
+#include "samplebuffer.h"
+
+/*!
+ * The number of buffers in the pool. The decoder holds at most one
+ * buffer at a time, so the sampler always has a free one; the rest hold
+ * the previous minutes.
+ */
+const size_t MSF_SAMPLE_POOL_SIZE = 4;
+
+void SamplePool_init(void);
+struct MSF_SAMPLE_BUFFER* SamplePool_startMinute(void);
+void SamplePool_endMinute(struct MSF_SAMPLE_BUFFER* pBuffer);
+struct MSF_SAMPLE_BUFFER* SamplePool_find(uint32_t sequence);
+bool SamplePool_claim(struct MSF_SAMPLE_BUFFER* pBuffer, uint32_t sequence);
+void SamplePool_release(struct MSF_SAMPLE_BUFFER* pBuffer);
+
+#endif /* INC_SAMPLEPOOL_H_ */
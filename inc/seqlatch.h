@@ -0,0 +1,58 @@
+/*
+ * seqlatch.h
+ *
+ * A sequence counted latch: a value written by one context (usually an
+ * IRQ handler) which any context can read without masking interrupts.
+ */
+
+#ifndef SEQLATCH_H_
+#define SEQLATCH_H_
+
+#include <stdint.h>
+#include "membarrier.h"
+
+/*!
+ * Holds two copies of the value. The writer updates them one at a time,
+ * bumping the sequence count before each, so that the copy selected by
+ * the low bit of the sequence is never the one being written. A reader
+ * retries only if the writer moved on while it was copying; a reader
+ * which has interrupted the writer always reads the finished copy, so it
+ * never waits on it as it would with a plain seqlock.
+ */
+template <typename T>
+struct SEQ_LATCH {
+    volatile uint32_t sequence;
+    T copies[2];
+
+    /*!
+     * Sets the value. Only one context may write.
+     */
+    void write(
+        const T& value
+    ) {
+        ++sequence;
+        MEMORY_BARRIER();
+        copies[0] = value;
+        MEMORY_BARRIER();
+        ++sequence;
+        MEMORY_BARRIER();
+        copies[1] = value;
+        MEMORY_BARRIER();
+    }
+    /*!
+     * Gets the value. May be called from any context.
+     */
+    void read(
+        T& value
+    ) const {
+        uint32_t seq;
+        do {
+            seq = sequence;
+            MEMORY_BARRIER();
+            value = copies[seq & 1];
+            MEMORY_BARRIER();
+        } while (seq != sequence);
+    }
+};
+
+#endif /* SEQLATCH_H_ */
@@ -0,0 +1,162 @@
+/*
+ * spscring.h
+ *
+ * A lock-free single producer/single consumer ring of items, for handing
+ * data between interrupt and main line code without disabling interrupts.
+ */
+
+#ifndef SPSCRING_H_
+#define SPSCRING_H_
+
+#include <stdint.h>
+#include "membarrier.h"
+
+/*!
+ * The ring. Only the producer writes head and only the consumer writes
+ * tail; both run freely and are masked down to an index, so (head - tail)
+ * is always the number of items in the ring. Besides pushing and popping
+ * single items, either side can work on the ring in place: writeSpan()
+ * and readSpan() give the longest run of free or filled items that does
+ * not wrap, and commitWrite() and commitRead() hand over what was done
+ * with it.
+ * @param T the item type
+ * @param SIZE the number of items the ring holds. Must be a power of 2.
+ */
+template <typename T, uint32_t SIZE>
+struct SPSC_RING {
+    typedef char sizeIsPowerOf2[((SIZE & (SIZE - 1)) == 0) ? 1 : -1];
+
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    T items[SIZE];
+
+    void init(void) { head = 0; tail = 0; }
+    bool isEmpty(void) const { return head == tail; }
+    bool isFull(void) const { return (head - tail) >= SIZE; }
+    /*! The items in the ring */
+    uint32_t count(void) const { return head - tail; }
+    /*! The items free. Producer side only. */
+    uint32_t space(void) const { return SIZE - (head - tail); }
+    /*!
+     * Adds an item. Producer side only.
+     * @return false if the ring is full and the item was dropped
+     */
+    bool push(
+        const T& item
+    ) {
+        uint32_t h = head;
+        if ((h - tail) >= SIZE)
+            return false;
+        items[h & (SIZE - 1)] = item;
+        MEMORY_BARRIER();
+        head = h + 1;
+        return true;
+    }
+    /*!
+     * Removes the oldest item. Consumer side only.
+     * @return false if the ring is empty
+     */
+    bool pop(
+        T& item
+    ) {
+        uint32_t t = tail;
+        if (head == t)
+            return false;
+        MEMORY_BARRIER();
+        item = items[t & (SIZE - 1)];
+        MEMORY_BARRIER();
+        tail = t + 1;
+        return true;
+    }
+    /*!
+     * Gives the free items that follow the last one added, up to the end
+     * of the ring. Producer side only.
+     * @param length receives the number of free items from there
+     * @return the first free item
+     */
+    T* writeSpan(
+        uint32_t& length
+    ) {
+        uint32_t h = head;
+        uint32_t index = h & (SIZE - 1);
+        length = SIZE - (h - tail);
+        if (length > SIZE - index)
+            length = SIZE - index;
+        return &items[index];
+    }
+    /*!
+     * Adds the items written in place from writeSpan(), or through the
+     * free-running index head. Producer side only.
+     * @param added the number of items written, at most space()
+     */
+    void commitWrite(
+        uint32_t added
+    ) {
+        MEMORY_BARRIER();
+        head = head + added;
+    }
+    /*!
+     * Gives the items that follow the oldest one, up to the end of the
+     * ring. Consumer side only.
+     * @param length receives the number of items from there
+     * @return the oldest item
+     */
+    const T* readSpan(
+        uint32_t& length
+    ) {
+        uint32_t t = tail;
+        uint32_t index = t & (SIZE - 1);
+        length = head - t;
+        if (length > SIZE - index)
+            length = SIZE - index;
+        MEMORY_BARRIER();
+        return &items[index];
+    }
+    /*!
+     * Removes items read in place from readSpan(). Consumer side only.
+     * @param removed the number of items read, at most count()
+     */
+    void commitRead(
+        uint32_t removed
+    ) {
+        MEMORY_BARRIER();
+        tail = tail + removed;
+    }
+    /*!
+     * Adds as many items as there is room for. Producer side only.
+     * @return the number of items added
+     */
+    uint32_t write(
+        const T* pItems,
+        uint32_t length
+    ) {
+        uint32_t h = head;
+        uint32_t free = SIZE - (h - tail);
+        if (length > free)
+            length = free;
+        for (uint32_t idx = 0; idx < length; ++idx)
+            items[(h + idx) & (SIZE - 1)] = pItems[idx];
+        commitWrite(length);
+        return length;
+    }
+    /*!
+     * Removes up to length items. Consumer side only.
+     * @return the number of items removed
+     */
+    uint32_t read(
+        T* pItems,
+        uint32_t length
+    ) {
+        uint32_t t = tail;
+        uint32_t filled = head - t;
+        if (length > filled)
+            length = filled;
+        MEMORY_BARRIER();
+        for (uint32_t idx = 0; idx < length; ++idx)
+            pItems[idx] = items[(t + idx) & (SIZE - 1)];
+        commitRead(length);
+        return length;
+    }
+};
+
+#endif /* SPSCRING_H_ */
@@ -8,11 +8,15 @@
 #ifndef SYSTICK_H_
 #define SYSTICK_H_
 
+#include <stdint.h>
+
 const unsigned SYSTICK_ONESEC = 100;
+const unsigned SYSTICK_US_PER_TICK = 1000000/SYSTICK_ONESEC;
 void SysTick_init(void);
 uint32_t SysTick_readTicks(void);
+uint64_t SysTick_readTicks64(void);
+uint64_t SysTick_readMicros(void);
+void SysTick_setCorrection(int32_t correction);
 bool SysTick_startSample(void);
-struct MSF_SAMPLE_BUFFER* SysTick_getMSFSample(void);
-void SysTick_releaseMSFSample(void);
 
 #endif /* SYSTICK_H_ */
@@ -0,0 +1,21 @@
+/*
+ * timesource.h
+ *
+ * Gives the current UTC time to microsecond resolution, interpolated from
+ * the last good MSF decode with the (disciplined) local clock.
+ */
+
+#ifndef TIMESOURCE_H_
+#define TIMESOURCE_H_
+
+#include <stdint.h>
+#include "msf.h"
+
+void TimeSource_init(void);
+void TimeSource_setMinute(const struct MSF_DATE_TIME& dateTime);
+void TimeSource_setApproximate(uint32_t unixTime, uint32_t errorBound);
+bool TimeSource_readUTC(uint64_t& utcTime, bool* pApproximate = 0,
+                        uint32_t* pErrorBound = 0);
+uint32_t TimeSource_unixTime(const struct MSF_DATE_TIME& dateTime);
+
+#endif /* TIMESOURCE_H_ */
@@ -57,8 +57,9 @@
 #define ENDP0_TXADDR        (0x80)
 
 /* EP1  */
-/* tx buffer base address */
-#define ENDP1_TXADDR        (0xC0)
+/* double buffered tx buffer base addresses */
+#define ENDP1_BUF0ADDR      (0xC0)
+#define ENDP1_BUF1ADDR      (0x150)
 #define ENDP2_TXADDR        (0x100)
 #define ENDP3_RXADDR        (0x110)
 
@@ -69,7 +70,7 @@
 /* IMR_MSK */
 /* mask defining which events has to be handled */
 /* by the device application software */
-#define IMR_MSK (CNTR_CTRM  | CNTR_WKUPM | CNTR_SUSPM | CNTR_ERRM  | CNTR_SOFM \
+#define IMR_MSK (CNTR_CTRM  | CNTR_WKUPM | CNTR_SUSPM | CNTR_ERRM \
                  | CNTR_ESOFM | CNTR_RESETM )
 
 /*#define CTR_CALLBACK*/
@@ -78,7 +79,7 @@
 /*#define WKUP_CALLBACK*/
 /*#define SUSP_CALLBACK*/
 /*#define RESET_CALLBACK*/
-#define SOF_CALLBACK
+/*#define SOF_CALLBACK*/
 /*#define ESOF_CALLBACK*/
 /* CTR service routines */
 /* associated to defined endpoints */
@@ -8,12 +8,22 @@
 #ifndef USB_ENDP_H_
 #define USB_ENDP_H_
 
+#include <stdint.h>
+
+/*! The size of the serial transmit ring; must be a power of 2 */
+#define USB_TX_BUFF_SIZE   2048
+
 #if defined __cplusplus
 extern "C" {
 #endif
 
 uint32_t USBPutSerial(const uint8_t *ptrBuffer, uint32_t Send_length);
 uint32_t USBGetSerial(uint8_t *ptrBuffer, uint32_t bufferLength);
+uint8_t* USBClaimTx(uint32_t *pStart);
+uint32_t USBFreeTx(void);
+void USBCommitTx(uint32_t length);
+void USBResetTx(void);
+void USBServiceTx(void);
 
 #if defined __cplusplus
 }
@@ -0,0 +1,87 @@
+/*
+ * lm75.cpp
+ *
+ * Polled I2C reads of the LM75 temperature sensor. The LM75 powers up
+ * pointing at its temperature register, and we never move the pointer,
+ * so a read is just a two byte receive. Every wait is bounded, so a
+ * missing or stuck sensor costs a few hundred us rather than a hang.
+ *
+ */
+
+#include "stm32f10x.h"
+#include "stm3210b_lctech.h"
+#include "lm75.h"
+
+/*! The most status polls we make waiting for each step of a read */
+const uint32_t LM75_TIMEOUT = 10000;
+
+/*!
+ * Waits for any of a set of I2C SR1 flags
+ * @param flags the SR1 flags to wait for
+ * @return false if none were set before we timed out
+ */
+static bool waitSR1(
+	uint16_t flags
+) {
+	for (uint32_t count = 0; count < LM75_TIMEOUT; ++count) {
+		if (LM75_I2C->SR1 & flags) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*!
+ * Sets up I2C1 to talk to the LM75
+ */
+void LM75_init(void) {
+	I2C_InitTypeDef I2C_InitStructure;
+
+	LM75_LowLevel_Init();
+	I2C_DeInit(LM75_I2C);
+	I2C_InitStructure.I2C_Mode = I2C_Mode_I2C;
+	I2C_InitStructure.I2C_DutyCycle = I2C_DutyCycle_2;
+	I2C_InitStructure.I2C_OwnAddress1 = 0x00;
+	I2C_InitStructure.I2C_Ack = I2C_Ack_Enable;
+	I2C_InitStructure.I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit;
+	I2C_InitStructure.I2C_ClockSpeed = LM75_I2C_SPEED;
+	I2C_Init(LM75_I2C, &I2C_InitStructure);
+	I2C_Cmd(LM75_I2C, ENABLE);
+}
+
+/*!
+ * Reads the temperature. Main line code only; a read takes around 300us.
+ * @param temperature assigned the temperature, in 1/256ths of a degree C
+ * @return false if the LM75 did not answer
+ */
+bool LM75_readTemperature(
+	int16_t& temperature
+) {
+	bool ok = false;
+	LM75_I2C->CR1 |= I2C_CR1_START;
+	if (waitSR1(I2C_SR1_SB)) {
+		LM75_I2C->DR = LM75_ADDRESS | 1;
+		if (waitSR1(I2C_SR1_ADDR | I2C_SR1_AF)) {
+			if (!(LM75_I2C->SR1 & I2C_SR1_AF)) {
+				/* NACK the second byte: set before ADDR is cleared */
+				LM75_I2C->CR1 = (LM75_I2C->CR1 & ~I2C_CR1_ACK) | I2C_CR1_POS;
+				(void)LM75_I2C->SR1;
+				(void)LM75_I2C->SR2;
+				if (waitSR1(I2C_SR1_BTF)) {
+					LM75_I2C->CR1 |= I2C_CR1_STOP;
+					uint16_t msb = LM75_I2C->DR & 0xFF;
+					uint16_t lsb = LM75_I2C->DR & 0xFF;
+					/* The reading is left justified, the LSBs are zero */
+					temperature = (int16_t)((msb << 8) | lsb);
+					ok = true;
+				}
+			}
+		}
+	}
+	if (!ok) {
+		LM75_I2C->SR1 = (uint16_t)~I2C_SR1_AF;
+		LM75_I2C->CR1 |= I2C_CR1_STOP;
+	}
+	LM75_I2C->CR1 = (LM75_I2C->CR1 & ~I2C_CR1_POS) | I2C_CR1_ACK;
+	return ok;
+}
@@ -13,7 +13,17 @@
 #include "usb_pwr.h"
 #include "usb_endp.h"
 #include "msf.h"
-#include "samplebuffer.h"
+#include "msf_hal.h"
+#include "msffll.h"
+#include "msfholdover.h"
+#include "msfreport.h"
+#include "msftune.h"
+#include "lm75.h"
+#include "rtcbackup.h"
+#include "timesource.h"
+#include "msfsampler.h"
+#include "periodqueue.h"
+#include "samplepool.h"
 
 #pragma import(__use_no_semihosting)
 
@@ -27,6 +37,15 @@ static uint32_t goodCount = 0;
  * We get 1 read per min, so 32 bits should be good for 8000 years!
  */
 static uint32_t badCount = 0;
+/*!
+ * The host has asked for binary decode reports (see msfreport.h) rather
+ * than text ones
+ */
+static bool binaryReports = false;
+/*!
+ * Decodes each minute as the sampler sends us its bit periods
+ */
+static struct MSF_STREAM_DECODER decoder;
 /*!
  * We holds read totals for the last 10, 60 and 1440 minutes. For such short
  * periods, 16 bit count values are sufficient (max value of 1440!).
@@ -126,26 +145,103 @@ static void statsUpdate(bool wasGood) {
             }
         }
     }
+    RTCBackup_saveStats(goodCount, badCount);
 }
 
 /*!
  * Services data we _receive_ via USB i.e. data sent from the host PC to
- * us. We dont currently have a use for this, so we just echo what we
- * receive back to the host - at least this can be used to verify we are
- * operational.
+ * us. The host selects binary or text decode reports by sending
+ * MSF_REPORT_SELECT_BINARY or MSF_REPORT_SELECT_TEXT. While reports are
+ * text, we echo what we receive back to the host - at least this can be
+ * used to verify we are operational.
  */
 static void serviceUSB() {
     char tempBuff[128];
     if (USBDeviceState == CONFIGURED) {
         size_t messageLen = USBGetSerial((uint8_t *)tempBuff,
                                   (uint32_t)sizeof(tempBuff));
-        if (messageLen > 0) {
+        for (size_t idx = 0; idx < messageLen; ++idx) {
+            if (tempBuff[idx] == MSF_REPORT_SELECT_BINARY) {
+                binaryReports = true;
+            } else if (tempBuff[idx] == MSF_REPORT_SELECT_TEXT) {
+                binaryReports = false;
+            }
+        }
+        if ((messageLen > 0) && !binaryReports) {
             USBPutSerial((uint8_t *)tempBuff,
                           (uint32_t)messageLen);
         }
     }
 }
 
+/*!
+ * Once a second, passes the board temperature to the holdover model and
+ * steers the system tick from it while in holdover. Once a minute in
+ * holdover, reports the time and its error bound; until the first decode
+ * after a warm start, reports the time restored from the RTC and how
+ * far out it may be.
+ */
+static void serviceHoldover() {
+    static uint32_t lastTicks = 0;
+    static uint32_t seconds = 0;
+    static int16_t temperature = 0;
+    uint32_t ticks = SysTick_readTicks();
+    if (ticks - lastTicks < SYSTICK_ONESEC) {
+        return;
+    }
+    lastTicks = ticks;
+    if (LM75_readTemperature(temperature)) {
+        MSFHoldover_setTemperature(temperature);
+    }
+    if (MSFHoldover_service()) {
+        SysTick_setCorrection(MSFHoldover_readCorrection());
+        /* Keep the loop measuring against the clock we are running */
+        MSFFLL_setCorrection(MSFHoldover_readCorrection());
+    }
+    uint64_t utcTime;
+    bool approximate = false;
+    uint32_t rtcErrorBound = 0;
+    if ((++seconds % 60 != 0) ||
+        !TimeSource_readUTC(utcTime, &approximate, &rtcErrorBound) ||
+        !(MSFHoldover_isActive() || approximate)) {
+        return;
+    }
+    static CMsg holdoverMsg;
+    char tempBuff[80];
+    /* Format the sign apart, so that -0.5C does not come out as 0.50C */
+    unsigned tempMagnitude = (temperature < 0) ?
+                             (unsigned)-temperature : (unsigned)temperature;
+    const char* pTempSign = (temperature < 0) ? "-" : "";
+    if (approximate) {
+        snprintf(
+            tempBuff, sizeof(tempBuff),
+            "RTC|%u|+-%us|%dppb|%s%u.%02uC",
+            (unsigned)(utcTime/1000000), (unsigned)rtcErrorBound,
+            MSFFLL_readCorrection(),
+            pTempSign, tempMagnitude/256, (tempMagnitude & 0xFF)*100/256);
+    } else {
+        snprintf(
+            tempBuff, sizeof(tempBuff),
+            "HOLDOVER|%u.%06u|+-%uus|%dppb|%s%u.%02uC",
+            (unsigned)(utcTime/1000000), (unsigned)(utcTime%1000000),
+            MSFHoldover_readErrorBound(), MSFHoldover_readCorrection(),
+            pTempSign, tempMagnitude/256, (tempMagnitude & 0xFF)*100/256);
+    }
+    holdoverMsg.append(tempBuff, 0);
+    holdoverMsg.sendMsg();
+}
+
+/*!
+ * Sends the classifier tuning learnt for the receiver to the host, as
+ * TUNE|<class centres>|max <error limit>|<seconds learnt> secs
+ */
+static void reportTuning() {
+    static CMsg tuneMsg;
+    tuneMsg.append("TUNE", 0);
+    MSFTune_format(tuneMsg);
+    tuneMsg.sendMsg();
+}
+
 static void addStatsUpdate(
     CMsg& msg
 ) {
@@ -160,16 +256,114 @@ static void addStatsUpdate(
     msg.append(tempBuff, "|");
 }
 
+/*!
+ * Sends the result of decoding a minute to the host as a binary report
+ * @param decodeOK true if the decode was good
+ * @param dateTime the decoded date/time, if decodeOK
+ */
+static void sendBinaryReport(
+    bool decodeOK,
+    const struct MSF_DATE_TIME& dateTime
+) {
+    struct MSF_REPORT report;
+    uint8_t frame[MSF_REPORT_FRAME_SIZE];
+    MSFReport_setTime(report, decodeOK, dateTime);
+    report.goodCount = goodCount;
+    report.badCount = badCount;
+    report.recent[0] = S10.goodCount;
+    report.recent[1] = S10.badCount;
+    report.recent[2] = S60.goodCount;
+    report.recent[3] = S60.badCount;
+    report.recent[4] = S1440.goodCount;
+    report.recent[5] = S1440.badCount;
+    if (USBDeviceState == CONFIGURED) {
+        USBPutSerial(frame, (uint32_t)MSFReport_encode(report, frame));
+    }
+}
+
+/*!
+ * Acts on the result of decoding a minute: a good decode steers the clocks,
+ * sets the time and retunes the classifier. Either way the read stats are
+ * updated and the result sent to the host, as text or as a binary report
+ * as the host asked, followed by the new tuning if it changed.
+ * @param decodeOK true if the decode was good
+ * @param dateTime the decoded date/time, if decodeOK
+ * @param decodeMsg any decode failure reason
+ */
+static void reportDecode(
+    bool decodeOK,
+    const struct MSF_DATE_TIME& dateTime,
+    CMsg& decodeMsg
+) {
+	bool retuned = false;
+	if (decodeOK) {
+		if (MSFFLL_update(dateTime)) {
+			SysTick_setCorrection(MSFFLL_readCorrection());
+			MSFHoldover_learn(MSFFLL_readClockError());
+		}
+		MSFHoldover_fix((dateTime.usAtTimeError != 0) ?
+						dateTime.usAtTimeError :
+						SYSTICK_US_PER_TICK);
+		TimeSource_setMinute(dateTime);
+		uint64_t utcTime;
+		if (TimeSource_readUTC(utcTime)) {
+			RTCBackup_saveFix((uint32_t)(utcTime/1000000),
+							  MSFFLL_readCorrection());
+		}
+		retuned = MSFTune_update();
+        statsUpdate(true);
+	} else {
+        statsUpdate(false);
+	}
+	if (binaryReports) {
+		/* The binary report has no room for the failure reason */
+		decodeMsg.clear();
+		sendBinaryReport(decodeOK, dateTime);
+	} else if (decodeOK) {
+        formatMSFDateTime(dateTime, decodeMsg);
+        addStatsUpdate(decodeMsg);
+		decodeMsg.sendMsg();
+	} else {
+        addStatsUpdate(decodeMsg);
+        decodeMsg.sendErrorMsg();
+	}
+	if (retuned) {
+		reportTuning();
+	}
+}
+
 /*!
  * Our main processing loop
  */
 int main(void) {
     CMsg decodeMsg;
-    const char* cdcMessage;
-    size_t cdcMessageLength;
 
     statsInit();
+    /* Polled sampler times come from the corrected tick count */
+    MSFFLL_init(MSF_EDGE_CAPTURE == 0);
+    TimeSource_init();
+    MSFHoldover_init();
+    msfStreamInit(decoder);
+    MSFTune_init();
     SysTick_init();
+    /* Carry on from where we were before the reset, if the RTC kept going */
+    struct RTC_BACKUP_STATE backup;
+    if (RTCBackup_init(backup)) {
+        goodCount = backup.goodCount;
+        badCount = backup.badCount;
+        SysTick_setCorrection(backup.correction);
+        MSFFLL_setCorrection(backup.correction);
+        /*
+         * The RTC has run from the LSE alone since the last fix, so it
+         * may be out by the LSE tolerance over that time, on top of the
+         * second it counts in. After too long it is not used at all.
+         */
+        if (backup.fixAge <= RTC_BACKUP_MAX_FIX_AGE) {
+            TimeSource_setApproximate(
+                backup.unixTime,
+                1 + backup.fixAge/(1000000/RTC_BACKUP_LSE_PPM));
+        }
+    }
 	Set_System();
 	Set_USBClock();
 	USB_Interrupts_Config();
@@ -177,33 +371,56 @@ int main(void) {
 	disableMSFReceiver();
 	configureMSFIO();
 	enableMSFReceiver();
+	LM75_init();
 
 
 	while (1) {
-		struct MSF_SAMPLE_BUFFER* pSampleBuffer = 0;
-		while ((pSampleBuffer=SysTick_getMSFSample()) == 0) {
+		struct MSF_PERIOD_EVENT event;
+		while (!MSFSampler_getEvent(event)) {
 		    serviceUSB();
+		    serviceHoldover();
 		}
-		struct MSF_DATE_TIME dateTime;
-		decodeMsg.clear();
-		bool decodeOK = decodeMSFSampleBuffer(
-			pSampleBuffer, dateTime, decodeMsg);
-		SysTick_releaseMSFSample();
-		if (decodeOK) {
-            formatMSFDateTime(dateTime, decodeMsg);
-            statsUpdate(true);
-            addStatsUpdate(decodeMsg);
-			cdcMessage = decodeMsg.getMsg(&cdcMessageLength);
-		} else {
-            statsUpdate(false);
-            addStatsUpdate(decodeMsg);
-            cdcMessage = decodeMsg.getErrorMsg(&cdcMessageLength);
-		}
-		if (cdcMessageLength > 0) {
-			if (USBDeviceState == CONFIGURED) {
-				USBPutSerial((uint8_t *)cdcMessage,
-							  (uint32_t)cdcMessageLength);
+		if ((event.type == MSF_EVENT_MINUTE_START) ||
+			(event.type == MSF_EVENT_PARTIAL_START)) {
+			struct MSF_SAMPLE_BUFFER* pRecord = SamplePool_find(event.value);
+			decodeMsg.clear();
+			if (pRecord != 0) {
+				msfStreamStart(decoder, pRecord,
+							   event.type == MSF_EVENT_PARTIAL_START);
+			} else {
+				msfStreamAbort(decoder);
+			}
+		} else if (event.type == MSF_EVENT_PERIOD) {
+			struct MSF_DATE_TIME dateTime;
+			if (msfStreamPeriod(decoder, dateTime)) {
+				/* Completed the partial minute before this one */
+				reportDecode(true, dateTime, decodeMsg);
+				decodeMsg.clear();
 			}
+		} else if (event.type == MSF_EVENT_RETRACT) {
+			msfStreamRetract(decoder);
+		} else if (event.type == MSF_EVENT_MINUTE_END) {
+			if (decoder.active &&
+				SamplePool_claim(decoder.pRecord, decoder.sequence)) {
+				struct MSF_DATE_TIME dateTime;
+				bool decodeOK = msfStreamEnd(
+					decoder, event.value, dateTime, decodeMsg);
+				SamplePool_release(decoder.pRecord);
+				/*
+				 * A partial minute is reported once the next minute
+				 * completes it, if it can
+				 */
+				if (!decoder.extract.partial) {
+					reportDecode(decodeOK, dateTime, decodeMsg);
+				} else {
+					/* Give up the USB transmit ring until then */
+					decodeMsg.clear();
+				}
+			} else {
+				msfStreamAbort(decoder);
+			}
+		} else {
+			msfStreamAbort(decoder);
 		}
 	}
 }
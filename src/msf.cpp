@@ -7,82 +7,13 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
-#include <stdlib.h>
-#include "stm32f10x.h"
 #include "msf.h"
 #include "systick.h"
 #include "msg.h"
-
-#define A(X) (ABits[(X)-1])
-#define B(X) (BBits[(X)-1])
-
-/*!
- * System ticker time values for the 100..900ms intervals
- */
-const int ms100 = 100*SYSTICK_ONESEC/1000;
-const int ms200 = 200*SYSTICK_ONESEC/1000;
-const int ms300 = 300*SYSTICK_ONESEC/1000;
-const int ms700 = 700*SYSTICK_ONESEC/1000;
-const int ms800 = 800*SYSTICK_ONESEC/1000;
-const int ms900 = 900*SYSTICK_ONESEC/1000;
-
-/*!
- * Indicates if the MSF receiver module has been enabled
- * @return true if enabled, false if not
- */
-bool isMSFReceiverEnabled(void) {
-	if (GPIOB->ODR & (1 << 1))
-		return false;
-	return true;
-}
-
-/*!
- * Enables the MSF receiver module
- */
-void enableMSFReceiver(void) {
-	GPIOB->BRR = (1 << 1);
-}
-
-/*!
- * Disables the MSF receiver module
- */
-void disableMSFReceiver(void) {
-	GPIOB->BSRR = (1 << 1);
-}
-
-/*!
- * Configures the STM32 IO to interface to the MSF receiver module.
- * PB0 = MSF receiver data output (input to us)
- * PB1 = MSF receiver enable (output from us)
- * PB2 = Output from us toggled each time we sample the MSF data
- */
-void configureMSFIO(void) {
-	/* Enable GPIOB Clock */
-	RCC->APB2ENR |= (1UL << 3);
-	/*
-	 * PortB0 = Data      (Input)
-	 *    1000 = Input with pull up/pull down
-	 * PortB1 = /ENABLE   (Output, 0 to enable, 1 to disable)
-	 *    0010 = Output max speed 2MHz, push/pull output
-	 * PortB2 = /ENABLE   (Output, 0 to enable, 1 to disable)
-	 *    0010 = Output max speed 2MHz, push/pull output
-	 */
-	GPIOB->CRL = (GPIOB->CRL & 0xFFFFF000) | 0x00000228;
-}
-
-/*!
- * Returns current MSF bit level
- * \return 0/1
- */
-int msfSample(void) {
-	/*
-	 * Toggle the sample indicator to generate a signal
-	 * output at 1/2 our sampling frequency.
-	 */
-	GPIOB->ODR = GPIOB->ODR ^ (1 << 2);
-	/* The input is inverted */
-	return (GPIOB->IDR & 1) ? 0 : 1;
-}
+#include "msfframe.h"
+#include "msfclassify.h"
+#include "msfphase.h"
+#include "msftune.h"
 
 /*!
  * Prints out the bit periods found in a MSF sample buffer
@@ -103,7 +34,7 @@ static void showMSFBitPeriods(
 		while (pRPtr != pSampleBuffer->pWPtr) {
 		    snprintf(
 		        messageBuff, sizeof(messageBuff),
-	            "%u:%d:%u", sampleIdx++, level, *pRPtr);
+	            "%u:%d:%u", (unsigned)sampleIdx++, level, *pRPtr);
 	        decodeMsg.append(messageBuff, "|");
 			level = 1 - level;
 			++pRPtr;
@@ -132,142 +63,209 @@ bool msfPeriodLengthMatch(
 }
 
 /*!
- * Calculates an error score for how well two period match two target periods.
- * If the match is exact [(p1 == m1) and (p2 == m2) _and_ the two bit periods
- * add up to 1000ms] the returned value is 0 - the minimum error (maximum match).
- * As the p values move away from the m values the error score will increase.
- * @param p1 the test period 1
- * @param p2 the test period 2
- * @param m1 the target period 1
- * @param m2 the target period 2
+ * Stores the A/B bit values for one second into a frame
+ * @param frame the frame, which must have been cleared before the first
+ *        second is stored
+ * @param secsIdx the 0.. based index of the second after the minute marker
+ *        i.e. MSF bit (secsIdx + 1). Seconds past the end of the frame are
+ *        dropped.
+ * @param aBit the A bit value (0/1)
+ * @param bBit the B bit value (0/1)
  */
-static uint32_t msfPeriodMatch2Periods(
-    int p1,
-    int p2,
-    int m1,
-    int m2
+static inline void storeABBits(
+	struct MSF_FRAME& frame,
+	size_t secsIdx,
+	unsigned aBit,
+	unsigned bBit
 ) {
-    int pcMatch = 0;
-    pcMatch += abs(1000 - 1000*p1/m1);
-    pcMatch += abs(1000 - 1000*p2/m2);
-    pcMatch += 10*abs(100 - p1 - p2);
-    return (uint32_t)(pcMatch/3);
-}
-
-/*!
- * Calculates an error score for how well two period match 300ms and 700ms.
- * If the match is exact [(p300 == 300ms) and (p700 == 700ms) _and_ the two bit
- * periods add up to 1000ms] the returned value is 0 - the minimum error
- * (maximum match). As the p values move away from the 300/700 ms values the
- * error score will increase.
- * @param p300 the 300ms test period
- * @param p700 the 700ms test period
- */
-static uint32_t msfPeriodMatch_300_700(
-    uint8_t p300,
-    uint8_t p700
-) {
-    return msfPeriodMatch2Periods(p300, p700, ms300, ms700);
-}
-
-/*!
- * Calculates an error score for how well two period match 100ms and 900ms.
- * If the match is exact [(p100 == 100ms) and (p900 == 900ms) _and_ the two bit
- * periods add up to 1000ms] the returned value is 0 - the minimum error
- * (maximum match). As the p values move away from the 100/900 ms values the
- * error score will increase.
- * @param p100 the 100ms test period
- * @param p900 the 900ms test period
- */
-static uint32_t msfPeriodMatch_100_900(
-    uint8_t p100,
-    uint8_t p900
-) {
-    return msfPeriodMatch2Periods(p100, p900, ms100, ms900);
-}
-
-/*!
- * Calculates an error score for how well two period match 200ms and 800ms.
- * If the match is exact [(p200 == 200ms) and (p800 == 800ms) _and_ the two bit
- * periods add up to 1000ms] the returned value is 0 - the minimum error
- * (maximum match). As the p values move away from the 200/800 ms values the
- * error score will increase.
- * @param p200 the 200ms test period
- * @param p800 the 800ms test period
- */
-static uint32_t msfPeriodMatch_200_800(
-    uint8_t p200,
-    uint8_t p800
-) {
-    return msfPeriodMatch2Periods(p200, p800, ms200, ms800);
-}
-
-/*!
- * Calculates an error score for how well four period match 100,100,100,700ms.
- * If the match is exact [(p100_1 == 100ms) and (p100_2 == 100ms) and
- * (p100_3=100ms) _and_ p100_1+p100_2+p100_3+p700 = 1000ms] the returned value
- * is 0 - the minimum error (maximum match). As the values move away from the
- * 100/100/100/700 ms values the error score will increase.
- * @param p100_1 the 100ms test period
- * @param p100_2 the 100ms test period
- * @param p100_3 the 100ms test period
- * @param p700 the 700ms test period
- */
-static uint32_t msfPeriodMatch_100_100_100_700(
-    int p100_1,
-    int p100_2,
-    int p100_3,
-    int p700
-) {
-    int pcMatch = 0;
-    pcMatch += abs(1000 - 1000*p100_1/ms100);
-    pcMatch += abs(1000 - 1000*p100_2/ms100);
-    pcMatch += abs(1000 - 1000*p100_3/ms100);
-    pcMatch += abs(1000 - 1000*p700/ms700);
-    pcMatch += 10*abs(100 - p100_1 - p100_2 - p100_3 - p700);
-    return (uint32_t)(pcMatch/5);
-}
-
-/*!
- * Indicates if a test value is an acceptable error and is the minimum error
- * in a set of 3.
- * @param test the value to test for being the minimum acceptable error
- * @param e1 one of the 3 comparator error values
- * @param e2 one of the 3 comparator error values
- * @param e3 one of the 3 comparator error values
- * @return true if test is an acceptable error value and is smaller than
- *         any in the set {e1,e2,e3}
- */
-static bool isBestError(
-	uint32_t test,
-	uint32_t e1,
-	uint32_t e2,
-	uint32_t e3
-) {
-    bool rCode = false;
-    if (test < 300) {
-        if (test < e1) {
-            if (test < e2) {
-                if (test < e3) {
-                    rCode = true;
-                }
-            }
-        }
-    }
-    return rCode;
+	if (secsIdx < 63) {
+		frame.A |= (MSF_BITS)aBit << (62 - secsIdx);
+		frame.B |= (MSF_BITS)bBit << (62 - secsIdx);
+	}
+}
+
+/*!
+ * Prepares to extract the A,B bits from a new set of bit periods
+ * \param extract the extraction state to reset
+ * \param partial true if the periods start part way through a minute
+ */
+static void resetExtract(
+	struct MSF_EXTRACT_STATE& extract,
+	bool partial
+) {
+	extract.partial = partial;
+	extract.frame.A = 0;
+	extract.frame.B = 0;
+	extract.secsCount = 0;
+	extract.usedCount = 0;
+	extract.erased.A = 0;
+	extract.erased.B = 0;
+	extract.erasureCount = 0;
+	extract.erasureOffset = 0;
+	extract.failed = false;
+	/* Node 0 is the start of the minute, reached at no cost */
+	extract.nodes[0].cost = 0;
+	extract.nodes[0].span = 0;
+	extract.nodeCount = 1;
+}
+
+/*!
+ * Notes the failure to extract a second, keeping its periods and their
+ * match scores for showExtractFailure()
+ * \param pSampleBuffer the bit period data set we work on
+ * \param extract the extraction state we update
+ * \param offset the period offset of the second
+ */
+static void failExtract(
+	const struct MSF_SAMPLE_BUFFER* pSampleBuffer,
+	struct MSF_EXTRACT_STATE& extract,
+	size_t offset
+) {
+	size_t storedCount = pSampleBuffer->getWriteOffset();
+	for (size_t idx = 0; idx < 4; ++idx) {
+		extract.failPeriods[idx] = (offset + idx < storedCount) ?
+			pSampleBuffer->sampleData[offset + idx] : 0;
+	}
+	msfClassifySecond(extract.failPeriods[0], extract.failPeriods[1],
+					  extract.failPeriods[2], extract.failPeriods[3],
+					  offset + 4 <= storedCount, extract.failScores);
+	extract.failOffset = offset;
+	extract.failed = true;
 }
 
 /*!
- * Extracts the A,B bit sets from the bit periods data set
+ * Works out the seconds, and so the A/B bits, from the lowest cost path
+ * through the segmentation nodes. The seconds of a partial minute end at
+ * bit 59, those before its first second being erased.
  * \param pSampleBuffer the bit period data set we work on
- * \param ABits array of A bit values which we assign
- * \param BBits array of B bit values which we assign
- * \param secsCount assigned the number of seconds entries we
- *        extracted. If we fail, this is set to the seconds
- *        entry that we failed at. Note that if there is no
- *        data in the sample buffer we return false with
- *        secsCount set to 0.
- * \return true if full set of A/B bits assigned, false if failed
+ * \param extract the extraction state we update
+ * \param endNode the node at the end of the minute's periods, or of the
+ *        periods so far
+ */
+static void traceSeconds(
+	const struct MSF_SAMPLE_BUFFER* pSampleBuffer,
+	struct MSF_EXTRACT_STATE& extract,
+	size_t endNode
+) {
+	extract.frame.A = 0;
+	extract.frame.B = 0;
+	extract.erased.A = 0;
+	extract.erased.B = 0;
+	extract.erasureCount = 0;
+	extract.erasureOffset = 0;
+	extract.failed = false;
+	if (extract.nodes[endNode].cost == MSF_SEGMENT_UNREACHED) {
+		/* Report from the last point we could reach */
+		size_t node = endNode;
+		while ((node > 0) &&
+			   (extract.nodes[node].cost == MSF_SEGMENT_UNREACHED)) {
+			--node;
+		}
+		failExtract(pSampleBuffer, extract, 2*node);
+		return;
+	}
+	size_t secsCount = 0;
+	size_t node;
+	for (node = endNode; extract.nodes[node].span != 0;
+		 node -= extract.nodes[node].span/2) {
+		secsCount += extract.nodes[node].seconds;
+	}
+	extract.secsCount = secsCount;
+	size_t secsIdx = secsCount;
+	if (extract.partial && (secsCount < MSF_FRAME_SECONDS - 1)) {
+		secsIdx = MSF_FRAME_SECONDS - 1;
+		for (size_t idx = 0; idx < secsIdx - secsCount; ++idx) {
+			storeABBits(extract.erased, idx, 1, 1);
+		}
+	}
+	for (node = endNode; extract.nodes[node].span != 0;
+		 node -= extract.nodes[node].span/2) {
+		const struct MSF_SEGMENT_NODE& second = extract.nodes[node];
+		enum MSF_SECOND_TYPE type = (enum MSF_SECOND_TYPE)second.guess;
+		bool noMatch = (second.type == MSF_SEC_NO_MATCH);
+		bool aErased = noMatch || (second.aConfidence < MSF_LOW_CONFIDENCE);
+		bool bErased = noMatch || (second.bConfidence < MSF_LOW_CONFIDENCE);
+		for (unsigned sec = 0; sec < second.seconds; ++sec) {
+			--secsIdx;
+			storeABBits(extract.frame, secsIdx,
+						msfSecondABit(type), msfSecondBBit(type));
+			storeABBits(extract.erased, secsIdx, aErased, bErased);
+			if (secsIdx < MSF_FRAME_SECONDS) {
+				extract.confidence[secsIdx] =
+					(second.aConfidence < second.bConfidence) ?
+					second.aConfidence : second.bConfidence;
+			}
+			if (aErased || bErased) {
+				++extract.erasureCount;
+			}
+		}
+		if (aErased || bErased) {
+			/* We go backwards, so this ends up as the first */
+			extract.erasureOffset = 2*node - second.span;
+		}
+	}
+}
+
+/*!
+ * Works out the erased A/B bits of a frame where we can: A52..A59 always
+ * hold 01111110, and a single erased bit in an odd parity group (the
+ * parity bit included) is whatever makes the parity good. Erasures in
+ * bits we do not use are ignored.
+ * \param frame the A/B bits, erased bits holding the closest guess. The
+ *        erased bits worked out are set.
+ * \param erased the erased A/B bits. The bits worked out are cleared.
+ * \return false if any bit we use is still erased
+ */
+static bool resolveErasures(
+	struct MSF_FRAME& frame,
+	struct MSF_FRAME& erased
+) {
+	const struct MSF_FIELD& marker = MSF_FIELD_LAYOUT[MSF_FIELD_MARKER];
+	MSF_BITS markerMask = msfFieldMask(marker);
+	MSF_BITS markerBits = (MSF_BITS)MSF_MARKER_CODE <<
+						  (64 - marker.startBit - marker.bitCount);
+	frame.A = (frame.A & ~(erased.A & markerMask)) |
+			  (markerBits & erased.A);
+	erased.A &= ~markerMask;
+	for (unsigned idx = 0; idx < MSF_PARITY_GROUP_COUNT; ++idx) {
+		const struct MSF_PARITY_GROUP& group = MSF_PARITY_GROUPS[idx];
+		MSF_BITS groupMask = msfFieldMask(group.field);
+		unsigned aCount = msfPopCount(erased.A & groupMask);
+		unsigned bCount = msfBitValue(erased.B, group.parityBit);
+		if (aCount + bCount > 1) {
+			return false;
+		}
+		if ((aCount + bCount == 1) && !msfParityGood(frame, group)) {
+			/* Flip the erased bit */
+			if (aCount == 1) {
+				frame.A ^= erased.A & groupMask;
+			} else {
+				frame.B ^= msfBitMask(group.parityBit);
+			}
+		}
+		erased.A &= ~groupMask;
+		erased.B &= ~msfBitMask(group.parityBit);
+	}
+	/* DUT1 and BST have no parity cover */
+	MSF_BITS usedB = msfFieldMask(MSF_FIELD_LAYOUT[MSF_FIELD_DUT1_POS]) |
+					 msfFieldMask(MSF_FIELD_LAYOUT[MSF_FIELD_DUT1_NEG]) |
+					 msfBitMask(MSF_BST_BIT);
+	return (erased.B & usedB) == 0;
+}
+
+/*!
+ * Extracts the A,B bit sets from the bit periods data set. This works
+ * incrementally: it carries on from the nodes already worked out and
+ * can be called again as more periods are stored.
+ * \param pSampleBuffer the bit period data set we work on
+ * \param extract the extraction state we update, holding the segmentation
+ *        nodes and, once all the periods are stored, the packed A/B bits
+ *        and the number of seconds extracted.
+ * \param storedCount the number of periods known to be in the sample buffer.
+ *        The sampler may be storing more as we go.
+ * \param allStored true if the sample buffer holds all of the minute's
+ *        periods. If not we leave the last stored period unused, as it is
+ *        the one most likely to be unstored.
  *
  *  +0   +100 +200 +300 +400 +500 +600 +700 +800 +900 +1000  ms
  *   +----+----+----+----+----+----+----+----+----+----+
@@ -282,110 +280,142 @@ static bool isBestError(
  *   0:200, 1:800,               => Ax = 1, Bx = 0
  *   0:100, 1:100, 0:100, 1:700  => Ax = 0, Bx = 1
  *   0:100, 1:900                => Ax = 0, Bx = 0
- * any other pattern is invalid.
- * We can see from the above that we should get 2 or 4 periods
- * per second from which we can deduce the A/B bit values.
+ * plus, with noise, up to two glitch pulses within any of those.
+ *
+ * Rather than matching each second in turn, which loses the rest of the
+ * minute at the first bad second, we find the split of the whole minute
+ * into seconds with the lowest total match cost (a Viterbi search). Node
+ * n is the boundary before period 2n: its cost is the lowest cost of
+ * reaching it from node n-1, n-2 or n-3 with one second of 2, 4 or 6
+ * periods (see msfClassifySpan()). A second which matches no pattern is
+ * an erasure, so one bad second costs only that second (or two, if noise
+ * hid the start of the next one). A partial minute may start at any
+ * node, its periods before that being skipped at MSF_SKIP_COST a node.
  */
-static bool extractABBits(
+static void extractABBits(
 	struct MSF_SAMPLE_BUFFER* pSampleBuffer,
-	uint8_t ABits[],
-	uint8_t BBits[],
-	size_t& secsCount,
+	struct MSF_EXTRACT_STATE& extract,
+	size_t storedCount,
+	bool allStored
+) {
+	size_t usableCount = allStored ? storedCount :
+						 ((storedCount > 0) ? storedCount - 1 : 0);
+	size_t lastNode = usableCount/2;
+	if (lastNode >= MSF_SEGMENT_NODES) {
+		lastNode = MSF_SEGMENT_NODES - 1;
+	}
+	while (extract.nodeCount <= lastNode) {
+		size_t nodeIdx = extract.nodeCount;
+		struct MSF_SEGMENT_NODE& node = extract.nodes[nodeIdx];
+		node.cost = MSF_SEGMENT_UNREACHED;
+		if (extract.partial) {
+			/* The minute may start at any node, for a cost */
+			node.cost = (uint16_t)(nodeIdx*MSF_SKIP_COST);
+			node.span = 0;
+		}
+		for (unsigned span = 2;
+			 (span <= MSF_MAX_SPAN_PERIODS) && (span <= 2*nodeIdx);
+			 span += 2) {
+			uint16_t fromCost = extract.nodes[nodeIdx - span/2].cost;
+			struct MSF_SPAN_MATCH match;
+			if ((fromCost != MSF_SEGMENT_UNREACHED) &&
+				msfClassifySpan(pSampleBuffer->sampleData + 2*nodeIdx - span,
+								span, match) &&
+				((uint32_t)fromCost + match.cost < node.cost)) {
+				node.cost = (uint16_t)(fromCost + match.cost);
+				node.span = (uint8_t)span;
+				node.seconds = match.seconds;
+				node.type = (uint8_t)match.type;
+				node.guess = (uint8_t)match.guess;
+				node.aConfidence = match.aConfidence;
+				node.bConfidence = match.bConfidence;
+			}
+		}
+		extract.nodeCount += 1;
+	}
+	extract.usedCount = 2*(extract.nodeCount - 1);
+	if (allStored) {
+		traceSeconds(pSampleBuffer, extract, lastNode);
+	}
+}
+
+/*!
+ * Extracts the A,B bit sets by classifying each second from its window on
+ * the second grid set by the minute marker (see msfClassifyGridSecond()),
+ * rather than by splitting the periods into seconds. Each second is read
+ * on its own, so a bad period only costs the second it is in.
+ * \param pSampleBuffer the bit period data set we work on, starting at
+ *        a minute marker
+ * \param frame assigned the A/B bits
+ * \param erased assigned the A/B bits read with too little confidence
+ */
+static void extractGridBits(
+	const struct MSF_SAMPLE_BUFFER* pSampleBuffer,
+	struct MSF_FRAME& frame,
+	struct MSF_FRAME& erased
+) {
+	unsigned count = (unsigned)pSampleBuffer->getWriteOffset();
+	frame.A = 0;
+	frame.B = 0;
+	erased.A = 0;
+	erased.B = 0;
+	for (size_t secsIdx = 0; secsIdx < MSF_FRAME_SECONDS - 1; ++secsIdx) {
+		struct MSF_GRID_SECOND second;
+		msfClassifyGridSecond(pSampleBuffer->sampleData,
+							  pSampleBuffer->periodEnds, count,
+							  (uint32_t)(secsIdx + 1)*SYSTICK_ONESEC, second);
+		storeABBits(frame, secsIdx, second.aBit, second.bBit);
+		storeABBits(erased, secsIdx,
+					second.aConfidence < MSF_GRID_LOW_CONFIDENCE,
+					second.bConfidence < MSF_GRID_LOW_CONFIDENCE);
+	}
+}
+
+/*!
+ * Reports why extractABBits() failed
+ * \param pSampleBuffer the bit period data set we worked on
+ * \param extract the failed extraction state
+ * \param decodeMsg the message the reason is appended to
+ */
+static void showExtractFailure(
+	const struct MSF_SAMPLE_BUFFER* pSampleBuffer,
+	const struct MSF_EXTRACT_STATE& extract,
     CMsg& decodeMsg
 ) {
     char messageBuff[128];
-    bool rCode = true;
-	secsCount = 0;
 	if (pSampleBuffer->isEmpty()) {
         decodeMsg.append("extractABBits failed: sample buffer is empty", 0);
-		rCode = false;
 	} else {
-		bool allDone = false;
-		pSampleBuffer->resetRead();
-		//   v(pRPtr)          v(pSampleBuffer->pWPtr)
-		// x x x x x x x x x x
-		// while we have at least 2 samples to process ...
-		while (!allDone && rCode) {
-            // Inspect first 2 periods
-			size_t startOffset = pSampleBuffer->getReadOffset();
-            uint8_t bitP0;
-            uint8_t bitP1;
-            pSampleBuffer->readNext(bitP0);
-            allDone = !pSampleBuffer->readNext(bitP1);
-            if (!allDone) {
-				uint32_t err_300_700 = msfPeriodMatch_300_700(bitP0, bitP1);
-				uint32_t err_200_800 = msfPeriodMatch_200_800(bitP0, bitP1);
-				uint32_t err_100_900 = msfPeriodMatch_100_900(bitP0, bitP1);
-				uint32_t err_100_100_100_700 = 100;
-	            uint8_t bitP2=0;
-	            uint8_t bitP3=0;
-				if (pSampleBuffer->readPeek(0, bitP2)) {
-					if (pSampleBuffer->readPeek(1, bitP3)) {
-						err_100_100_100_700 = msfPeriodMatch_100_100_100_700(
-								bitP0, bitP1, bitP2, bitP3);
-					}
-				}
-				if (isBestError(err_300_700,
-								err_200_800, err_100_900, err_100_100_100_700)) {
-					ABits[secsCount] = 1;
-					BBits[secsCount] = 1;
-					secsCount += 1;
-				} else if (isBestError(err_200_800,
-								  err_300_700, err_100_900, err_100_100_100_700)) {
-					ABits[secsCount] = 1;
-					BBits[secsCount] = 0;
-					secsCount += 1;
-				} else if (isBestError(err_100_900,
-								  err_300_700, err_200_800, err_100_100_100_700)) {
-					ABits[secsCount] = 0;
-					BBits[secsCount] = 0;
-					secsCount += 1;
-				} else if (isBestError(err_100_100_100_700,
-									   err_300_700, err_200_800, err_100_900)) {
-
-					ABits[secsCount] = 0;
-					BBits[secsCount] = 1;
-					pSampleBuffer->readSkip(2);
-					secsCount += 1;
-				} else {
-					snprintf(
-						messageBuff, sizeof(messageBuff),
-						"extractABBits failed: @%u {%u,%u,%u,%u} %u,%u,%u,%u",
-						startOffset,
-						bitP0, bitP1, bitP2, bitP3,
-		                err_300_700, err_200_800,
-		                err_100_900, err_100_100_100_700
-					);
-					decodeMsg.append(messageBuff, 0);
-					rCode = false;
-				}
-            }
-		}
-	}
-	if (rCode == false) {
-	    showMSFBitPeriods(pSampleBuffer, decodeMsg);
+		snprintf(
+			messageBuff, sizeof(messageBuff),
+			"extractABBits failed: @%u {%u,%u,%u,%u} %u,%u,%u,%u",
+			(unsigned)extract.failOffset,
+			extract.failPeriods[0], extract.failPeriods[1],
+			extract.failPeriods[2], extract.failPeriods[3],
+			extract.failScores.err_300_700, extract.failScores.err_200_800,
+			extract.failScores.err_100_900,
+			extract.failScores.err_100_100_100_700
+		);
+		decodeMsg.append(messageBuff, 0);
 	}
-	return rCode;
+    showMSFBitPeriods(pSampleBuffer, decodeMsg);
 }
 
 /*!
- * Turns an array of A bits and a matching array of B bits into a text string
- * for display.
- * @param ABits and array of A bits - one entry per bit
- * @param BBits and array of B bits - one entry per bit
- * @param secsCount the number of entries in ABits[] and BBits[]
+ * Turns a frame of A/B bits into a text string for display.
+ * @param frame the packed A/B bits
+ * @param secsCount the number of bits to show [0..60]
  * @param decodeMsg - the message into which the text string is appended
  */
 static void showABBitSet(
-	const uint8_t ABits[],
-	const uint8_t BBits[],
+	const struct MSF_FRAME& frame,
 	size_t secsCount,
     CMsg& decodeMsg
 ) {
     char messageBuff[128];
     snprintf(
         messageBuff, sizeof(messageBuff),
-        "Extracted AB bits for %u secs\r", secsCount);
+        "Extracted AB bits for %u secs\r", (unsigned)secsCount);
     decodeMsg.append(messageBuff, "\r");
     /*
      *            1         2         3         4         5         6
@@ -397,14 +427,14 @@ static void showABBitSet(
     decodeMsg.append("  123456789012345678901234567890123456789012345678901234567890\r", 0);
     decodeMsg.append("A=", 0);
     for (size_t idx=0; idx < secsCount; ++idx) {
-        messageBuff[idx]='0' + (ABits[idx] & 1);
+        messageBuff[idx]='0' + msfBitValue(frame.A, idx + 1);
     }
     messageBuff[secsCount]='\r';
     messageBuff[secsCount+1]='\0';
     decodeMsg.append(messageBuff, 0);
     decodeMsg.append("B=", 0);
     for (size_t idx=0; idx < secsCount; ++idx) {
-        messageBuff[idx]='0' + (BBits[idx] & 1);
+        messageBuff[idx]='0' + msfBitValue(frame.B, idx + 1);
     }
     decodeMsg.append(messageBuff, 0);
 }
@@ -421,138 +451,96 @@ static inline uint8_t bcdDecimalValue(
 }
 
 /*!
- * Builds a value from a contiguous set of extracted bits
- * @param bitSet an array containing one entry per bit [x]=0|1
- * @param startBit index of starting bit
- * @param bitCount number of bits (Should be [1..8])
- * @return unsigned 8 bit value
+ * Extracts a BCD field from a frame as a decimal value
+ * @param bits the A or B bits
+ * @param fieldId which field to extract
+ * @return the decimal value of the field
  */
-static uint8_t buildValueFromBitset(
-	const uint8_t bitSet[],
-	size_t startBit,
-	size_t bitCount
+static inline uint8_t bcdFieldValue(
+	MSF_BITS bits,
+	enum MSF_FIELD_ID fieldId
 ) {
-	uint8_t value = 0;
-	for (size_t idx = 0; idx < bitCount; ++idx) {
-		value = (value << 1) | bitSet[startBit-1+idx];
-	}
-	return value;
-}
-
-/*!
- * Counts the number of consecutive 1 bits within a bit set
- * @param bitSet an array containing one entry per bit [x]=0|1
- * @param startBit index of starting bit
- * @param bitCount number of bits to scan
- * @return the number of consecutive 1 bits found [0..bitCount]
- */
-static uint8_t countLeading1Bits(
-	const uint8_t bitSet[],
-	size_t startBit,
-	size_t bitCount
-) {
-	uint8_t count = 0;
-	while (bitCount-- > 0) {
-		if (bitSet[startBit++ - 1] == 1)
-			++count;
-		else
-			break;
-	}
-	return count;
-}
-
-/*!
- * Calculates the parity (xor of bits)
- * @param bitSet an array containing one entry per bit [x]=0|1
- * @param startBit index of starting bit + 1 i.e. index using 1.. based
- *        indexing (done so so that calls to us match the MSF spec for
- *        bit indexing (sorry!))
- * @param bitCount number of bits [1..]
- * @return the xor of each bit bitSet[startBit-1 .. startBit-1+bitCount-1]
- */
-static uint8_t calcParity(
-	const uint8_t bitSet[],
-	size_t startBit,
-	size_t bitCount
-) {
-    startBit -= 1;
-	uint8_t parity = bitSet[startBit++];
-	while (--bitCount > 0) {
-		parity ^= bitSet[startBit++];
-	}
-	return parity;
+	return bcdDecimalValue(
+		(uint8_t)msfFieldValue(bits, MSF_FIELD_LAYOUT[fieldId]));
 }
 
 /*!
  * Decodes an A/B bit set into a MSF_DATE_TIME struct
- * @param ABits array of 0/1 values, one for each bit
- * @param BBits array of 0/1 values, one for each bit
+ * @param frame the packed A/B bits
  * @param msfDateTime assigned the decided date time value
- * @param decodeMsg where we return any error message should
- *        we fail to decode
+ * @param pDecodeMsg where we return any error message should
+ *        we fail to decode, or 0 to fail quietly
  * @return true if decoded OK, false if not
  */
 static bool decodeMSFDateTime(
-	const uint8_t ABits[],
-	const uint8_t BBits[],
+	const struct MSF_FRAME& frame,
 	struct MSF_DATE_TIME& msfDateTime,
-	CMsg& decodeMsg
+	CMsg* pDecodeMsg
 ) {
+	static const char* parityErrors[MSF_PARITY_GROUP_COUNT] = {
+	    "B54 parity error", "B55 parity error",
+	    "B56 parity error", "B57 parity error"
+	};
 	bool rCode = true;
 	/*
 	 * Check bits A52..59 are 01111110
 	 */
-	uint8_t a52_59 = buildValueFromBitset(ABits, 52, 8);
-	if (a52_59 != 0x7E) {
-		decodeMsg.append("A52..59 code check fail");
+	if (msfFieldValue(frame.A, MSF_FIELD_LAYOUT[MSF_FIELD_MARKER]) !=
+	        MSF_MARKER_CODE) {
 		rCode =false;
+		if (pDecodeMsg != 0) {
+			pDecodeMsg->append("A52..59 code check fail");
+		}
 	}
 	/*
 	 * Figure out the DUT1 value
 	 */
-	uint8_t oneCount = countLeading1Bits(BBits,1,8);
+	unsigned oneCount = msfFieldLeading1Bits(
+	    frame.B, MSF_FIELD_LAYOUT[MSF_FIELD_DUT1_POS]);
 	if (oneCount > 0) {
 		msfDateTime.DUT1 = 100*oneCount;
 	} else {
-		oneCount = countLeading1Bits(BBits,9,8);
-		if (oneCount > 0) {
-			msfDateTime.DUT1 = -100*oneCount;
-		}
-		else {
-			msfDateTime.DUT1 = 0;
-		}
+		oneCount = msfFieldLeading1Bits(
+		    frame.B, MSF_FIELD_LAYOUT[MSF_FIELD_DUT1_NEG]);
+		msfDateTime.DUT1 = -100*(int)oneCount;
 	}
 	/*
 	 * Extract the main date/time values
 	 */
-	msfDateTime.year = bcdDecimalValue(buildValueFromBitset(ABits, 17, 8));
-	msfDateTime.month = bcdDecimalValue(buildValueFromBitset(ABits, 25, 5));
-	msfDateTime.day = bcdDecimalValue(buildValueFromBitset(ABits, 30, 6));
-	msfDateTime.dayOfWeek = bcdDecimalValue(buildValueFromBitset(ABits, 36, 3));
-	msfDateTime.hour = bcdDecimalValue(buildValueFromBitset(ABits, 39, 6));
-	msfDateTime.min = bcdDecimalValue(buildValueFromBitset(ABits, 45, 7));
-	msfDateTime.BST = (B(58) == 1);
+	msfDateTime.year = bcdFieldValue(frame.A, MSF_FIELD_YEAR);
+	msfDateTime.month = bcdFieldValue(frame.A, MSF_FIELD_MONTH);
+	msfDateTime.day = bcdFieldValue(frame.A, MSF_FIELD_DAY);
+	msfDateTime.dayOfWeek = bcdFieldValue(frame.A, MSF_FIELD_DAY_OF_WEEK);
+	msfDateTime.hour = bcdFieldValue(frame.A, MSF_FIELD_HOUR);
+	msfDateTime.min = bcdFieldValue(frame.A, MSF_FIELD_MIN);
+	msfDateTime.BST = (msfBitValue(frame.B, MSF_BST_BIT) == 1);
 	/*
-	 * Check out the parity bits (odd parity)
+	 * Check the values are in range, as bit errors that slip past the
+	 * parity checks often leave a BCD digit above 9
 	 */
-	if ((calcParity(ABits, 17, 8) ^ B(54)) != 1) {
-		decodeMsg.append("B54 parity error");
-		rCode =false;
-	}
-	if ((calcParity(ABits, 25, 11) ^ B(55)) != 1) {
-		decodeMsg.append("B55 parity error");
-		rCode =false;
-	}
-	if ((calcParity(ABits, 36, 3) ^ B(56)) != 1) {
-		decodeMsg.append("B56 parity error");
-		rCode =false;
+	if ((msfDateTime.year > 99) ||
+		(msfDateTime.month < 1) || (msfDateTime.month > 12) ||
+		(msfDateTime.day < 1) || (msfDateTime.day > 31) ||
+		(msfDateTime.dayOfWeek > 6) ||
+		(msfDateTime.hour > 23) || (msfDateTime.min > 59)) {
+		rCode = false;
+		if (pDecodeMsg != 0) {
+			pDecodeMsg->append("Date/time out of range");
+		}
 	}
-	if ((calcParity(ABits, 39, 13) ^ B(57)) != 1) {
-		decodeMsg.append("B57 parity error");
-		rCode =false;
+	/*
+	 * Check out the parity bits (odd parity)
+	 */
+	for (unsigned idx = 0; idx < MSF_PARITY_GROUP_COUNT; ++idx) {
+		if (!msfParityGood(frame, MSF_PARITY_GROUPS[idx])) {
+			rCode =false;
+			if (pDecodeMsg != 0) {
+				pDecodeMsg->append(parityErrors[idx]);
+			}
+		}
 	}
-	if (rCode == false) {
-        showABBitSet(ABits, BBits, 60, decodeMsg);
+	if ((rCode == false) && (pDecodeMsg != 0)) {
+        showABBitSet(frame, 60, *pDecodeMsg);
 	}
 	return rCode;
 }
@@ -583,6 +571,338 @@ void formatMSFDateTime(
 	output.append(str, 0);
 }
 
+/*!
+ * Moves a MSF_DATE_TIME on by a number of minutes. A BST change or a
+ * DUT1 step is not predicted.
+ * @param dateTime the date/time to move on
+ * @param minutes the minutes to move it on by
+ */
+static void advanceMSFDateTime(
+	struct MSF_DATE_TIME& dateTime,
+	uint32_t minutes
+) {
+	static const uint8_t daysInMonth[12] = {
+		31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+	};
+	for (uint32_t idx = 0; idx < minutes; ++idx) {
+		if (++dateTime.min < 60) {
+			continue;
+		}
+		dateTime.min = 0;
+		if (++dateTime.hour < 24) {
+			continue;
+		}
+		dateTime.hour = 0;
+		dateTime.dayOfWeek = (uint8_t)((dateTime.dayOfWeek + 1) % 7);
+		uint8_t monthDays = daysInMonth[dateTime.month - 1];
+		if ((dateTime.month == 2) && ((dateTime.year % 4) == 0)) {
+			monthDays = 29;
+		}
+		if (++dateTime.day <= monthDays) {
+			continue;
+		}
+		dateTime.day = 1;
+		if (++dateTime.month <= 12) {
+			continue;
+		}
+		dateTime.month = 1;
+		dateTime.year = (uint8_t)((dateTime.year + 1) % 100);
+	}
+}
+
+/*!
+ * Converts a decimal value [0..99] to two BCD nibbles
+ */
+static inline uint8_t decimalBCDValue(
+	uint8_t value
+) {
+	return (uint8_t)(((value / 10) << 4) | (value % 10));
+}
+
+/*!
+ * Builds the A/B bits MSF sends for a date/time. The bits we do not
+ * decode are left 0.
+ * @param dateTime the date/time
+ * @param frame assigned the A/B bits
+ */
+static void encodeMSFDateTime(
+	const struct MSF_DATE_TIME& dateTime,
+	struct MSF_FRAME& frame
+) {
+	frame.A = 0;
+	frame.B = 0;
+	msfSetField(frame.A, MSF_FIELD_LAYOUT[MSF_FIELD_YEAR],
+				decimalBCDValue(dateTime.year));
+	msfSetField(frame.A, MSF_FIELD_LAYOUT[MSF_FIELD_MONTH],
+				decimalBCDValue(dateTime.month));
+	msfSetField(frame.A, MSF_FIELD_LAYOUT[MSF_FIELD_DAY],
+				decimalBCDValue(dateTime.day));
+	msfSetField(frame.A, MSF_FIELD_LAYOUT[MSF_FIELD_DAY_OF_WEEK],
+				decimalBCDValue(dateTime.dayOfWeek));
+	msfSetField(frame.A, MSF_FIELD_LAYOUT[MSF_FIELD_HOUR],
+				decimalBCDValue(dateTime.hour));
+	msfSetField(frame.A, MSF_FIELD_LAYOUT[MSF_FIELD_MIN],
+				decimalBCDValue(dateTime.min));
+	msfSetField(frame.A, MSF_FIELD_LAYOUT[MSF_FIELD_MARKER],
+				MSF_MARKER_CODE);
+	/* DUT1 is unary: one bit set per 100ms */
+	int dut1 = dateTime.DUT1 / 100;
+	enum MSF_FIELD_ID dut1Field = MSF_FIELD_DUT1_POS;
+	if (dut1 < 0) {
+		dut1 = -dut1;
+		dut1Field = MSF_FIELD_DUT1_NEG;
+	}
+	const struct MSF_FIELD& field = MSF_FIELD_LAYOUT[dut1Field];
+	if (dut1 > field.bitCount) {
+		dut1 = field.bitCount;
+	}
+	msfSetField(frame.B, field,
+				((1UL << dut1) - 1) << (field.bitCount - dut1));
+	for (unsigned idx = 0; idx < MSF_PARITY_GROUP_COUNT; ++idx) {
+		if (!msfParityGood(frame, MSF_PARITY_GROUPS[idx])) {
+			msfSetBit(frame.B, MSF_PARITY_GROUPS[idx].parityBit, 1);
+		}
+	}
+	msfSetBit(frame.B, MSF_BST_BIT, dateTime.BST ? 1 : 0);
+}
+
+/*!
+ * Gives the A/B bits we decode, so those encodeMSFDateTime() sets
+ * @param used assigned the mask of those bits
+ */
+static void decodedBits(
+	struct MSF_FRAME& used
+) {
+	used.A = 0;
+	for (unsigned idx = MSF_FIELD_YEAR; idx <= MSF_FIELD_MARKER; ++idx) {
+		used.A |= msfFieldMask(MSF_FIELD_LAYOUT[idx]);
+	}
+	used.B = msfFieldMask(MSF_FIELD_LAYOUT[MSF_FIELD_DUT1_POS]) |
+			 msfFieldMask(MSF_FIELD_LAYOUT[MSF_FIELD_DUT1_NEG]) |
+			 msfBitMask(MSF_BST_BIT);
+	for (unsigned idx = 0; idx < MSF_PARITY_GROUP_COUNT; ++idx) {
+		used.B |= msfBitMask(MSF_PARITY_GROUPS[idx].parityBit);
+	}
+}
+
+/*!
+ * Scores how well the A/B bits received agree with a predicted frame,
+ * over the bits we decode. Erased bits are left out.
+ * @param frame the A/B bits received
+ * @param erased the A/B bits erased
+ * @param predicted the predicted A/B bits
+ * @return the bits agreeing less MSF_PREDICT_MISMATCH_COST for each bit
+ *         disagreeing
+ */
+static int scorePrediction(
+	const struct MSF_FRAME& frame,
+	const struct MSF_FRAME& erased,
+	const struct MSF_FRAME& predicted
+) {
+	struct MSF_FRAME used;
+	decodedBits(used);
+	MSF_BITS usedA = used.A & ~erased.A;
+	MSF_BITS usedB = used.B & ~erased.B;
+	unsigned mismatches = msfPopCount((frame.A ^ predicted.A) & usedA) +
+						  msfPopCount((frame.B ^ predicted.B) & usedB);
+	unsigned agreements = msfPopCount(usedA) + msfPopCount(usedB) -
+						  mismatches;
+	return (int)agreements - MSF_PREDICT_MISMATCH_COST*(int)mismatches;
+}
+
+/*!
+ * Works out the minute expected to end at a minute marker, from the last
+ * good decode
+ * @param last the last good decode
+ * @param markerTime the ticker time of the minute marker
+ * @param predicted assigned the expected date/time
+ * @return false if the marker is too far from a whole number of minutes
+ *         (up to MSF_PREDICT_MAX_MINUTES) after the last good decode
+ */
+static bool predictMSFDateTime(
+	const struct MSF_DATE_TIME& last,
+	uint32_t markerTime,
+	struct MSF_DATE_TIME& predicted
+) {
+	const uint32_t oneMinute = 60*SYSTICK_ONESEC;
+	uint32_t elapsed = markerTime - last.ticksAtTime;
+	uint32_t minutes = (elapsed + oneMinute/2) / oneMinute;
+	int32_t error = (int32_t)(elapsed - minutes*oneMinute);
+	if ((minutes == 0) || (minutes > MSF_PREDICT_MAX_MINUTES) ||
+		(error > (int32_t)SYSTICK_ONESEC/2) ||
+		(error < -(int32_t)SYSTICK_ONESEC/2)) {
+		return false;
+	}
+	predicted = last;
+	advanceMSFDateTime(predicted, minutes);
+	return true;
+}
+
+/*!
+ * Completes the decode of a minute's bit periods into a MSF_DATE_TIME
+ * struct. If the decode fails, we return the reason in the decodeMsg.
+ * A minute which fails to decode from its seconds is read again on the
+ * second grid (see extractGridBits()); the two readings are combined bit
+ * by bit and decoded once more, and the grid reading is also used in
+ * checking the minute against pPredicted.
+ * @param pSampleBuffer the minute's bit periods
+ * @param extract the extraction state for pSampleBuffer
+ * @param markerTime the ticker time of the minute marker that ended the
+ *        minute
+ * @param pPredicted the date/time expected for the minute, or 0 if there
+ *        is none. Should the minute fail to decode on its own, but its A/B
+ *        bits agree well enough with those of the expected date/time, that
+ *        is taken as the decode and the failure reason is dropped.
+ * @param dateTime assigned the decoded date/time
+ * @param decodeMsg the CMsg into which any failure reason is appended
+ * @return true if the decode was good, false if the decode failed
+ */
+static bool finishDecode(
+	struct MSF_SAMPLE_BUFFER* pSampleBuffer,
+	struct MSF_EXTRACT_STATE& extract,
+	uint32_t markerTime,
+	const struct MSF_DATE_TIME* pPredicted,
+	struct MSF_DATE_TIME &dateTime,
+	CMsg& decodeMsg
+) {
+	bool rCode = true;
+	extractABBits(pSampleBuffer, extract,
+				  pSampleBuffer->getWriteOffset(), true);
+	/* Kept before resolveErasures() changes them */
+	struct MSF_FRAME received = extract.frame;
+	struct MSF_FRAME erased = extract.erased;
+	bool framed = !pSampleBuffer->isEmpty() && !extract.failed &&
+				  (extract.secsCount == 59);
+	if (pSampleBuffer->isEmpty() || extract.failed) {
+		showExtractFailure(pSampleBuffer, extract, decodeMsg);
+		rCode = false;
+	} else if (extract.secsCount < 59) {
+		decodeMsg.append("Did not get at least 59 seconds from sample data");
+		rCode = false;
+	} else if (extract.secsCount > 60) {
+		/* Missed a minute marker - more than one minute of data */
+		decodeMsg.append("Got more than 60 seconds from sample data");
+		showMSFBitPeriods(pSampleBuffer, decodeMsg);
+		rCode = false;
+	} else if (!resolveErasures(extract.frame, extract.erased)) {
+		char messageBuff[48];
+		snprintf(messageBuff, sizeof(messageBuff),
+				 "%u uncertain seconds: ", (unsigned)extract.erasureCount);
+		decodeMsg.append(messageBuff);
+		failExtract(pSampleBuffer, extract, extract.erasureOffset);
+		showExtractFailure(pSampleBuffer, extract, decodeMsg);
+		rCode = false;
+	} else if (!decodeMSFDateTime(extract.frame, dateTime, &decodeMsg)) {
+		showMSFBitPeriods(pSampleBuffer, decodeMsg);
+		rCode = false;
+	} else {
+		dateTime.predicted = false;
+	}
+	/* A failed minute that starts at a marker is read again on the grid */
+	bool gridded = !rCode && !extract.partial && !pSampleBuffer->isEmpty();
+	struct MSF_FRAME gridReceived;
+	struct MSF_FRAME gridErased;
+	if (gridded) {
+		extractGridBits(pSampleBuffer, gridReceived, gridErased);
+	}
+	if (gridded && framed) {
+		/*
+		 * Each reading fills in the other's uncertain bits, and a bit
+		 * they both read but disagree on becomes uncertain
+		 */
+		struct MSF_FRAME frame;
+		struct MSF_FRAME frameErased;
+		frame.A = (received.A & ~erased.A) | (gridReceived.A & erased.A);
+		frame.B = (received.B & ~erased.B) | (gridReceived.B & erased.B);
+		frameErased.A = (erased.A & gridErased.A) |
+			(~erased.A & ~gridErased.A & (received.A ^ gridReceived.A));
+		frameErased.B = (erased.B & gridErased.B) |
+			(~erased.B & ~gridErased.B & (received.B ^ gridReceived.B));
+		if (resolveErasures(frame, frameErased) &&
+			decodeMSFDateTime(frame, dateTime, 0)) {
+			decodeMsg.clear();
+			dateTime.predicted = false;
+			rCode = true;
+		}
+	}
+	if (!rCode && (framed || gridded) && (pPredicted != 0)) {
+		struct MSF_FRAME expected;
+		encodeMSFDateTime(*pPredicted, expected);
+		int score = framed ?
+			scorePrediction(received, erased, expected) : 0;
+		if (gridded) {
+			int gridScore = scorePrediction(gridReceived, gridErased,
+											expected);
+			if (gridScore > score) {
+				score = gridScore;
+			}
+		}
+		if (score >= MSF_PREDICT_MIN_SCORE) {
+			decodeMsg.clear();
+			dateTime = *pPredicted;
+			dateTime.predicted = true;
+			rCode = true;
+		}
+	}
+	if (rCode) {
+		struct MSF_PHASE_ESTIMATE phase;
+		dateTime.ticksAtTime = markerTime;
+		dateTime.markerScore = pSampleBuffer->markerScore;
+		if (msfEstimatePhase(pSampleBuffer, phase)) {
+			dateTime.usAtTime = phase.minuteEndTime;
+			dateTime.usAtTimeError = phase.uncertainty;
+			dateTime.clockError = phase.rateError;
+		} else {
+			dateTime.usAtTime = 0;
+			dateTime.usAtTimeError = 0;
+			dateTime.clockError = 0;
+		}
+	}
+	return rCode;
+}
+
+/*!
+ * Passes the seconds of a good decode to the classifier tuning (see
+ * msftune.cpp). Only the seconds matched with confidence, and whose A/B
+ * bits we decode agree with the decoded date/time, are passed on.
+ * \param pSampleBuffer the minute's bit periods
+ * \param extract the extraction state for pSampleBuffer, with its
+ *        seconds traced
+ * \param dateTime the decoded date/time
+ */
+static void learnSeconds(
+	const struct MSF_SAMPLE_BUFFER* pSampleBuffer,
+	const struct MSF_EXTRACT_STATE& extract,
+	const struct MSF_DATE_TIME& dateTime
+) {
+	struct MSF_FRAME expected;
+	struct MSF_FRAME used;
+	encodeMSFDateTime(dateTime, expected);
+	decodedBits(used);
+	size_t secsIdx = extract.secsCount;
+	for (size_t node = extract.nodeCount - 1; extract.nodes[node].span != 0;
+		 node -= extract.nodes[node].span/2) {
+		const struct MSF_SEGMENT_NODE& second = extract.nodes[node];
+		secsIdx -= second.seconds;
+		if ((second.type == MSF_SEC_NO_MATCH) ||
+			(second.aConfidence < MSF_LOW_CONFIDENCE) ||
+			(second.bConfidence < MSF_LOW_CONFIDENCE)) {
+			continue;
+		}
+		enum MSF_SECOND_TYPE type = (enum MSF_SECOND_TYPE)second.type;
+		unsigned bit = (unsigned)secsIdx + 1;
+		if ((msfBitValue(used.A, bit) &&
+			 (msfBitValue(expected.A, bit) != msfSecondABit(type))) ||
+			(msfBitValue(used.B, bit) &&
+			 (msfBitValue(expected.B, bit) != msfSecondBBit(type)))) {
+			continue;
+		}
+		MSFTune_addSecond(type,
+			pSampleBuffer->sampleData + 2*node - second.span, second.span,
+			second.cost - extract.nodes[node - second.span/2].cost);
+	}
+}
+
 /*!
  * Decodes a period sample buffer into a MSF_DATE_TIME struct. If the decode
  * fails, we return the reason in the decodeMsg
@@ -597,21 +917,264 @@ bool decodeMSFSampleBuffer(
 	struct MSF_DATE_TIME &dateTime,
 	CMsg& decodeMsg
 ) {
-	bool rCode = true;
-	uint8_t ABits[60];
-	uint8_t BBits[60];
-	size_t secsCount = 0;
-	if (!extractABBits(pSampleBuffer, ABits, BBits, secsCount, decodeMsg)) {
-		rCode = false;
-	} else if (secsCount < 59) {
-		decodeMsg.append("Did not get at least 59 seconds from sample data");
-		rCode = false;
+	/* Too big for the stack */
+	static struct MSF_EXTRACT_STATE extract;
+	resetExtract(extract, false);
+	pSampleBuffer->resetRead();
+	return finishDecode(pSampleBuffer, extract,
+						pSampleBuffer->sampleStartTime, 0, dateTime, decodeMsg);
+}
+
+/*!
+ * Readies a stream decoder for use, with no minute being decoded and no
+ * good decode to predict the next minute from
+ * @param decoder the stream decoder
+ */
+void msfStreamInit(
+	struct MSF_STREAM_DECODER& decoder
+) {
+	decoder.active = false;
+	decoder.lastValid = false;
+	decoder.heldValid = false;
+}
+
+/*!
+ * Gives the mask of the first bits of a minute
+ * @param count the number of bits [0..59]
+ */
+static inline MSF_BITS frameHeadMask(
+	size_t count
+) {
+	return (((MSF_BITS)1 << count) - 1) << (63 - count);
+}
+
+/*!
+ * Keeps the end of a partial minute to be completed from the start of the
+ * next, if its last seconds hold the A52..A59 marker code that ends every
+ * minute (so the minute marker we stopped at is where we think it is).
+ * @param decoder the stream decoder, with the partial minute's seconds
+ *        extracted
+ * @param markerTime the ticker time of the minute marker ending it
+ * @param decodeMsg the CMsg into which what happened is appended
+ */
+static void holdPartialMinute(
+	struct MSF_STREAM_DECODER& decoder,
+	uint32_t markerTime,
+	CMsg& decodeMsg
+) {
+	const struct MSF_EXTRACT_STATE& extract = decoder.extract;
+	const struct MSF_FIELD& marker = MSF_FIELD_LAYOUT[MSF_FIELD_MARKER];
+	MSF_BITS markerBits = (MSF_BITS)MSF_MARKER_CODE <<
+						  (64 - marker.startBit - marker.bitCount);
+	MSF_BITS markerMask = msfFieldMask(marker) & ~extract.erased.A;
+	char messageBuff[64];
+	if (decoder.pRecord->isEmpty() || extract.failed) {
+		decodeMsg.append("Partial minute: ");
+		showExtractFailure(decoder.pRecord, extract, decodeMsg);
+	} else if ((markerMask == 0) ||
+			   (((extract.frame.A ^ markerBits) & markerMask) != 0)) {
+		decodeMsg.append("Partial minute does not end with the marker code");
 	} else {
-		if (!decodeMSFDateTime(ABits, BBits, dateTime, decodeMsg)) {
-		    showMSFBitPeriods(pSampleBuffer, decodeMsg);
-			rCode = false;
-		} else {
-			dateTime.ticksAtTime = pSampleBuffer->sampleStartTime;
+		decoder.heldValid = true;
+		decoder.heldSequence = decoder.sequence;
+		decoder.heldMarkerTime = markerTime;
+		decoder.heldMissing = (extract.secsCount < MSF_FRAME_SECONDS - 1) ?
+			MSF_FRAME_SECONDS - 1 - extract.secsCount : 0;
+		decoder.heldFrame = extract.frame;
+		decoder.heldErased = extract.erased;
+		snprintf(messageBuff, sizeof(messageBuff),
+				 "Acquired the last %u seconds of a minute",
+				 (unsigned)extract.secsCount);
+		decodeMsg.append(messageBuff);
+	}
+}
+
+/*!
+ * Tries to complete the partial minute held from the seconds of the
+ * minute after it extracted so far. The first seconds of a minute hold
+ * its most significant fields, which are the same in the next minute
+ * unless a less significant field rolls over - and that is in the bits
+ * we have, so is checked for.
+ * @param decoder the stream decoder
+ * @param dateTime assigned the date/time of the partial minute
+ * @return true if the partial minute is complete. Once the seconds it is
+ *         missing have arrived the partial minute is dropped either way.
+ */
+static bool completePartialMinute(
+	struct MSF_STREAM_DECODER& decoder,
+	struct MSF_DATE_TIME& dateTime
+) {
+	struct MSF_EXTRACT_STATE& extract = decoder.extract;
+	size_t endNode = extract.nodeCount - 1;
+	if ((endNode == 0) ||
+		(extract.nodes[endNode].cost == MSF_SEGMENT_UNREACHED)) {
+		return false;
+	}
+	traceSeconds(decoder.pRecord, extract, endNode);
+	/* The last second traced may not be complete */
+	if (extract.secsCount <= decoder.heldMissing) {
+		return false;
+	}
+	decoder.heldValid = false;
+	MSF_BITS headMask = frameHeadMask(decoder.heldMissing);
+	struct MSF_FRAME frame;
+	struct MSF_FRAME erased;
+	frame.A = (decoder.heldFrame.A & ~headMask) | (extract.frame.A & headMask);
+	frame.B = (decoder.heldFrame.B & ~headMask) | (extract.frame.B & headMask);
+	erased.A = (decoder.heldErased.A & ~headMask) |
+			   (extract.erased.A & headMask);
+	erased.B = (decoder.heldErased.B & ~headMask) |
+			   (extract.erased.B & headMask);
+	if (!resolveErasures(frame, erased) ||
+		!decodeMSFDateTime(frame, dateTime, 0)) {
+		return false;
+	}
+	struct MSF_DATE_TIME next = dateTime;
+	struct MSF_FRAME thisBits;
+	struct MSF_FRAME nextBits;
+	advanceMSFDateTime(next, 1);
+	encodeMSFDateTime(dateTime, thisBits);
+	encodeMSFDateTime(next, nextBits);
+	if ((((thisBits.A ^ nextBits.A) | (thisBits.B ^ nextBits.B)) &
+		 headMask) != 0) {
+		/* The bits borrowed from the next minute differ from ours */
+		return false;
+	}
+	dateTime.predicted = false;
+	dateTime.ticksAtTime = decoder.heldMarkerTime;
+	/* We have no second edges from before the minute marker */
+	dateTime.usAtTime = 0;
+	dateTime.usAtTimeError = 0;
+	dateTime.clockError = 0;
+	decoder.lastGood = dateTime;
+	decoder.lastValid = true;
+	return true;
+}
+
+/*!
+ * Starts decoding a new minute. Called when the minute marker at the start
+ * of the minute has been seen, or when the sampler starts recording part
+ * way through a minute.
+ * @param decoder the stream decoder
+ * @param pRecord the sample buffer the sampler is recording the minute in
+ * @param partial true if the sampler started part way through the minute
+ */
+void msfStreamStart(
+	struct MSF_STREAM_DECODER& decoder,
+	struct MSF_SAMPLE_BUFFER* pRecord,
+	bool partial
+) {
+	decoder.pRecord = pRecord;
+	decoder.sequence = pRecord->sampleSequence;
+	decoder.storedCount = 0;
+	decoder.pRecord->resetRead();
+	resetExtract(decoder.extract, partial);
+	/* A partial minute is only any use to the minute straight after it */
+	if (partial || (decoder.sequence != decoder.heldSequence + 1)) {
+		decoder.heldValid = false;
+	}
+	decoder.active = true;
+}
+
+/*!
+ * Abandons the minute being decoded
+ * @param decoder the stream decoder
+ */
+void msfStreamAbort(
+	struct MSF_STREAM_DECODER& decoder
+) {
+	decoder.active = false;
+	decoder.heldValid = false;
+}
+
+/*!
+ * Notes the sampler has recorded the next bit period of the minute,
+ * extracting any A/B bits it completes. If a partial minute was recorded
+ * just before this one, the seconds it missed are taken from this one as
+ * soon as they arrive, so a first fix need not wait for a whole minute
+ * after the first minute marker.
+ * @param decoder the stream decoder
+ * @param dateTime assigned the date/time of the partial minute, if it was
+ *        completed
+ * @return true if the partial minute was completed. Its date/time is that
+ *         of the minute starting at the minute marker that ended it.
+ */
+bool msfStreamPeriod(
+	struct MSF_STREAM_DECODER& decoder,
+	struct MSF_DATE_TIME &dateTime
+) {
+	bool rCode = false;
+	if (decoder.active) {
+		size_t nodeCount = decoder.extract.nodeCount;
+		decoder.storedCount += 1;
+		extractABBits(decoder.pRecord, decoder.extract,
+					  decoder.storedCount, false);
+		if (decoder.heldValid && (decoder.extract.nodeCount > nodeCount)) {
+			rCode = completePartialMinute(decoder, dateTime);
+		}
+	}
+	return rCode;
+}
+
+/*!
+ * Notes the sampler has dropped the last bit period recorded, as it was
+ * noise. Any segmentation nodes which used the period are dropped, to be
+ * worked out again as the periods after it arrive.
+ * @param decoder the stream decoder
+ */
+void msfStreamRetract(
+	struct MSF_STREAM_DECODER& decoder
+) {
+	if (decoder.active && (decoder.storedCount > 0)) {
+		decoder.storedCount -= 1;
+		if (decoder.storedCount < decoder.extract.usedCount) {
+			/* Forget the nodes which used the dropped period */
+			decoder.extract.nodeCount = decoder.storedCount/2 + 1;
+			decoder.extract.usedCount = 2*(decoder.extract.nodeCount - 1);
+		}
+	}
+}
+
+/*!
+ * Completes the decode of the minute. Called when the minute marker at the
+ * end of the minute has been seen, once the decoder's sample buffer has
+ * been claimed from the sample pool. A minute too noisy to decode on its
+ * own may still be confirmed against the one predicted from the last good
+ * decode. A partial minute is not decoded, but kept for msfStreamPeriod()
+ * to complete.
+ * @param decoder the stream decoder
+ * @param markerTime the ticker time of the minute marker
+ * @param dateTime assigned the decoded date/time
+ * @param decodeMsg the CMsg into which any failure reason is appended
+ * @return true if the decode was good, false if the decode failed - in which
+ *         case decodeMsg is filled with the reason the decode failed.
+ */
+bool msfStreamEnd(
+	struct MSF_STREAM_DECODER& decoder,
+	uint32_t markerTime,
+	struct MSF_DATE_TIME &dateTime,
+	CMsg& decodeMsg
+) {
+	decoder.active = false;
+	if (decoder.extract.partial) {
+		extractABBits(decoder.pRecord, decoder.extract,
+					  decoder.pRecord->getWriteOffset(), true);
+		holdPartialMinute(decoder, markerTime, decodeMsg);
+		return false;
+	}
+	decoder.heldValid = false;
+	struct MSF_DATE_TIME predicted;
+	bool canPredict = decoder.lastValid &&
+		predictMSFDateTime(decoder.lastGood, markerTime, predicted);
+	bool rCode = finishDecode(decoder.pRecord, decoder.extract, markerTime,
+							  canPredict ? &predicted : 0,
+							  dateTime, decodeMsg);
+	if (rCode) {
+		decoder.lastGood = dateTime;
+		decoder.lastValid = true;
+		if (!dateTime.predicted) {
+			/* A minute decoded on its own has all its seconds traced */
+			learnSeconds(decoder.pRecord, decoder.extract, dateTime);
 		}
 	}
 	return rCode;
@@ -0,0 +1,86 @@
+/*
+ * msf_hal.cpp
+ *
+ * STM32 implementation of the MSF receiver hardware abstraction.
+ *
+ */
+#include "stm32f10x.h"
+#include "msf_hal.h"
+#include "systick.h"
+#include "msfcapture.h"
+
+/*!
+ * Indicates if the MSF receiver module has been enabled
+ * @return true if enabled, false if not
+ */
+bool isMSFReceiverEnabled(void) {
+	if (GPIOB->ODR & (1 << 1))
+		return false;
+	return true;
+}
+
+/*!
+ * Enables the MSF receiver module
+ */
+void enableMSFReceiver(void) {
+	GPIOB->BRR = (1 << 1);
+}
+
+/*!
+ * Disables the MSF receiver module
+ */
+void disableMSFReceiver(void) {
+	GPIOB->BSRR = (1 << 1);
+}
+
+/*!
+ * Configures the STM32 IO to interface to the MSF receiver module.
+ * PB0 = MSF receiver data output (input to us)
+ * PB1 = MSF receiver enable (output from us)
+ * PB2 = Output from us toggled each time we sample the MSF data
+ */
+void configureMSFIO(void) {
+	/* Enable GPIOB Clock */
+	RCC->APB2ENR |= (1UL << 3);
+	/*
+	 * PortB0 = Data      (Input)
+	 *    1000 = Input with pull up/pull down
+	 * PortB1 = /ENABLE   (Output, 0 to enable, 1 to disable)
+	 *    0010 = Output max speed 2MHz, push/pull output
+	 * PortB2 = /ENABLE   (Output, 0 to enable, 1 to disable)
+	 *    0010 = Output max speed 2MHz, push/pull output
+	 */
+	GPIOB->CRL = (GPIOB->CRL & 0xFFFFF000) | 0x00000228;
+}
+
+/*!
+ * Returns current MSF bit level
+ * \return 0/1
+ */
+int msfSample(void) {
+	/*
+	 * Toggle the sample indicator to generate a signal
+	 * output at 1/2 our sampling frequency.
+	 */
+	GPIOB->ODR = GPIOB->ODR ^ (1 << 2);
+	/* The input is inverted */
+	return (GPIOB->IDR & 1) ? 0 : 1;
+}
+
+/*!
+ * Converts a sampler time into the local time kept by SysTick_readMicros().
+ * The sampler time must be from within the last 71 minutes.
+ * @param samplerTime the sampler time, in us
+ * @return the local time, in us
+ */
+uint64_t msfSamplerToLocal(
+	uint32_t samplerTime
+) {
+#if MSF_EDGE_CAPTURE
+	return MSFCapture_toLocal(samplerTime);
+#else
+	/* The sampler time is the low 32 bits of the tick count in us */
+	uint64_t local = SysTick_readTicks64()*SYSTICK_US_PER_TICK;
+	return local - (uint32_t)((uint32_t)local - samplerTime);
+#endif
+}
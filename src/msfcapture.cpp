@@ -0,0 +1,198 @@
+/*
+ * msfcapture.cpp
+ *
+ * Holds the TIM3 input capture and DMA set up that timestamps the MSF
+ * receiver output edges, and the TIM3 update IRQ handler which passes
+ * the edges on to the MSF sampler.
+ *
+ */
+
+#include "stm32f10x.h"
+#include "systick.h"
+#include "msf_hal.h"
+#include "msfsampler.h"
+#include "msfcapture.h"
+#include "seqlatch.h"
+
+#if MSF_EDGE_CAPTURE
+
+/*!
+ * The captured timer counts of the PB0 rising edges, written by DMA1
+ * channel 2 from TIM3_CCR3
+ */
+static volatile uint16_t risingEdges[MSF_CAPTURE_BUFFER_SIZE];
+/*!
+ * The captured timer counts of the PB0 falling edges, written by DMA1
+ * channel 3 from TIM3_CCR4
+ */
+static volatile uint16_t fallingEdges[MSF_CAPTURE_BUFFER_SIZE];
+/*! The index of the next unread entry in risingEdges[] */
+static uint32_t risingIdx;
+/*! The index of the next unread entry in fallingEdges[] */
+static uint32_t fallingIdx;
+/*! The top 16 bits of the 32 bit, 1us, capture time */
+static uint32_t timerHigh;
+/*!
+ * The capture time as the last drain started. Every edge not drained
+ * by then was captured after it.
+ */
+static uint32_t prevNow;
+/*!
+ * A capture time and the local time (from SysTick_readMicros()) at the
+ * same instant
+ */
+struct TIME_PAIR {
+	uint32_t captureTime;
+	uint64_t localTime;
+};
+/*! The time pair taken at the last timer update */
+static SEQ_LATCH<TIME_PAIR> timeLatch;
+
+/*!
+ * Extends a 16 bit captured timer count to a 32 bit time. The capture
+ * must have been made within the 65.536ms after since.
+ * @param capture the captured timer count
+ * @param since a 32 bit time from before the capture
+ */
+static inline uint32_t extendCapture(
+	uint16_t capture,
+	uint32_t since
+) {
+	return since + (uint16_t)(capture - (uint16_t)since);
+}
+
+/*!
+ * Gives the index of the entry a DMA channel will write next
+ * @param pChannel the DMA channel
+ */
+static inline uint32_t dmaWriteIndex(
+	DMA_Channel_TypeDef* pChannel
+) {
+	return (MSF_CAPTURE_BUFFER_SIZE - pChannel->CNDTR) %
+		   MSF_CAPTURE_BUFFER_SIZE;
+}
+
+/*!
+ * Passes the edges captured since the last call to the MSF sampler,
+ * oldest first.
+ */
+static void drainEdges(void) {
+	/*
+	 * Extend the edges from the time the last drain started, as every
+	 * edge left then came after it. Read the DMA positions before now,
+	 * so every edge read is before now.
+	 */
+	uint32_t since = prevNow;
+	prevNow = (timerHigh << 16) | TIM3->CNT;
+	uint32_t risingEnd = dmaWriteIndex(DMA1_Channel2);
+	uint32_t fallingEnd = dmaWriteIndex(DMA1_Channel3);
+	uint32_t now = (timerHigh << 16) | TIM3->CNT;
+	uint32_t nowTicks = SysTick_readTicks();
+	struct TIME_PAIR timePair;
+	timePair.captureTime = now;
+	timePair.localTime = SysTick_readMicros();
+	timeLatch.write(timePair);
+	while ((risingIdx != risingEnd) || (fallingIdx != fallingEnd)) {
+		uint32_t risingTime = extendCapture(risingEdges[risingIdx], since);
+		uint32_t fallingTime = extendCapture(fallingEdges[fallingIdx], since);
+		uint32_t edgeTime;
+		int msfLevel;
+		/* Take the older edge. The input is inverted. */
+		if ((risingIdx != risingEnd) &&
+			((fallingIdx == fallingEnd) ||
+			 (now - risingTime >= now - fallingTime))) {
+			edgeTime = risingTime;
+			msfLevel = 0;
+			risingIdx = (risingIdx + 1) % MSF_CAPTURE_BUFFER_SIZE;
+		} else {
+			edgeTime = fallingTime;
+			msfLevel = 1;
+			fallingIdx = (fallingIdx + 1) % MSF_CAPTURE_BUFFER_SIZE;
+		}
+		uint32_t edgeAge = (now - edgeTime + SYSTICK_US_PER_TICK/2) /
+						   SYSTICK_US_PER_TICK;
+		MSFSampler_edge(edgeTime, nowTicks - edgeAge, msfLevel);
+	}
+	MSFSampler_poll(now, nowTicks);
+}
+
+/*!
+ * The TIM3 Interrupt Handler, invoked on each timer update (every
+ * 65.536ms)
+ */
+extern "C"
+void TIM3_IRQHandler(void) {
+	if (TIM3->SR & TIM_SR_UIF) {
+		TIM3->SR = (uint16_t)~TIM_SR_UIF;
+		++timerHigh;
+		/* Toggle the sample indicator each time we look at the edges */
+		GPIOB->ODR = GPIOB->ODR ^ (1 << 2);
+		drainEdges();
+	}
+}
+
+/*!
+ * Converts a capture time into the local time kept by SysTick_readMicros().
+ * The capture time must be from within the last 71 minutes.
+ * @param captureTime the capture time, in us
+ * @return the local time, in us
+ */
+uint64_t MSFCapture_toLocal(
+	uint32_t captureTime
+) {
+	struct TIME_PAIR timePair;
+	timeLatch.read(timePair);
+	return timePair.localTime - (uint32_t)(timePair.captureTime - captureTime);
+}
+
+/*!
+ * Starts timestamping the MSF receiver output edges. PB0 is an input from
+ * reset (configureMSFIO() adds its pull resistor) and MSFSampler_init()
+ * must have been called.
+ */
+void MSFCapture_init(void) {
+	risingIdx = 0;
+	fallingIdx = 0;
+	timerHigh = 0;
+	prevNow = 0;
+	RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
+	RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+	/*
+	 * DMA1 channel 2 = TIM3_CH3, channel 3 = TIM3_CH4.
+	 * 16 bit peripheral to 16 bit memory, circular, high priority.
+	 */
+	const uint32_t dmaConfig = DMA_CCR1_PL_1 | DMA_CCR1_MSIZE_0 |
+							   DMA_CCR1_PSIZE_0 | DMA_CCR1_MINC |
+							   DMA_CCR1_CIRC;
+	DMA1_Channel2->CCR = 0;
+	DMA1_Channel2->CPAR = (uint32_t)&TIM3->CCR3;
+	DMA1_Channel2->CMAR = (uint32_t)risingEdges;
+	DMA1_Channel2->CNDTR = MSF_CAPTURE_BUFFER_SIZE;
+	DMA1_Channel2->CCR = dmaConfig | DMA_CCR1_EN;
+	DMA1_Channel3->CCR = 0;
+	DMA1_Channel3->CPAR = (uint32_t)&TIM3->CCR4;
+	DMA1_Channel3->CMAR = (uint32_t)fallingEdges;
+	DMA1_Channel3->CNDTR = MSF_CAPTURE_BUFFER_SIZE;
+	DMA1_Channel3->CCR = dmaConfig | DMA_CCR1_EN;
+	/*
+	 * TIM3 free runs at 1MHz. The input filter clock is CK_INT/4, and an
+	 * edge must be stable for 8 samples at fDTS/32 (about 14us) to count.
+	 */
+	TIM3->CR1 = TIM_CR1_CKD_1;
+	TIM3->PSC = (uint16_t)(SystemCoreClock/1000000 - 1);
+	TIM3->ARR = 0xFFFF;
+	/* IC3 on TI3, IC4 on TI3, both with the maximum filter */
+	TIM3->CCMR2 = TIM_CCMR2_CC3S_0 | TIM_CCMR2_IC3F |
+				  TIM_CCMR2_CC4S_1 | TIM_CCMR2_IC4F;
+	/* CH3 captures rising edges, CH4 falling edges */
+	TIM3->CCER = TIM_CCER_CC3E | TIM_CCER_CC4E | TIM_CCER_CC4P;
+	TIM3->DIER = TIM_DIER_UIE | TIM_DIER_CC3DE | TIM_DIER_CC4DE;
+	/* Load the prescaler, then drop the update that caused */
+	TIM3->EGR = TIM_EGR_UG;
+	TIM3->SR = 0;
+	NVIC_SetPriority(TIM3_IRQn, 0);
+	NVIC_EnableIRQ(TIM3_IRQn);
+	TIM3->CR1 |= TIM_CR1_CEN;
+}
+
+#endif /* MSF_EDGE_CAPTURE */
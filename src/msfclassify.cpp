@@ -0,0 +1,577 @@
+/*
+ * msfclassify.cpp
+ *
+ * Code to classify the bit periods of one MSF second as one of the four
+ * A/B bit patterns. The per-period error terms are worked out at compile
+ * time, so classifying a second takes a handful of table lookups and no
+ * divisions.
+ *
+ * Each class of period can be re-centred by a whole number of ticks, to
+ * suit a receiver which stretches or shrinks it (see msftune.cpp). The
+ * period is moved by the same amount before its error term is looked up,
+ * so the tables stay the same.
+ *
+ */
+#include <stdint.h>
+#include "systick.h"
+#include "msfclassify.h"
+
+/*!
+ * System ticker time values for the 100..900ms intervals
+ */
+const int ms100 = 100*SYSTICK_ONESEC/1000;
+const int ms200 = 200*SYSTICK_ONESEC/1000;
+const int ms300 = 300*SYSTICK_ONESEC/1000;
+const int ms700 = 700*SYSTICK_ONESEC/1000;
+const int ms800 = 800*SYSTICK_ONESEC/1000;
+const int ms900 = 900*SYSTICK_ONESEC/1000;
+
+/*!
+ * The error term for period p against target period m, being the
+ * difference between p and m in 1/1000ths of m: abs(1000 - 1000*p/m).
+ */
+#define PERIOD_ERROR(p, m) \
+	((1000 - 1000*(p)/(m)) < 0 ? (1000*(p)/(m) - 1000) : (1000 - 1000*(p)/(m)))
+#define PERIOD_ERRORS_4(p, m) \
+	PERIOD_ERROR((p), m), PERIOD_ERROR((p)+1, m), \
+	PERIOD_ERROR((p)+2, m), PERIOD_ERROR((p)+3, m)
+#define PERIOD_ERRORS_16(p, m) \
+	PERIOD_ERRORS_4((p), m), PERIOD_ERRORS_4((p)+4, m), \
+	PERIOD_ERRORS_4((p)+8, m), PERIOD_ERRORS_4((p)+12, m)
+#define PERIOD_ERRORS_64(p, m) \
+	PERIOD_ERRORS_16((p), m), PERIOD_ERRORS_16((p)+16, m), \
+	PERIOD_ERRORS_16((p)+32, m), PERIOD_ERRORS_16((p)+48, m)
+#define PERIOD_ERRORS_256(m) \
+	PERIOD_ERRORS_64(0, m), PERIOD_ERRORS_64(64, m), \
+	PERIOD_ERRORS_64(128, m), PERIOD_ERRORS_64(192, m)
+
+/*!
+ * Indexes the target periods in periodError[][]
+ */
+enum TARGET_PERIOD {
+	T100,
+	T200,
+	T300,
+	T700,
+	T800,
+	T900,
+	TARGET_COUNT
+};
+
+/*!
+ * The error term for every possible (8 bit) period against each of the
+ * target periods: periodError[target][p] == PERIOD_ERROR(p, target)
+ */
+static const uint16_t periodError[TARGET_COUNT][256] = {
+	{ PERIOD_ERRORS_256(ms100) },
+	{ PERIOD_ERRORS_256(ms200) },
+	{ PERIOD_ERRORS_256(ms300) },
+	{ PERIOD_ERRORS_256(ms700) },
+	{ PERIOD_ERRORS_256(ms800) },
+	{ PERIOD_ERRORS_256(ms900) }
+};
+
+/*!
+ * The target period of each MSF_PERIOD_CLASS
+ */
+static const uint8_t classTarget[MSF_PERIOD_CLASS_COUNT] = {
+	T100, T200, T300, T100, T700, T800, T900
+};
+
+/*!
+ * The tuning in use, untuned to start with
+ */
+static struct MSF_CLASSIFY_TUNING tuning = {
+	{ 0, 0, 0, 0, 0, 0, 0 },
+	MSF_MAX_SECOND_ERROR
+};
+
+/*!
+ * Sets how the classifier is tuned to the receiver. The centre shifts are
+ * limited to MSF_MAX_CENTRE_SHIFT and the match error limit to
+ * MSF_MIN_SECOND_ERROR..MSF_MAX_SECOND_ERROR.
+ * @param newTuning the tuning to use
+ */
+void msfClassifySetTuning(
+	const struct MSF_CLASSIFY_TUNING& newTuning
+) {
+	for (unsigned idx = 0; idx < MSF_PERIOD_CLASS_COUNT; ++idx) {
+		int8_t centre = newTuning.centre[idx];
+		if (centre > MSF_MAX_CENTRE_SHIFT) {
+			centre = MSF_MAX_CENTRE_SHIFT;
+		} else if (centre < -MSF_MAX_CENTRE_SHIFT) {
+			centre = -MSF_MAX_CENTRE_SHIFT;
+		}
+		tuning.centre[idx] = centre;
+	}
+	tuning.maxError = newTuning.maxError;
+	if (tuning.maxError > MSF_MAX_SECOND_ERROR) {
+		tuning.maxError = MSF_MAX_SECOND_ERROR;
+	} else if (tuning.maxError < MSF_MIN_SECOND_ERROR) {
+		tuning.maxError = MSF_MIN_SECOND_ERROR;
+	}
+}
+
+/*!
+ * Gives the tuning in use
+ * @param current assigned the tuning
+ */
+void msfClassifyReadTuning(
+	struct MSF_CLASSIFY_TUNING& current
+) {
+	current = tuning;
+}
+
+/*!
+ * Gives the error term for a period against its class's tuned centre
+ * @param periodClass the class the period should be
+ * @param p the period
+ */
+static inline uint32_t classError(
+	enum MSF_PERIOD_CLASS periodClass,
+	uint8_t p
+) {
+	int idx = (int)p - tuning.centre[periodClass];
+	if (idx < 0) {
+		idx = 0;
+	} else if (idx > 255) {
+		idx = 255;
+	}
+	return periodError[classTarget[periodClass]][idx];
+}
+
+/*!
+ * Gives 10x the difference between a total period and one second. This
+ * penalises period sets which do not add up to a whole second.
+ * @param total the sum of the periods in the second
+ */
+static inline uint32_t secondLengthError(
+	int total
+) {
+	int delta = (int)SYSTICK_ONESEC - total;
+	return (uint32_t)(10*((delta < 0) ? -delta : delta));
+}
+
+/*!
+ * Calculates an error score for how well two period match two target periods.
+ * If the match is exact [(p1 == m1) and (p2 == m2) _and_ the two bit periods
+ * add up to 1000ms] the returned value is 0 - the minimum error (maximum match).
+ * As the p values move away from the m values the error score will increase.
+ * @param p1 the test period 1
+ * @param p2 the test period 2
+ * @param m1 the class of target period 1
+ * @param m2 the class of target period 2
+ */
+static inline uint32_t periodMatch2Periods(
+	uint8_t p1,
+	uint8_t p2,
+	enum MSF_PERIOD_CLASS m1,
+	enum MSF_PERIOD_CLASS m2
+) {
+	uint32_t pcMatch = classError(m1, p1) + classError(m2, p2);
+	pcMatch += secondLengthError(p1 + p2);
+	return pcMatch/3;
+}
+
+/*!
+ * Calculates an error score for how well four period match 100,100,100,700ms.
+ * If the match is exact [(p100_1 == 100ms) and (p100_2 == 100ms) and
+ * (p100_3=100ms) _and_ p100_1+p100_2+p100_3+p700 = 1000ms] the returned value
+ * is 0 - the minimum error (maximum match). As the values move away from the
+ * 100/100/100/700 ms values the error score will increase.
+ * @param p100_1 the 100ms test period
+ * @param p100_2 the 100ms test period
+ * @param p100_3 the 100ms test period
+ * @param p700 the 700ms test period
+ */
+static inline uint32_t periodMatch_100_100_100_700(
+	uint8_t p100_1,
+	uint8_t p100_2,
+	uint8_t p100_3,
+	uint8_t p700
+) {
+	uint32_t pcMatch = classError(MSF_PERIOD_LOW_100, p100_1) +
+					   classError(MSF_PERIOD_HIGH_100, p100_2) +
+					   classError(MSF_PERIOD_LOW_100, p100_3) +
+					   classError(MSF_PERIOD_HIGH_700, p700);
+	pcMatch += secondLengthError(p100_1 + p100_2 + p100_3 + p700);
+	return pcMatch/5;
+}
+
+/*!
+ * Indicates if a test value is an acceptable error and is the minimum error
+ * in a set of 3.
+ * @param test the value to test for being the minimum acceptable error
+ * @param e1 one of the 3 comparator error values
+ * @param e2 one of the 3 comparator error values
+ * @param e3 one of the 3 comparator error values
+ * @return true if test is an acceptable error value and is smaller than
+ *         any in the set {e1,e2,e3}
+ */
+static inline bool isBestError(
+	uint32_t test,
+	uint32_t e1,
+	uint32_t e2,
+	uint32_t e3
+) {
+	return (test < tuning.maxError) &&
+		   (test < e1) && (test < e2) && (test < e3);
+}
+
+/*!
+ * Classifies the periods at the start of a MSF second.
+ *
+ *  +0   +100 +200 +300 +400 +500 +600 +700 +800 +900 +1000  ms
+ *   +----+----+----+----+----+----+----+----+----+----+
+ *         ____ ____ ___________________________________
+ * x|_____|_Ax_|_Bx_|
+ *
+ * For each second we will get one of:
+ *   0:300, 1:700                => Ax = 1, Bx = 1
+ *   0:200, 1:800,               => Ax = 1, Bx = 0
+ *   0:100, 1:100, 0:100, 1:700  => Ax = 0, Bx = 1
+ *   0:100, 1:900                => Ax = 0, Bx = 0
+ * @param p0 the first (low) period of the second
+ * @param p1 the second (high) period
+ * @param p2 the third period, if have4Periods
+ * @param p3 the fourth period, if have4Periods
+ * @param have4Periods true if p2,p3 hold real periods. If not the four
+ *        period pattern is given a nominal error score of 100.
+ * @param scores assigned the error score of each pattern
+ * @return the best matching pattern, or MSF_SEC_NO_MATCH if no pattern
+ *         is clearly the best acceptable match
+ */
+enum MSF_SECOND_TYPE msfClassifySecond(
+	uint8_t p0,
+	uint8_t p1,
+	uint8_t p2,
+	uint8_t p3,
+	bool have4Periods,
+	struct MSF_SECOND_SCORES& scores
+) {
+	scores.err_300_700 = periodMatch2Periods(p0, p1, MSF_PERIOD_LOW_300,
+											 MSF_PERIOD_HIGH_700);
+	scores.err_200_800 = periodMatch2Periods(p0, p1, MSF_PERIOD_LOW_200,
+											 MSF_PERIOD_HIGH_800);
+	scores.err_100_900 = periodMatch2Periods(p0, p1, MSF_PERIOD_LOW_100,
+											 MSF_PERIOD_HIGH_900);
+	scores.err_100_100_100_700 = have4Periods ?
+		periodMatch_100_100_100_700(p0, p1, p2, p3) : 100;
+	if (isBestError(scores.err_300_700,
+					scores.err_200_800, scores.err_100_900,
+					scores.err_100_100_100_700)) {
+		return MSF_SEC_300_700;
+	}
+	if (isBestError(scores.err_200_800,
+					scores.err_300_700, scores.err_100_900,
+					scores.err_100_100_100_700)) {
+		return MSF_SEC_200_800;
+	}
+	if (isBestError(scores.err_100_900,
+					scores.err_300_700, scores.err_200_800,
+					scores.err_100_100_100_700)) {
+		return MSF_SEC_100_900;
+	}
+	if (isBestError(scores.err_100_100_100_700,
+					scores.err_300_700, scores.err_200_800,
+					scores.err_100_900)) {
+		return MSF_SEC_100_100_100_700;
+	}
+	return MSF_SEC_NO_MATCH;
+}
+
+/*! The match score of a pattern that has not been tried */
+const uint32_t UNTRIED = 0xFFFF;
+
+/*!
+ * Gives the cost of reading a pulse as a glitch: the base cost plus 0.6
+ * per ms of pulse, so a real 100ms A/B pulse is never cheaper to ignore
+ * than to match.
+ * @param glitch the pulse period
+ */
+static inline uint32_t glitchCost(
+	uint8_t glitch
+) {
+	return MSF_GLITCH_COST + 600*glitch/SYSTICK_ONESEC;
+}
+
+/*!
+ * Gives one period made from three, the middle one being a glitch
+ */
+static inline uint8_t mergePeriods(
+	uint8_t p0,
+	uint8_t p1,
+	uint8_t p2
+) {
+	unsigned total = p0 + p1 + p2;
+	return (uint8_t)((total > 255) ? 255 : total);
+}
+
+/*!
+ * Keeps the lower of a pattern's score so far and a new one
+ */
+static inline void keepBest(
+	uint32_t& best,
+	uint32_t score
+) {
+	if (score < best) {
+		best = score;
+	}
+}
+
+/*!
+ * Scores a low/high period pair against the three two period patterns
+ * @param extra the glitch cost of reading the periods this way
+ * @param typeCost the best score of each pattern, which we update
+ */
+static void matchTwo(
+	uint8_t low,
+	uint8_t high,
+	uint32_t extra,
+	uint32_t typeCost[]
+) {
+	keepBest(typeCost[MSF_SEC_300_700],
+			 periodMatch2Periods(low, high, MSF_PERIOD_LOW_300,
+								 MSF_PERIOD_HIGH_700) + extra);
+	keepBest(typeCost[MSF_SEC_200_800],
+			 periodMatch2Periods(low, high, MSF_PERIOD_LOW_200,
+								 MSF_PERIOD_HIGH_800) + extra);
+	keepBest(typeCost[MSF_SEC_100_900],
+			 periodMatch2Periods(low, high, MSF_PERIOD_LOW_100,
+								 MSF_PERIOD_HIGH_900) + extra);
+}
+
+/*!
+ * Scores four periods against the 100/100/100/700 pattern
+ * @param extra the glitch cost of reading the periods this way
+ * @param typeCost the best score of each pattern, which we update
+ */
+static void matchFour(
+	uint8_t p0,
+	uint8_t p1,
+	uint8_t p2,
+	uint8_t p3,
+	uint32_t extra,
+	uint32_t typeCost[]
+) {
+	keepBest(typeCost[MSF_SEC_100_100_100_700],
+			 periodMatch_100_100_100_700(p0, p1, p2, p3) + extra);
+}
+
+/*!
+ * Classifies a span of periods as one MSF second. Besides the clean 2 and
+ * 4 period patterns, up to two short pulses within the span may be read
+ * as glitches, merging each with the periods either side, at a cost.
+ * Should no pattern match, the span may still be taken as an erasure: a
+ * second (or two, if it lasts two seconds) whose bits are unknown, but
+ * which keeps the seconds after it in step.
+ * @param pPeriods the periods, the first being the low period starting
+ *        the second
+ * @param count the number of periods (2, 4 or 6)
+ * @param match assigned how the span matches
+ * @return false if the span cannot be one second, not even an erasure
+ */
+bool msfClassifySpan(
+	const uint8_t* pPeriods,
+	unsigned count,
+	struct MSF_SPAN_MATCH& match
+) {
+	uint32_t typeCost[MSF_SEC_NO_MATCH] = {
+		UNTRIED, UNTRIED, UNTRIED, UNTRIED
+	};
+	const uint8_t* p = pPeriods;
+	int total = 0;
+	for (unsigned idx = 0; idx < count; ++idx) {
+		total += p[idx];
+	}
+	if (count == 2) {
+		matchTwo(p[0], p[1], 0, typeCost);
+	} else if (count == 4) {
+		matchFour(p[0], p[1], p[2], p[3], 0, typeCost);
+		matchTwo(mergePeriods(p[0], p[1], p[2]), p[3],
+				 glitchCost(p[1]), typeCost);
+		matchTwo(p[0], mergePeriods(p[1], p[2], p[3]),
+				 glitchCost(p[2]), typeCost);
+	} else if (count == 6) {
+		matchFour(mergePeriods(p[0], p[1], p[2]), p[3], p[4], p[5],
+				  glitchCost(p[1]), typeCost);
+		matchFour(p[0], mergePeriods(p[1], p[2], p[3]), p[4], p[5],
+				  glitchCost(p[2]), typeCost);
+		matchFour(p[0], p[1], mergePeriods(p[2], p[3], p[4]), p[5],
+				  glitchCost(p[3]), typeCost);
+		matchFour(p[0], p[1], p[2], mergePeriods(p[3], p[4], p[5]),
+				  glitchCost(p[4]), typeCost);
+		matchTwo(p[0], mergePeriods(mergePeriods(p[1], p[2], p[3]),
+									p[4], p[5]),
+				 glitchCost(p[2]) + glitchCost(p[4]), typeCost);
+		matchTwo(mergePeriods(p[0], p[1], p[2]),
+				 mergePeriods(p[3], p[4], p[5]),
+				 glitchCost(p[1]) + glitchCost(p[4]), typeCost);
+		matchTwo(mergePeriods(mergePeriods(p[0], p[1], p[2]), p[3], p[4]),
+				 p[5], glitchCost(p[1]) + glitchCost(p[3]), typeCost);
+	} else {
+		return false;
+	}
+	unsigned best = 0;
+	for (unsigned type = 1; type < MSF_SEC_NO_MATCH; ++type) {
+		if (typeCost[type] < typeCost[best]) {
+			best = type;
+		}
+	}
+	match.guess = (enum MSF_SECOND_TYPE)best;
+	match.seconds = 1;
+	if (typeCost[best] < tuning.maxError) {
+		/* The best pattern with the other bit value sets each margin */
+		uint32_t otherA = UNTRIED;
+		uint32_t otherB = UNTRIED;
+		for (unsigned type = 0; type < MSF_SEC_NO_MATCH; ++type) {
+			enum MSF_SECOND_TYPE secondType = (enum MSF_SECOND_TYPE)type;
+			if (msfSecondABit(secondType) != msfSecondABit(match.guess)) {
+				keepBest(otherA, typeCost[type]);
+			}
+			if (msfSecondBBit(secondType) != msfSecondBBit(match.guess)) {
+				keepBest(otherB, typeCost[type]);
+			}
+		}
+		otherA -= typeCost[best];
+		otherB -= typeCost[best];
+		match.type = match.guess;
+		match.cost = (uint16_t)typeCost[best];
+		match.aConfidence = (uint8_t)((otherA > 255) ? 255 : otherA);
+		match.bConfidence = (uint8_t)((otherB > 255) ? 255 : otherB);
+		return true;
+	}
+	int delta = total - (int)SYSTICK_ONESEC;
+	if (delta > (int)SYSTICK_ONESEC/2) {
+		/* Noise may have hidden the low period starting a second */
+		match.seconds = 2;
+		match.guess = MSF_SEC_100_900;
+		delta -= SYSTICK_ONESEC;
+	}
+	if ((delta > MSF_ERASURE_SLACK) || (delta < -MSF_ERASURE_SLACK)) {
+		return false;
+	}
+	match.type = MSF_SEC_NO_MATCH;
+	match.cost = (uint16_t)(match.seconds*MSF_ERASURE_COST +
+							secondLengthError(SYSTICK_ONESEC + delta));
+	match.aConfidence = 0;
+	match.bConfidence = 0;
+	return true;
+}
+
+/*!
+ * Gives the time the MSF level was low within a time window
+ * @param pPeriods the periods, alternately low and high starting low
+ * @param pEnds the time each period ended, in ticks
+ * @param count the number of periods
+ * @param from the start of the window, in ticks
+ * @param to the end of the window, in ticks
+ * @return the ticks of the window the level was low for
+ */
+static uint32_t lowTicksWithin(
+	const uint8_t* pPeriods,
+	const uint16_t* pEnds,
+	unsigned count,
+	uint32_t from,
+	uint32_t to
+) {
+	/* Find the first period ending after the window starts */
+	unsigned lo = 0;
+	unsigned hi = count;
+	while (lo < hi) {
+		unsigned mid = (lo + hi)/2;
+		if (pEnds[mid] <= from) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	uint32_t low = 0;
+	for (unsigned idx = lo; idx < count; ++idx) {
+		uint32_t start = (pEnds[idx] > pPeriods[idx]) ?
+						 pEnds[idx] - pPeriods[idx] : 0;
+		if (start >= to) {
+			break;
+		}
+		if ((idx & 1) == 0) {
+			uint32_t end = pEnds[idx];
+			low += ((end < to) ? end : to) - ((start > from) ? start : from);
+		}
+	}
+	return low;
+}
+
+/*!
+ * Gives how clearly a window was low or high (0..100)
+ * @param low the ticks of the window the level was low for
+ * @param length the length of the window, in ticks
+ */
+static inline uint8_t windowConfidence(
+	uint32_t low,
+	uint32_t length
+) {
+	int32_t margin = 2*(int32_t)low - (int32_t)length;
+	if (margin < 0) {
+		margin = -margin;
+	}
+	return (uint8_t)(100*margin/(int32_t)length);
+}
+
+/*!
+ * Classifies one second from where its edges fall within its window on
+ * the second grid, rather than from the lengths of the periods before
+ * it. A split or merged period elsewhere in the minute then has no
+ * effect here, so each second can be classified on its own.
+ *
+ * The second is split into 100ms slots: the first should be low, the
+ * second is low for A = 1, the third is low for B = 1 and the rest should
+ * be high. A guard band at each slot edge allows for edge jitter. Should
+ * the receiver stretch the low periods, the low level runs on past the
+ * end of a low slot, so the windows of the slots that follow start that
+ * much later; should it shrink them, the windows end that much sooner.
+ * @param pPeriods the minute's periods, alternately low and high starting
+ *        with the low period starting second 1
+ * @param pEnds the time each period ended, in ticks after the minute
+ *        marker
+ * @param count the number of periods
+ * @param secondStart the start of the second on the grid, in ticks after
+ *        the minute marker
+ * @param result assigned the A/B bits and their confidences
+ */
+void msfClassifyGridSecond(
+	const uint8_t* pPeriods,
+	const uint16_t* pEnds,
+	unsigned count,
+	uint32_t secondStart,
+	struct MSF_GRID_SECOND& result
+) {
+	const int stretch = tuning.centre[MSF_PERIOD_LOW_100];
+	const uint32_t slot = ms100;
+	const uint32_t guard = slot/5;
+	const uint32_t startGuard = guard + ((stretch > 0) ? stretch : 0);
+	const uint32_t endGuard = guard + ((stretch < 0) ? -stretch : 0);
+	const uint32_t markLength = slot - guard - endGuard;
+	const uint32_t slotLength = slot - startGuard - endGuard;
+	const uint32_t tailLength = 7*slot - startGuard - guard;
+	uint32_t markLow = lowTicksWithin(pPeriods, pEnds, count,
+									  secondStart + guard,
+									  secondStart + slot - endGuard);
+	uint32_t aLow = lowTicksWithin(pPeriods, pEnds, count,
+								   secondStart + slot + startGuard,
+								   secondStart + 2*slot - endGuard);
+	uint32_t bLow = lowTicksWithin(pPeriods, pEnds, count,
+								   secondStart + 2*slot + startGuard,
+								   secondStart + 3*slot - endGuard);
+	uint32_t tailLow = lowTicksWithin(pPeriods, pEnds, count,
+									  secondStart + 3*slot + startGuard,
+									  secondStart + 10*slot - guard);
+	result.aBit = (2*aLow > slotLength) ? 1 : 0;
+	result.bBit = (2*bLow > slotLength) ? 1 : 0;
+	if ((2*markLow > markLength) && (4*tailLow < tailLength)) {
+		result.aConfidence = windowConfidence(aLow, slotLength);
+		result.bConfidence = windowConfidence(bLow, slotLength);
+	} else {
+		result.aConfidence = 0;
+		result.bConfidence = 0;
+	}
+}
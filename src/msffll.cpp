@@ -0,0 +1,125 @@
+/*
+ * msffll.cpp
+ *
+ * The frequency locked loop. Each good decode gives the time (in sampler
+ * us) that a MSF minute started. Comparing that with the last good decode
+ * gives how far the sampler clock has drifted over the minutes between
+ * them, and so its frequency error. The correction is moved towards that
+ * error a step at a time, so a single poor measurement does little harm.
+ *
+ */
+
+#include <stdint.h>
+#include "msffll.h"
+
+/*! One minute, in us */
+const int64_t US_PER_MIN = 60000000;
+
+/*!
+ * The frequency locked loop state
+ */
+static struct {
+	bool samplerCorrected;  /*!< The sampler clock has the correction applied */
+	bool haveFix;           /*!< lastTime and lastMinute hold a fix */
+	bool locked;            /*!< The correction has been measured */
+	uint32_t lastTime;      /*!< The usAtTime of the last good decode */
+	uint32_t lastMinute;    /*!< Its minute of the day */
+	int32_t correction;     /*!< The current clock correction, in ppb */
+	int32_t clockError;     /*!< The last measured crystal error, in ppb */
+} fll;
+
+/*!
+ * Gives the minute of the day of a decoded date/time
+ */
+static inline uint32_t minuteOfDay(
+	const struct MSF_DATE_TIME& dateTime
+) {
+	return dateTime.hour*60UL + dateTime.min;
+}
+
+/*!
+ * Resets the loop.
+ * @param samplerCorrected true if the sampler times come from the system
+ *        tick, so already have the correction applied. If false the sampler
+ *        times come straight from the crystal.
+ */
+void MSFFLL_init(
+	bool samplerCorrected
+) {
+	fll.samplerCorrected = samplerCorrected;
+	fll.haveFix = false;
+	fll.locked = false;
+	fll.correction = 0;
+	fll.clockError = 0;
+}
+
+/*!
+ * Measures the clock against a good decode and updates the correction.
+ * @param dateTime the decoded date/time
+ * @return true if the correction was updated
+ */
+bool MSFFLL_update(
+	const struct MSF_DATE_TIME& dateTime
+) {
+	bool updated = false;
+	if (dateTime.usAtTimeError == 0) {
+		/* No minute start time to measure against */
+		return false;
+	}
+	if (fll.haveFix) {
+		uint32_t span = (minuteOfDay(dateTime) + 1440 - fll.lastMinute) % 1440;
+		int64_t elapsed = (int64_t)(dateTime.usAtTime - fll.lastTime);
+		if ((span > 0) && (span <= MSF_FLL_MAX_SPAN) &&
+			(elapsed > (span - 1)*US_PER_MIN) &&
+			(elapsed < (span + 1)*US_PER_MIN)) {
+			/* us per minute gained is ppm, x1000/60 gives ppb */
+			int64_t gained = elapsed - span*US_PER_MIN;
+			int32_t measured = (int32_t)(gained*1000/(60*(int64_t)span));
+			int32_t residual = fll.samplerCorrected ?
+							   measured : measured - fll.correction;
+			if ((residual < MSF_FLL_MAX_ERROR) &&
+				(residual > -MSF_FLL_MAX_ERROR)) {
+				fll.clockError = fll.correction + residual;
+				/* Take the first measurement as it is */
+				fll.correction += fll.locked ?
+								  residual/MSF_FLL_GAIN : residual;
+				fll.locked = true;
+				updated = true;
+			}
+		}
+	}
+	fll.lastTime = dateTime.usAtTime;
+	fll.lastMinute = minuteOfDay(dateTime);
+	fll.haveFix = true;
+	return updated;
+}
+
+/*!
+ * Gives the current clock correction. A positive value means the crystal
+ * runs fast, so each tick needs that many ppb more crystal cycles.
+ * @return the correction in ppb
+ */
+int32_t MSFFLL_readCorrection(void) {
+	return fll.correction;
+}
+
+/*!
+ * Gives the crystal error found by the last measurement which updated the
+ * correction. Unlike the correction, this is not smoothed.
+ * @return the crystal error in ppb (positive if it runs fast)
+ */
+int32_t MSFFLL_readClockError(void) {
+	return fll.clockError;
+}
+
+/*!
+ * Overrides the clock correction, e.g. while the local clock is steered
+ * from a model rather than from MSF. The system tick must be given the
+ * same correction, as later measurements are made against it.
+ * @param correction the correction in ppb
+ */
+void MSFFLL_setCorrection(
+	int32_t correction
+) {
+	fll.correction = correction;
+}
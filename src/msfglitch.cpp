@@ -0,0 +1,125 @@
+/*
+ * msfglitch.cpp
+ *
+ * Filters glitches out of the MSF receiver output before the sampler
+ * state machine sees it. The filter integrates the level: the time spent
+ * high counts up and the time spent low counts down, between 0 and the
+ * hold time, and the filtered level only changes on reaching a limit. A
+ * glitch shorter than the hold time never gets through, nor does a burst
+ * of them that is more one level than the other by less than the hold
+ * time, so the state machine only ever sees clean, alternating edges.
+ *
+ * An edge that gets through is timed from the unfiltered edge that
+ * started it, so a clean edge keeps its exact time even though it is only
+ * passed on once the hold time has gone by.
+ *
+ * The hold time follows the glitch rate. The decoder copes with the odd
+ * glitch far better than with a period the filter has eaten into, so the
+ * hold time is kept short while glitches are rare. It is lengthened as
+ * they become common, before they can fill the minute's period buffer.
+ *
+ */
+
+#include <stdint.h>
+#include "msfglitch.h"
+
+/*!
+ * Sets the hold time from the glitches counted over the last adapt period
+ * @param filter the glitch filter
+ */
+static void adaptHoldTime(
+	struct MSF_GLITCH_FILTER& filter
+) {
+	/* Smooth over about 4 periods */
+	filter.glitchRate = (3*filter.glitchRate + 4*filter.glitchCount + 2)/4;
+	filter.glitchCount = 0;
+	uint32_t holdTime = MSF_GLITCH_MIN_HOLD +
+						filter.glitchRate*MSF_GLITCH_HOLD_STEP/4;
+	if (holdTime > MSF_GLITCH_MAX_HOLD) {
+		holdTime = MSF_GLITCH_MAX_HOLD;
+	}
+	filter.holdTime = holdTime;
+	if (filter.integral > holdTime) {
+		filter.integral = holdTime;
+	}
+}
+
+/*!
+ * Prepares a glitch filter, with the MSF level high
+ * @param filter the glitch filter
+ * @param time the time (in us) now
+ */
+void msfGlitchInit(
+	struct MSF_GLITCH_FILTER& filter,
+	uint32_t time
+) {
+	filter.holdTime = MSF_GLITCH_MIN_HOLD;
+	filter.integral = filter.holdTime;
+	filter.lastTime = time;
+	filter.edgeTime = time;
+	filter.edgeTicks = 0;
+	filter.adaptStart = time;
+	filter.glitchCount = 0;
+	filter.glitchRate = 0;
+	filter.rawLevel = 1;
+	filter.level = 1;
+}
+
+/*!
+ * Feeds the glitch filter the MSF level at a time, which may be either a
+ * sample or the level following an edge. It should be fed at least every
+ * 100ms or so even without an edge, so that an edge is passed on soon
+ * after the hold time has gone by.
+ * @param filter the glitch filter
+ * @param time the time (in us). Only differences between times are used,
+ *        so this may wrap.
+ * @param ticks the system tick count at time
+ * @param msfLevel the MSF level (0/1) from time on
+ * @param edge assigned the filtered edge, if there is one
+ * @return true if the filtered level changed, so edge was assigned
+ */
+bool msfGlitchFeed(
+	struct MSF_GLITCH_FILTER& filter,
+	uint32_t time,
+	uint32_t ticks,
+	int msfLevel,
+	struct MSF_GLITCH_EDGE& edge
+) {
+	bool changed = false;
+	/* Integrate the level up to now */
+	uint32_t elapsed = time - filter.lastTime;
+	filter.lastTime = time;
+	if (filter.rawLevel != 0) {
+		filter.integral = (elapsed < filter.holdTime - filter.integral) ?
+						  filter.integral + elapsed : filter.holdTime;
+		if ((filter.integral == filter.holdTime) && (filter.level == 0)) {
+			changed = true;
+		}
+	} else {
+		filter.integral = (elapsed < filter.integral) ?
+						  filter.integral - elapsed : 0;
+		if ((filter.integral == 0) && (filter.level != 0)) {
+			changed = true;
+		}
+	}
+	if (changed) {
+		filter.level = filter.rawLevel;
+		edge.time = filter.edgeTime;
+		edge.ticks = filter.edgeTicks;
+		edge.level = filter.level;
+	}
+	if ((uint8_t)msfLevel != filter.rawLevel) {
+		if (time - filter.edgeTime < MSF_GLITCH_MAX_HOLD) {
+			/* Too short to be any MSF period */
+			++filter.glitchCount;
+		}
+		filter.rawLevel = (uint8_t)msfLevel;
+		filter.edgeTime = time;
+		filter.edgeTicks = ticks;
+	}
+	if (time - filter.adaptStart >= MSF_GLITCH_ADAPT_PERIOD) {
+		filter.adaptStart = time;
+		adaptHoldTime(filter);
+	}
+	return changed;
+}
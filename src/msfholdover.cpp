@@ -0,0 +1,293 @@
+/*
+ * msfholdover.cpp
+ *
+ * The holdover engine. The crystal error measured by the frequency locked
+ * loop is learnt into 1 degree C bins of board temperature. Each bin keeps
+ * a running mean of the error and of how far measurements stray from it.
+ * In holdover the correction for the current temperature is interpolated
+ * between the nearest learnt bins either side, and the local time error
+ * bound grows at a rate which covers the bin spread plus an allowance for
+ * how far the temperature is from anything learnt.
+ *
+ */
+
+#include <stdint.h>
+#include "systick.h"
+#include "msfholdover.h"
+
+/*! One degree C, in the 1/256ths of a degree C temperatures are kept in */
+const int32_t ONE_DEGREE = 256;
+/*! Once a bin has this many measurements, each new one has this weight */
+const uint32_t BIN_WEIGHT = 16;
+/*! Outliers are only dropped from bins with at least this many measurements */
+const uint32_t BIN_SETTLED = 4;
+/*! The smoothed temperature follows readings with a weight of 1/8 */
+const int32_t TEMP_WEIGHT = 8;
+/*! One minute, in us */
+const uint64_t US_PER_MIN = 60000000;
+
+/*!
+ * The crystal error learnt at one temperature
+ */
+struct HOLDOVER_BIN {
+	int32_t meanError;      /*!< The mean crystal error, in ppb */
+	uint32_t spread;        /*!< The mean deviation from meanError, in ppb */
+	uint32_t count;         /*!< Measurements learnt, up to BIN_WEIGHT */
+};
+
+/*!
+ * The holdover state
+ */
+static struct {
+	bool haveTemperature;   /*!< temperature holds a reading */
+	bool haveFix;           /*!< There has been a good decode */
+	bool haveError;         /*!< lastError holds a measurement */
+	bool active;            /*!< The correction comes from the model */
+	int32_t temperature;    /*!< The smoothed temperature, 1/256 deg C */
+	int32_t lastError;      /*!< The last crystal error learnt, in ppb */
+	int32_t correction;     /*!< The model correction, in ppb */
+	uint64_t lastFixTime;   /*!< The local time of the last fix, in us */
+	uint64_t lastServiceTime; /*!< The local time of the last service */
+	uint64_t errorBound;    /*!< The local time error bound, in ns */
+	struct HOLDOVER_BIN bins[MSF_HOLDOVER_BINS];
+} holdover;
+
+/*!
+ * Gives the model bin for a temperature
+ * @param temperature the temperature, in 1/256ths of a degree C
+ * @return the bin index, or -1 if out of the model's range
+ */
+static int32_t binIndex(
+	int32_t temperature
+) {
+	int32_t fromMin = temperature - MSF_HOLDOVER_MIN_TEMP*ONE_DEGREE +
+					  ONE_DEGREE/2;
+	if ((fromMin < 0) ||
+		(fromMin >= (int32_t)MSF_HOLDOVER_BINS*ONE_DEGREE)) {
+		return -1;
+	}
+	return fromMin/ONE_DEGREE;
+}
+
+/*!
+ * Gives the temperature at the centre of a model bin
+ * @return the temperature, in 1/256ths of a degree C
+ */
+static inline int32_t binTemperature(
+	int32_t idx
+) {
+	return (MSF_HOLDOVER_MIN_TEMP + idx)*ONE_DEGREE;
+}
+
+/*!
+ * Gives the absolute value
+ */
+static inline uint32_t absError(
+	int32_t error
+) {
+	return (error < 0) ? (uint32_t)-error : (uint32_t)error;
+}
+
+/*!
+ * Predicts the crystal error at the current (smoothed) temperature
+ * @param rateError assigned the uncertainty of the prediction, in ppb
+ * @return the predicted crystal error, in ppb
+ */
+static int32_t predictError(
+	uint32_t& rateError
+) {
+	int32_t idx = holdover.haveTemperature ?
+				  binIndex(holdover.temperature) : -1;
+	int32_t below = -1;
+	int32_t above = -1;
+	if (idx >= 0) {
+		for (below = idx; below >= 0; --below) {
+			if (holdover.bins[below].count != 0) {
+				break;
+			}
+		}
+		for (above = idx; above < (int32_t)MSF_HOLDOVER_BINS; ++above) {
+			if (holdover.bins[above].count != 0) {
+				break;
+			}
+		}
+		if (above == (int32_t)MSF_HOLDOVER_BINS) {
+			above = -1;
+		}
+	}
+	if ((below < 0) && (above < 0)) {
+		/* Nothing learnt here, so hold the last measurement */
+		rateError = MSF_HOLDOVER_NO_MODEL_ERROR;
+		return holdover.haveError ? holdover.lastError : 0;
+	}
+	if (below < 0) {
+		below = above;
+	} else if (above < 0) {
+		above = below;
+	}
+	const struct HOLDOVER_BIN& lower = holdover.bins[below];
+	const struct HOLDOVER_BIN& upper = holdover.bins[above];
+	int32_t error = lower.meanError;
+	int32_t fromLower = holdover.temperature - binTemperature(below);
+	int32_t toUpper = binTemperature(above) - holdover.temperature;
+	if (above != below) {
+		error += (int32_t)((int64_t)(upper.meanError - lower.meanError)*
+						   fromLower / (binTemperature(above) -
+										binTemperature(below)));
+	}
+	/* Allow for the distance to the nearest learnt bin */
+	uint32_t distance = absError(fromLower);
+	if (absError(toUpper) < distance) {
+		distance = absError(toUpper);
+	}
+	if (distance < (uint32_t)ONE_DEGREE/2) {
+		distance = 0;
+	}
+	rateError = MSF_HOLDOVER_BASE_ERROR +
+				((lower.spread > upper.spread) ? lower.spread : upper.spread) +
+				MSF_HOLDOVER_SLOPE_ERROR*distance/ONE_DEGREE;
+	return error;
+}
+
+/*!
+ * Forgets everything learnt and leaves holdover
+ */
+void MSFHoldover_init(void) {
+	holdover.haveTemperature = false;
+	holdover.haveFix = false;
+	holdover.haveError = false;
+	holdover.active = false;
+	holdover.temperature = 0;
+	holdover.lastError = 0;
+	holdover.correction = 0;
+	holdover.errorBound = 0;
+	for (uint32_t idx = 0; idx < MSF_HOLDOVER_BINS; ++idx) {
+		holdover.bins[idx].meanError = 0;
+		holdover.bins[idx].spread = 0;
+		holdover.bins[idx].count = 0;
+	}
+}
+
+/*!
+ * Learns a crystal error measurement at the current temperature
+ * @param clockError the measured crystal error, in ppb (positive if the
+ *        crystal runs fast)
+ */
+void MSFHoldover_learn(
+	int32_t clockError
+) {
+	holdover.lastError = clockError;
+	holdover.haveError = true;
+	if (!holdover.haveTemperature) {
+		return;
+	}
+	int32_t idx = binIndex(holdover.temperature);
+	if (idx < 0) {
+		return;
+	}
+	struct HOLDOVER_BIN& bin = holdover.bins[idx];
+	int32_t deviation = clockError - bin.meanError;
+	if (bin.count == 0) {
+		/* Until the bin settles, assume it is no better than a neighbour */
+		bin.meanError = clockError;
+		bin.spread = MSF_HOLDOVER_SLOPE_ERROR;
+		bin.count = 1;
+		return;
+	}
+	if ((bin.count >= BIN_SETTLED) &&
+		((deviation > MSF_HOLDOVER_MAX_JUMP) ||
+		 (deviation < -MSF_HOLDOVER_MAX_JUMP))) {
+		return;
+	}
+	if (bin.count < BIN_WEIGHT) {
+		++bin.count;
+	}
+	bin.meanError += deviation/(int32_t)bin.count;
+	bin.spread = bin.spread + absError(deviation)/bin.count -
+				 bin.spread/bin.count;
+}
+
+/*!
+ * Records a good decode, which ends any holdover
+ * @param uncertainty the uncertainty of the decoded minute start, in us
+ */
+void MSFHoldover_fix(
+	uint32_t uncertainty
+) {
+	uint64_t now = SysTick_readMicros();
+	holdover.lastFixTime = now;
+	holdover.lastServiceTime = now;
+	holdover.errorBound = (uint64_t)uncertainty*1000;
+	holdover.haveFix = true;
+	holdover.active = false;
+}
+
+/*!
+ * Gives the model a board temperature reading. Call about once a second.
+ * @param temperature the board temperature, in 1/256ths of a degree C
+ */
+void MSFHoldover_setTemperature(
+	int16_t temperature
+) {
+	if (!holdover.haveTemperature) {
+		holdover.temperature = temperature;
+		holdover.haveTemperature = true;
+	} else {
+		holdover.temperature += (temperature - holdover.temperature)/
+								TEMP_WEIGHT;
+	}
+}
+
+/*!
+ * Grows the error bound, starts holdover once the decodes have stopped
+ * and updates the correction while in holdover. Call about once a second.
+ * @return true if in holdover and the correction has changed, so should
+ *         be given to the system tick
+ */
+bool MSFHoldover_service(void) {
+	if (!holdover.haveFix) {
+		return false;
+	}
+	uint64_t now = SysTick_readMicros();
+	uint32_t rateError;
+	int32_t error = predictError(rateError);
+	/* us x ppb / 1e6 gives ns */
+	holdover.errorBound += (now - holdover.lastServiceTime)*rateError/
+						   1000000;
+	holdover.lastServiceTime = now;
+	bool changed = false;
+	if (!holdover.active &&
+		(now - holdover.lastFixTime > MSF_HOLDOVER_DELAY*US_PER_MIN)) {
+		holdover.active = true;
+		changed = true;
+	}
+	if (holdover.active && (error != holdover.correction)) {
+		changed = true;
+	}
+	holdover.correction = error;
+	return holdover.active && changed;
+}
+
+/*!
+ * Tells if the clock correction comes from the model
+ */
+bool MSFHoldover_isActive(void) {
+	return holdover.active;
+}
+
+/*!
+ * Gives the modelled clock correction for the current temperature
+ * @return the correction in ppb
+ */
+int32_t MSFHoldover_readCorrection(void) {
+	return holdover.correction;
+}
+
+/*!
+ * Gives the bound on the local time error since the last good decode
+ * @return the error bound in us
+ */
+uint32_t MSFHoldover_readErrorBound(void) {
+	uint64_t bound = holdover.errorBound/1000;
+	return (bound > 0xFFFFFFFFUL) ? 0xFFFFFFFFUL : (uint32_t)bound;
+}
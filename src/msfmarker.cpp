@@ -0,0 +1,137 @@
+/*
+ * msfmarker.cpp
+ *
+ * Finds the MSF minute marker in the recent edges. The marker second is
+ * low for 500ms and high for the rest, and follows the end of second 59,
+ * which is high after its first 300ms. Rather than test the length of
+ * each period on its own, the edges are correlated against that whole
+ * pattern, so noise which splits a period or lengthens one a little only
+ * lowers the score, and the marker is placed where the pattern fits best.
+ *
+ */
+
+#include <stdint.h>
+#include "msfmarker.h"
+
+/*! 100ms, in us */
+const uint32_t MARKER_MS100 = 100000;
+/*!
+ * How far (in us) the next second start may be before 1s after the marker.
+ * Noise in the marker's high half which runs into the next second can
+ * bring its low edge well forward.
+ */
+const uint32_t MARKER_EARLY_GATE = 2*MARKER_MS100;
+/*! How far (in us) the next second start may be after 1s after the marker */
+const uint32_t MARKER_LATE_GATE = MARKER_MS100;
+/*!
+ * The part (in us) of the template at each of its edges that is not
+ * scored, to allow for the receiver stretching or shrinking periods
+ */
+const uint32_t MARKER_GUARD = MARKER_MS100/2;
+/*! How much of the end of second 59 (in us) the template covers */
+const uint32_t MARKER_LEAD = 7*MARKER_MS100;
+
+/*!
+ * Gives how long the MSF level was at a level within a window
+ * @param history the recent edges
+ * @param time the time (in us) the window is measured back from
+ * @param from the start of the window, in us before time
+ * @param to the end of the window, in us before time. Must be less than
+ *        from.
+ * @param level the MSF level (0/1)
+ * @return the time (in us) the window was at level. Any part of the
+ *         window before the oldest edge held is taken to be at the level
+ *         that edge left.
+ */
+static uint32_t timeAtLevel(
+	const struct MSF_MARKER_HISTORY& history,
+	uint32_t time,
+	uint32_t from,
+	uint32_t to,
+	uint8_t level
+) {
+	uint32_t total = 0;
+	uint32_t end = 0;
+	for (uint32_t idx = history.size(); idx-- > 0; ) {
+		const struct MSF_MARKER_EDGE& edge = history.at(idx);
+		uint32_t start = time - edge.time;
+		if (end >= from) {
+			return total;
+		}
+		if ((edge.level == level) && (start > to)) {
+			uint32_t lo = (end > to) ? end : to;
+			uint32_t hi = (start < from) ? start : from;
+			total += hi - lo;
+		}
+		end = start;
+	}
+	if ((history.size() != 0) && (history.at(0).level != level) &&
+		(end < from)) {
+		total += from - ((end > to) ? end : to);
+	}
+	return total;
+}
+
+/*!
+ * Scores how well the edges match the marker template
+ * @param history the recent edges
+ * @param time the time (in us) of the low edge starting the second after
+ *        the marker
+ * @param length the time (in us) from the low edge starting the marker
+ *        to time
+ * @return the score, 0..100
+ */
+static uint8_t scoreMarker(
+	const struct MSF_MARKER_HISTORY& history,
+	uint32_t time,
+	uint32_t length
+) {
+	const uint32_t lowStart = length - MARKER_GUARD;
+	const uint32_t lowEnd = length - 5*MARKER_MS100 + MARKER_GUARD;
+	const uint32_t leadStart = length + MARKER_LEAD;
+	const uint32_t leadEnd = length + MARKER_GUARD;
+	const uint32_t tailStart = length - 5*MARKER_MS100 - MARKER_GUARD;
+	const uint32_t tailEnd = MARKER_GUARD;
+	uint32_t low = timeAtLevel(history, time, lowStart, lowEnd, 0);
+	uint32_t high = timeAtLevel(history, time, leadStart, leadEnd, 1) +
+					timeAtLevel(history, time, tailStart, tailEnd, 1);
+	uint32_t lowPercent = 100*low/(lowStart - lowEnd);
+	uint32_t highPercent = 100*high /
+		(leadStart - leadEnd + tailStart - tailEnd);
+	return (uint8_t)(lowPercent*highPercent/100);
+}
+
+/*!
+ * Looks for a minute marker ending at a low edge. Each low edge held about
+ * a second before is tried as the start of the marker, and the one that
+ * scores best is taken.
+ * @param history the recent edges, up to but not including the low edge
+ * @param time the time (in us) of the low edge, which should start the
+ *        second after the marker
+ * @param minScore the least score (0..100) to take, MSF_MARKER_MIN_SCORE
+ *        unless the marker is expected
+ * @param match assigned the best marker found
+ * @return true if the best marker scored at least minScore
+ */
+bool msfFindMarker(
+	const struct MSF_MARKER_HISTORY& history,
+	uint32_t time,
+	uint8_t minScore,
+	struct MSF_MARKER_MATCH& match
+) {
+	match.score = 0;
+	for (uint32_t idx = 0; idx < history.size(); ++idx) {
+		const struct MSF_MARKER_EDGE& edge = history.at(idx);
+		uint32_t length = time - edge.time;
+		if ((edge.level == 0) &&
+			(length > 10*MARKER_MS100 - MARKER_EARLY_GATE) &&
+			(length < 10*MARKER_MS100 + MARKER_LATE_GATE)) {
+			uint8_t score = scoreMarker(history, time, length);
+			if (score > match.score) {
+				match.edge = edge;
+				match.score = score;
+			}
+		}
+	}
+	return match.score >= minScore;
+}
@@ -0,0 +1,156 @@
+/*
+ * msfphase.cpp
+ *
+ * Fits the MSF second grid to the low edges recorded over a minute. Each
+ * second starts with a low edge, so a minute gives around 60 observations
+ * of where the grid lies rather than just the one minute marker. A straight
+ * line fit of the edge times against the second number gives both the
+ * grid phase and the sampler clock rate error, and edges which are not
+ * second starts (or are noise) are rejected along the way.
+ *
+ */
+
+#include <stdint.h>
+#include "msfphase.h"
+
+/*! One second, in us */
+const int32_t US_PER_SEC = 1000000;
+/*!
+ * Edges within this (in us) of the fitted grid are never rejected, however
+ * small the spread of the others.
+ */
+const int64_t PHASE_MIN_REJECT = 1000;
+
+/*!
+ * Gives the integer square root of a value
+ */
+static uint32_t isqrt64(
+	uint64_t value
+) {
+	uint64_t root = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+	while (bit > value) {
+		bit >>= 2;
+	}
+	while (bit != 0) {
+		if (value >= root + bit) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint32_t)root;
+}
+
+/*!
+ * Divides, rounding to the nearest integer
+ */
+static inline int64_t divRound(
+	int64_t num,
+	int64_t den
+) {
+	if (den < 0) {
+		num = -num;
+		den = -den;
+	}
+	return (num >= 0) ? (num + den/2)/den : -((-num + den/2)/den);
+}
+
+/*!
+ * Fits the second grid to the low edges recorded in a sample buffer. Edges
+ * are first matched to the nearest whole second after the minute marker
+ * (the gate is checked again here so that any sample buffer can be used);
+ * a line is then fitted to their offsets from those seconds, dropping the
+ * worst fitting edge and refitting while it lies more than 3 sigma from
+ * the line.
+ * @param pSampleBuffer the sample buffer holding the minute's edges
+ * @param estimate assigned the fitted grid
+ * @return true if there were enough second start edges to fit the grid
+ */
+bool msfEstimatePhase(
+	const struct MSF_SAMPLE_BUFFER* pSampleBuffer,
+	struct MSF_PHASE_ESTIMATE& estimate
+) {
+	uint8_t secs[MSF_EDGE_COUNT];
+	int32_t offsets[MSF_EDGE_COUNT];
+	uint32_t n = 0;
+	uint32_t edgeCount = pSampleBuffer->edgeCount;
+	if (edgeCount < MSF_PHASE_MIN_EDGES) {
+		return false;
+	}
+	/* The last edge is the minute marker ending the minute */
+	uint32_t endSec = (pSampleBuffer->edgeOffsets[edgeCount - 1] +
+					   US_PER_SEC/2) / US_PER_SEC;
+	estimate.rejectCount = 0;
+	for (uint32_t idx = 0; idx < edgeCount; ++idx) {
+		uint32_t offset = pSampleBuffer->edgeOffsets[idx];
+		uint32_t sec = (offset + US_PER_SEC/2) / US_PER_SEC;
+		int32_t residual = (int32_t)(offset - sec*US_PER_SEC);
+		if ((sec <= 255) && (residual < (int32_t)MSF_EDGE_GATE) &&
+			(residual > -(int32_t)MSF_EDGE_GATE)) {
+			secs[n] = (uint8_t)sec;
+			offsets[n] = residual;
+			++n;
+		} else {
+			++estimate.rejectCount;
+		}
+	}
+	while (true) {
+		if (n < MSF_PHASE_MIN_EDGES) {
+			return false;
+		}
+		int64_t sumS = 0;
+		int64_t sumSS = 0;
+		int64_t sumR = 0;
+		int64_t sumSR = 0;
+		for (uint32_t idx = 0; idx < n; ++idx) {
+			sumS += secs[idx];
+			sumSS += (int64_t)secs[idx]*secs[idx];
+			sumR += offsets[idx];
+			sumSR += (int64_t)secs[idx]*offsets[idx];
+		}
+		/* The fitted offset at second s is (a + b*s)/d */
+		int64_t d = n*sumSS - sumS*sumS;
+		if (d == 0) {
+			return false;
+		}
+		int64_t a = sumR*sumSS - sumS*sumSR;
+		int64_t b = n*sumSR - sumS*sumR;
+		uint64_t sumErr2 = 0;
+		int64_t worstErr = 0;
+		uint32_t worstIdx = 0;
+		for (uint32_t idx = 0; idx < n; ++idx) {
+			int64_t err = divRound(offsets[idx]*d - a - b*secs[idx], d);
+			sumErr2 += (uint64_t)(err*err);
+			if (err*err > worstErr*worstErr) {
+				worstErr = err;
+				worstIdx = idx;
+			}
+		}
+		uint64_t variance = sumErr2/(n - 2);
+		if ((worstErr*worstErr > PHASE_MIN_REJECT*PHASE_MIN_REJECT) &&
+			((uint64_t)(worstErr*worstErr) > 9*variance)) {
+			/* Drop the worst edge and refit */
+			--n;
+			secs[worstIdx] = secs[n];
+			offsets[worstIdx] = offsets[n];
+			++estimate.rejectCount;
+			continue;
+		}
+		int64_t spread = (int64_t)n*endSec - sumS;
+		uint64_t endVariance = variance*(uint64_t)(d + spread*spread) /
+							   ((uint64_t)n*d);
+		estimate.minuteEndTime = pSampleBuffer->edgeStartTime +
+			endSec*US_PER_SEC + (int32_t)divRound(a + b*endSec, d);
+		estimate.uncertainty = isqrt64(endVariance);
+		if (estimate.uncertainty == 0) {
+			/* No better than the sampler resolution */
+			estimate.uncertainty = 1;
+		}
+		estimate.rateError = (int32_t)divRound(b*1000, d);
+		estimate.edgeCount = (uint8_t)n;
+		return true;
+	}
+}
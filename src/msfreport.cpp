@@ -0,0 +1,145 @@
+/*
+ * msfreport.cpp
+ *
+ * Makes, encodes and decodes the binary decode reports (see msfreport.h).
+ * A report is some 40 bytes on the wire against some 70 for the text
+ * message, and making it needs no formatting; the host reads it back with
+ * a memcpy once the COBS encoding and CRC are undone.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "crc16.h"
+#include "msfholdover.h"
+#include "timesource.h"
+#include "msfreport.h"
+
+/*!
+ * Sets the time fields of a report from the result of decoding a minute,
+ * and the time and holdover state now. The read totals are left for the
+ * caller to set.
+ * @param report the report
+ * @param decodeOK true if the decode was good
+ * @param dateTime the decoded date/time, if decodeOK
+ */
+void MSFReport_setTime(
+	struct MSF_REPORT& report,
+	bool decodeOK,
+	const struct MSF_DATE_TIME& dateTime
+) {
+	report.type = decodeOK ? MSF_REPORT_GOOD : MSF_REPORT_BAD;
+	report.flags = 0;
+	report.dut1 = 0;
+	report.minuteTime = 0;
+	if (decodeOK) {
+		if (dateTime.BST) {
+			report.flags |= MSF_REPORT_BST;
+		}
+		if (dateTime.predicted) {
+			report.flags |= MSF_REPORT_PREDICTED;
+		}
+		report.dut1 = (int16_t)dateTime.DUT1;
+		report.minuteTime = TimeSource_unixTime(dateTime);
+	}
+	uint64_t utcTime;
+	bool approximate = false;
+	if (TimeSource_readUTC(utcTime, &approximate)) {
+		report.flags |= MSF_REPORT_UTC_VALID;
+		if (approximate) {
+			report.flags |= MSF_REPORT_APPROXIMATE;
+		}
+		report.utcSeconds = (uint32_t)(utcTime/1000000);
+		report.utcMicros = (uint32_t)(utcTime%1000000);
+	} else {
+		report.utcSeconds = 0;
+		report.utcMicros = 0;
+	}
+	if (MSFHoldover_isActive()) {
+		report.flags |= MSF_REPORT_HOLDOVER;
+	}
+}
+
+/*!
+ * Encodes a report for sending: adds its CRC and COBS encodes it, with a
+ * zero byte either side
+ * @param report the report
+ * @param pFrame receives the encoded report, which takes at most
+ *               MSF_REPORT_FRAME_SIZE bytes
+ * @return the length of the encoded report
+ */
+size_t MSFReport_encode(
+	const struct MSF_REPORT& report,
+	uint8_t* pFrame
+) {
+	uint8_t data[MSF_REPORT_CRC_SIZE];
+	memcpy(data, &report, sizeof(report));
+	uint16_t crc = CRC16_addBlock(CRC16_INIT, data, sizeof(report));
+	data[sizeof(report)] = (uint8_t)crc;
+	data[sizeof(report) + 1] = (uint8_t)(crc >> 8);
+	size_t length = 0;
+	pFrame[length++] = 0;
+	/*
+	 * Each zero byte is replaced by the distance to the next, or to the
+	 * end; the first such distance goes before the data. The report is
+	 * too short to need a block of 254 non-zero bytes to be split.
+	 */
+	size_t codeIdx = length++;
+	uint8_t code = 1;
+	for (size_t idx = 0; idx < MSF_REPORT_CRC_SIZE; ++idx) {
+		if (data[idx] == 0) {
+			pFrame[codeIdx] = code;
+			codeIdx = length++;
+			code = 1;
+		} else {
+			pFrame[length++] = data[idx];
+			++code;
+		}
+	}
+	pFrame[codeIdx] = code;
+	pFrame[length++] = 0;
+	return length;
+}
+
+/*!
+ * Decodes a report that has been received
+ * @param pData the encoded report, without the zero bytes either side
+ * @param length the length of the encoded report
+ * @param report receives the report
+ * @return false if the data is not a report, or its CRC is wrong
+ */
+bool MSFReport_decode(
+	const uint8_t* pData,
+	size_t length,
+	struct MSF_REPORT& report
+) {
+	uint8_t data[MSF_REPORT_CRC_SIZE];
+	size_t dataLength = 0;
+	size_t idx = 0;
+	while (idx < length) {
+		uint8_t code = pData[idx++];
+		if ((code == 0) || (idx + code - 1 > length) ||
+			(dataLength + code - 1 > sizeof(data))) {
+			return false;
+		}
+		for (uint8_t count = 1; count < code; ++count) {
+			data[dataLength++] = pData[idx++];
+		}
+		if ((code != 0xFF) && (idx < length)) {
+			if (dataLength == sizeof(data)) {
+				return false;
+			}
+			data[dataLength++] = 0;
+		}
+	}
+	if (dataLength != sizeof(data)) {
+		return false;
+	}
+	uint16_t crc = (uint16_t)(data[sizeof(report)] |
+							  (data[sizeof(report) + 1] << 8));
+	if (CRC16_addBlock(CRC16_INIT, data, sizeof(report)) != crc) {
+		return false;
+	}
+	memcpy(&report, data, sizeof(report));
+	return true;
+}
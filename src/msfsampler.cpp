@@ -0,0 +1,490 @@
+/*
+ * msfsampler.cpp
+ *
+ * Holds the MSF sampler state machine. It records each minute into a
+ * sample pool buffer and tells the decoder how it is getting on through a
+ * queue of period events.
+ *
+ */
+
+#include <stdint.h>
+#include "systick.h"
+#include "msf.h"
+#include "msfsampler.h"
+#include "samplebuffer.h"
+#include "periodqueue.h"
+#include "samplepool.h"
+#include "msfmarker.h"
+#include "msfglitch.h"
+
+/*!
+ * Holds MSF sampler the state machine state
+ */
+enum MSF_SAMPLER_STATE {
+	MSF_IDLE,               /*!< Pauses the sampling */
+	MSF_START,              /*!< Starts sampling */
+	MSF_SEC_SAMPLING        /*!< Sampling data bits */
+};
+volatile static enum MSF_SAMPLER_STATE msfSampleState = MSF_IDLE;
+/*!
+ * The queue of period events passed to the decoder
+ */
+static struct MSF_PERIOD_QUEUE periodQueue;
+/*!
+ * The sample pool buffer the current minute is recorded in
+ */
+static struct MSF_SAMPLE_BUFFER* pRecord;
+/*! The glitch filter the MSF level passes through first */
+static struct MSF_GLITCH_FILTER glitchFilter;
+/*! One second, in us */
+const uint32_t US_PER_SEC = 1000000;
+/*!
+ * The most minutes in a row we end on the second grid alone, without
+ * seeing their minute marker
+ */
+const uint32_t MSF_FLYWHEEL_MINUTES = 3;
+/*!
+ * Set while we trust the second grid set by the last minute marker, so
+ * can place the next marker even if noise hides it
+ */
+static bool gridLocked;
+/*! The time (in us) of the minute marker starting the current minute */
+static uint32_t minuteStartUs;
+/*! The minutes ended on the grid alone since the last marker seen */
+static uint32_t flywheelCount;
+/*! Set once a low edge is seen where the next minute marker should start */
+static bool markerEdgeSeen;
+/*! That edge, with the periods stored in the minute up to it */
+static struct MSF_MARKER_EDGE markerEdge;
+/*! The recent edges the minute marker is looked for in */
+static struct MSF_MARKER_HISTORY markerHistory;
+/*!
+ * Set if an event could not be queued. The decoder is then told to abort
+ * the current minute once there is space in the queue again.
+ */
+static bool eventLost;
+
+/*!
+ * Queues an event for the decoder
+ * @param type the event type
+ * @param value the event value (see MSF_PERIOD_EVENT)
+ */
+static void queueEvent(
+	enum MSF_EVENT_TYPE type,
+	uint32_t value
+) {
+	struct MSF_PERIOD_EVENT event;
+	if (eventLost) {
+		event.value = 0;
+		event.type = MSF_EVENT_ABORT;
+		if (!periodQueue.push(event)) {
+			return;
+		}
+		eventLost = false;
+	}
+	event.value = value;
+	event.type = (uint8_t)type;
+	if (!periodQueue.push(event)) {
+		eventLost = true;
+	}
+}
+
+/*!
+ * Starts recording a minute into a sample pool buffer
+ * @param markerTime the time (in us) of the low edge starting the minute
+ *        marker
+ * @param firstSecTime the time (in us) of the low edge starting second 1
+ * @return the next sampler state. This will normally be MSF_SEC_SAMPLING
+ *         but if there is no free buffer then we reset the sampling state
+ *         machine and wait for the next minute.
+ */
+static enum MSF_SAMPLER_STATE startMSFMinute(
+	uint32_t markerTime,
+	uint32_t firstSecTime
+) {
+	enum MSF_SAMPLER_STATE nextState = MSF_SEC_SAMPLING;
+	pRecord = SamplePool_startMinute();
+	if (pRecord != 0) {
+		pRecord->setEdgeStart(markerTime);
+		pRecord->storeEdge(markerTime);
+		pRecord->storeEdge(firstSecTime);
+		queueEvent(MSF_EVENT_MINUTE_START, pRecord->sampleSequence);
+		gridLocked = true;
+		minuteStartUs = markerTime;
+		markerEdgeSeen = false;
+	} else {
+		gridLocked = false;
+		nextState = MSF_START;
+	}
+	return nextState;
+}
+
+/*!
+ * Starts recording the rest of a minute whose marker was missed, so that
+ * the decoder can use its last seconds rather than wait a whole minute
+ * for the next marker
+ * @param time the time (in us) of the low edge we start at. This may
+ *        not be a second start.
+ * @return the next sampler state. This will normally be MSF_SEC_SAMPLING
+ *         but if there is no free buffer then we just look for the next
+ *         minute marker.
+ */
+static enum MSF_SAMPLER_STATE startPartialMinute(
+	uint32_t time
+) {
+	enum MSF_SAMPLER_STATE nextState = MSF_SEC_SAMPLING;
+	gridLocked = false;
+	pRecord = SamplePool_startMinute();
+	if (pRecord != 0) {
+		pRecord->setEdgeStart(time);
+		pRecord->storeEdge(time);
+		minuteStartUs = time;
+		queueEvent(MSF_EVENT_PARTIAL_START, pRecord->sampleSequence);
+	} else {
+		nextState = MSF_START;
+	}
+	return nextState;
+}
+
+/*!
+ * Ends the minute being recorded and hands it to the decoder
+ * @param markerTime the ticker time of the minute marker ending the minute
+ * @param markerScore how well that minute marker matched (see
+ *        msfFindMarker()), or 0 if it was not seen
+ */
+static void endMSFMinute(
+	uint32_t markerTime,
+	uint8_t markerScore
+) {
+	pRecord->setStartTime(markerTime);
+	pRecord->markerScore = markerScore;
+	SamplePool_endMinute(pRecord);
+	pRecord = 0;
+	queueEvent(MSF_EVENT_MINUTE_END, markerTime);
+}
+
+/*!
+ * Converts a time difference in us to the nearest number of system ticks
+ */
+static inline uint32_t usToTicks(
+	uint32_t us
+) {
+	return (us + SYSTICK_US_PER_TICK/2)/SYSTICK_US_PER_TICK;
+}
+
+/*!
+ * Stores a period sample into the minute's sample buffer
+ * @param period the period value (number of 10ms slots) to store
+ * @param time the time (in us) of the transition ending the period
+ * @param tickCount the current system tick count
+ * @return the next sampler state. This will normally be MSF_SEC_SAMPLING
+ *         but if the sample buffer gets full then we end the minute (the
+ *         decoder will reject it) and reset the sampling state machine
+ *         ready for the next sample.
+ */
+static enum MSF_SAMPLER_STATE storeMSFPeriod(
+	uint8_t period,
+	uint32_t time,
+	uint32_t tickCount
+) {
+	enum MSF_SAMPLER_STATE nextState = MSF_SEC_SAMPLING;
+	/* Is there space in the period buffer? */
+	if (!pRecord->isFull()) {
+		/* yes, so store */
+		pRecord->store(period,
+					   (uint16_t)usToTicks(time - pRecord->edgeStartTime));
+		queueEvent(MSF_EVENT_PERIOD, 0);
+	} else {
+		/* no, so end the minute */
+		endMSFMinute(tickCount, 0);
+		/* and restart the state machine */
+		nextState = MSF_START;
+	}
+	return nextState;
+}
+
+/*!
+ * Describes an edge along with where the minute being recorded had got to
+ * @param time the time (in us) of the edge
+ * @param ticks the system tick count at the time of the edge
+ * @param msfLevel the MSF level (0/1) following the edge
+ * @param edge assigned the edge
+ */
+static void describeEdge(
+	uint32_t time,
+	uint32_t ticks,
+	int msfLevel,
+	struct MSF_MARKER_EDGE& edge
+) {
+	edge.time = time;
+	edge.ticks = ticks;
+	edge.level = (uint8_t)msfLevel;
+	edge.offset = (pRecord != 0) ? (uint16_t)pRecord->getWriteOffset() : 0;
+	edge.edgeCount = (pRecord != 0) ? (uint8_t)pRecord->edgeCount : 0;
+}
+
+/*!
+ * Ends the minute at the low edge starting its minute marker. The periods
+ * and second start edges stored after that edge are the marker second, so
+ * are dropped.
+ * @param edge the low edge starting the minute marker
+ * @param markerScore how well the minute marker matched, or 0 if it was
+ *        placed on the second grid
+ */
+static void endMSFMinuteAt(
+	const struct MSF_MARKER_EDGE& edge,
+	uint8_t markerScore
+) {
+	while (pRecord->getWriteOffset() > edge.offset) {
+		pRecord->unstore();
+		queueEvent(MSF_EVENT_RETRACT, 0);
+	}
+	while (pRecord->edgeCount > edge.edgeCount) {
+		pRecord->unstoreEdge();
+	}
+	endMSFMinute(edge.ticks, markerScore);
+}
+
+/*!
+ * Ends the minute at the low edge where the second grid put its minute
+ * marker, although the marker itself was not seen, and starts the next.
+ * @param firstSecTime the time (in us) of the low edge starting second 1
+ * @return the next sampler state (see startMSFMinute())
+ */
+static enum MSF_SAMPLER_STATE flywheelMSFMinute(
+	uint32_t firstSecTime
+) {
+	endMSFMinuteAt(markerEdge, 0);
+	++flywheelCount;
+	return startMSFMinute(markerEdge.time, firstSecTime);
+}
+
+/*!
+ * Checks whether a time lies on the second grid
+ * @param elapsed the time (in us) since the minute marker starting the
+ *        grid
+ * @param seconds the whole number of seconds it should be
+ */
+static inline bool onSecondGrid(
+	uint32_t elapsed,
+	uint32_t seconds
+) {
+	int32_t error = (int32_t)(elapsed - seconds*US_PER_SEC);
+	return (error < (int32_t)MSF_EDGE_GATE) && (error > -(int32_t)MSF_EDGE_GATE);
+}
+
+/*!
+ * Checks whether a minute marker found can end the minute being recorded.
+ * One a minute on along the second grid needs only MSF_MARKER_GRID_SCORE.
+ * Elsewhere it needs MSF_MARKER_MIN_SCORE, and is only taken if we do not
+ * trust the grid: either there is none yet or it has not been met since
+ * the last minute ended on it alone.
+ * @param marker the minute marker found
+ */
+static inline bool isNextMarker(
+	const struct MSF_MARKER_MATCH& marker
+) {
+	uint32_t elapsed = marker.edge.time - minuteStartUs;
+	if (gridLocked && onSecondGrid(elapsed, 60)) {
+		return true;
+	}
+	return (!gridLocked || (flywheelCount > 0)) &&
+		   ((int32_t)elapsed >= 0) &&
+		   (marker.score >= MSF_MARKER_MIN_SCORE);
+}
+
+/*!
+ * The MSF sample state machine
+ *
+ *  +0   +100 +200 +300 +400 +500 +600 +700 +800 +900 +1000  ms
+ *   +----+----+----+----+----+----+----+----+----+----+
+ * The zero secs marker looks like:
+ *                             _________________________
+ * 0 |________________________|
+ *
+ * Following that the rest of the secs look like:
+ *          ____ ____ __________________________________
+ * x |_____|_Ax_|_Bx_|
+ *
+ * At each low edge the recent edges are checked for a minute marker
+ * ending there (see msfFindMarker()). Until one is found, what is left of
+ * the minute is recorded from the first low edge.
+ *
+ * Once locked to a minute marker, we keep the second grid it sets, and
+ * only take a marker that lies on it. Should noise hide the next marker,
+ * the minute is still ended where the grid puts it (see
+ * flywheelMSFMinute()), up to MSF_FLYWHEEL_MINUTES in a row. Seeing a
+ * marker again re-locks the grid.
+ *
+ * The level transitions come through the glitch filter (see
+ * msfglitch.cpp), so always alternate.
+ *
+ * @param time the time of the level transition in us. Only differences
+ *        between times are used, so this may wrap.
+ * @param ticks the system tick count at the time of the level transition
+ * @param msfLevel the MSF level (0/1) following the transition
+ */
+static void sampleTransition(
+	uint32_t time,
+	uint32_t ticks,
+	int msfLevel
+) {
+	/*! The time (in us) of the last transition */
+	static uint32_t lastTransitionTime;
+	/*! The ticker period the previous level was seen for */
+	uint32_t period = usToTicks(time - lastTransitionTime);
+	struct MSF_MARKER_MATCH marker;
+	lastTransitionTime = time;
+	/*
+	 * Process any transition with the state machine
+	 */
+	switch (msfSampleState) {
+		case MSF_IDLE:
+			break;
+		case MSF_START:
+			if (msfLevel == 0) {
+				if (msfFindMarker(markerHistory, time, MSF_MARKER_MIN_SCORE,
+								  marker)) {
+					flywheelCount = 0;
+					msfSampleState = startMSFMinute(marker.edge.time, time);
+				} else {
+					/* Record what is left of the minute as we look */
+					msfSampleState = startPartialMinute(time);
+				}
+			}
+			break;
+		case MSF_SEC_SAMPLING:
+			if (msfLevel == 0) {
+				uint32_t elapsed = time - minuteStartUs;
+				if (gridLocked &&
+					(elapsed > 61*US_PER_SEC + MSF_EDGE_GATE)) {
+					/* The grid has not been met, so stop trusting it */
+					gridLocked = false;
+				}
+				if (msfFindMarker(markerHistory, time, MSF_MARKER_GRID_SCORE,
+								  marker) &&
+					isNextMarker(marker)) {
+					endMSFMinuteAt(marker.edge, marker.score);
+					flywheelCount = 0;
+					msfSampleState = startMSFMinute(marker.edge.time, time);
+					break;
+				}
+				if (gridLocked && markerEdgeSeen &&
+					(flywheelCount < MSF_FLYWHEEL_MINUTES) &&
+					onSecondGrid(elapsed, 61)) {
+					/* We have missed the minute marker */
+					msfSampleState = flywheelMSFMinute(time);
+					break;
+				}
+				pRecord->storeEdge(time);
+				msfSampleState = storeMSFPeriod(period, time, ticks);
+				if (gridLocked && !markerEdgeSeen &&
+					(msfSampleState == MSF_SEC_SAMPLING) &&
+					onSecondGrid(elapsed, 60)) {
+					/* Where the next minute marker should start */
+					markerEdgeSeen = true;
+					describeEdge(time, ticks, msfLevel, markerEdge);
+				}
+			} else {
+				msfSampleState = storeMSFPeriod(period, time, ticks);
+			}
+			break;
+		default:
+			msfSampleState = MSF_START;
+			break;
+	}
+	struct MSF_MARKER_EDGE edge;
+	describeEdge(time, ticks, msfLevel, edge);
+	markerHistory.push(edge);
+}
+
+/*!
+ * Feeds the MSF sample state machine from a polled MSF level. Should be
+ * called once per system tick.
+ * @param tickCount the current system tick count
+ * @param msfLevel the MSF level (0/1) sampled at this tick
+ */
+void MSFSampler_sample(
+	uint32_t tickCount,
+	int msfLevel
+) {
+	struct MSF_GLITCH_EDGE edge;
+	if (msfGlitchFeed(glitchFilter, tickCount*SYSTICK_US_PER_TICK, tickCount,
+					  msfLevel, edge)) {
+		sampleTransition(edge.time, edge.ticks, edge.level);
+	}
+}
+
+/*!
+ * Feeds the MSF sample state machine from a timestamped MSF edge. Should
+ * be called for each edge, in time order.
+ * @param edgeTime the time of the edge in us
+ * @param edgeTicks the system tick count at the time of the edge
+ * @param msfLevel the MSF level (0/1) following the edge
+ */
+void MSFSampler_edge(
+	uint32_t edgeTime,
+	uint32_t edgeTicks,
+	int msfLevel
+) {
+	struct MSF_GLITCH_EDGE edge;
+	if (msfGlitchFeed(glitchFilter, edgeTime, edgeTicks, msfLevel, edge)) {
+		sampleTransition(edge.time, edge.ticks, edge.level);
+	}
+}
+
+/*!
+ * Lets the MSF sample state machine know the time, when fed from
+ * timestamped MSF edges, so that an edge is passed through the glitch
+ * filter once it has held for long enough rather than at the next edge.
+ * Should be called every 100ms or so, in time order with the edges.
+ * @param time the time now in us
+ * @param ticks the system tick count now
+ */
+void MSFSampler_poll(
+	uint32_t time,
+	uint32_t ticks
+) {
+	struct MSF_GLITCH_EDGE edge;
+	if (msfGlitchFeed(glitchFilter, time, ticks, glitchFilter.rawLevel,
+					  edge)) {
+		sampleTransition(edge.time, edge.ticks, edge.level);
+	}
+}
+
+/*!
+ * Prepares the MSF sampling state machine, its sample pool and its event
+ * queue.
+ */
+void MSFSampler_init(void) {
+	SamplePool_init();
+	periodQueue.init();
+	pRecord = 0;
+	msfGlitchInit(glitchFilter, 0);
+	markerHistory.init();
+	eventLost = false;
+	gridLocked = false;
+	flywheelCount = 0;
+	msfSampleState = MSF_START;
+}
+
+/*!
+ * Gets the next event from the sampler. The sampler sends a
+ * MSF_EVENT_MINUTE_START (giving the sample pool buffer used) when it sees a
+ * minute marker, a MSF_EVENT_PERIOD as each of the minute's bit periods is
+ * recorded, and a MSF_EVENT_MINUTE_END at the next minute marker. Until it
+ * has found a minute marker, it records from the first low edge it sees
+ * and sends a MSF_EVENT_PARTIAL_START instead of the
+ * MSF_EVENT_MINUTE_START. A MSF_EVENT_RETRACT withdraws the last period
+ * sent (the marker second's, once the marker is found), and
+ * MSF_EVENT_ABORT means events were lost and the minute should be dropped.
+ * The queue only holds a few seconds worth of events, so this should be
+ * called often.
+ * @param event assigned the event
+ * @returns false if there is no event waiting
+ */
+bool MSFSampler_getEvent(
+	struct MSF_PERIOD_EVENT& event
+) {
+	return periodQueue.pop(event);
+}
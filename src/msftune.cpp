@@ -0,0 +1,316 @@
+/*
+ * msftune.cpp
+ *
+ * Tunes the second classifier to the receiver. A real receiver does not
+ * pass on the MSF carrier edges exactly: it is slower to follow the
+ * carrier coming back than going off (or the other way about), which
+ * stretches every low period and shrinks every high one by a few tens of
+ * ms, and by more for some lengths of period than others. The classifier
+ * matches against the ideal lengths, so such a receiver runs close to the
+ * match error limit all the time.
+ *
+ * The periods of each second of a good decode are learnt into a histogram
+ * of their difference from the ideal length, one histogram for each class
+ * of period. The median of each histogram is where the receiver puts that
+ * class, and the classifier is re-centred on it. The match errors of those
+ * seconds are learnt too, and the match error limit is set from how high
+ * they run, so a receiver with little jitter does not accept a poor match
+ * that a noisy one would need to.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "systick.h"
+#include "msftune.h"
+
+/*!
+ * The ideal length of each MSF_PERIOD_CLASS, in ms
+ */
+static const uint16_t classLength[MSF_PERIOD_CLASS_COUNT] = {
+	100, 200, 300, 100, 700, 800, 900
+};
+
+/*!
+ * The MSF level of each MSF_PERIOD_CLASS
+ */
+static const uint8_t classLevel[MSF_PERIOD_CLASS_COUNT] = {
+	0, 0, 0, 1, 1, 1, 1
+};
+
+/*!
+ * The tuning state
+ */
+static struct {
+	/*! The periods learnt of each class, by difference from the ideal */
+	uint16_t bins[MSF_PERIOD_CLASS_COUNT][MSF_TUNE_BINS];
+	uint32_t counts[MSF_PERIOD_CLASS_COUNT]; /*!< The periods in each */
+	/*! The match errors of the seconds learnt */
+	uint16_t costBins[MSF_TUNE_COST_BINS];
+	uint32_t costCount;     /*!< The match errors in costBins */
+	uint32_t secondCount;   /*!< The seconds learnt in all */
+} tune;
+
+/*!
+ * Halves a histogram
+ * @param pBins the histogram bins
+ * @param binCount the number of bins
+ * @return the number of entries left
+ */
+static uint32_t halveBins(
+	uint16_t* pBins,
+	uint32_t binCount
+) {
+	uint32_t count = 0;
+	for (uint32_t idx = 0; idx < binCount; ++idx) {
+		pBins[idx] /= 2;
+		count += pBins[idx];
+	}
+	return count;
+}
+
+/*!
+ * Learns a period
+ * @param periodClass the class of the period
+ * @param period the period, in ticks
+ */
+static void addPeriod(
+	enum MSF_PERIOD_CLASS periodClass,
+	uint8_t period
+) {
+	int ideal = classLength[periodClass]*SYSTICK_ONESEC/1000;
+	int bin = (int)period - ideal + MSF_TUNE_BIN_OFFSET;
+	if (bin < 0) {
+		bin = 0;
+	} else if (bin >= (int)MSF_TUNE_BINS) {
+		bin = MSF_TUNE_BINS - 1;
+	}
+	++tune.bins[periodClass][bin];
+	if (++tune.counts[periodClass] >= MSF_TUNE_MAX_COUNT) {
+		tune.counts[periodClass] =
+			halveBins(tune.bins[periodClass], MSF_TUNE_BINS);
+	}
+}
+
+/*!
+ * Gives the median of a period histogram
+ * @param pBins the histogram bins
+ * @param count the periods in the histogram, which must not be 0
+ * @return the median difference from the ideal length, in 1/4 ticks
+ */
+static int medianQuarters(
+	const uint32_t* pBins,
+	uint32_t count
+) {
+	uint32_t below = 0;
+	for (uint32_t bin = 0; bin < MSF_TUNE_BINS; ++bin) {
+		if (2*(below + pBins[bin]) >= count) {
+			/* Interpolate within the bin, which spans +-1/2 tick */
+			return 4*((int)bin - MSF_TUNE_BIN_OFFSET) - 2 +
+				   (int)(2*(count - 2*below)/pBins[bin]);
+		}
+		below += pBins[bin];
+	}
+	return 0;
+}
+
+/*!
+ * Works out where a class of period is centred. All the periods of the
+ * class's level together give where the receiver puts that level, and the
+ * class is centred within a tick of that: the periods of a second we could
+ * not check against the decode may be misread as a class next to their
+ * own, and too many of those could otherwise drag the class towards the
+ * next one, and so cause more misreads. A class with too few periods of
+ * its own is centred where its level is; with too few periods at that
+ * level it is left where it is.
+ * @param periodClass the class
+ * @param centre the current centre, in ticks
+ * @return the new centre, in ticks. This only moves once the median is
+ *         3/4 of a tick away, so that a median near half way between two
+ *         ticks does not move it back and forth.
+ */
+static int8_t classCentre(
+	enum MSF_PERIOD_CLASS periodClass,
+	int8_t centre
+) {
+	uint32_t bins[MSF_TUNE_BINS];
+	uint32_t count = 0;
+	for (uint32_t bin = 0; bin < MSF_TUNE_BINS; ++bin) {
+		bins[bin] = 0;
+	}
+	for (unsigned idx = 0; idx < MSF_PERIOD_CLASS_COUNT; ++idx) {
+		if (classLevel[idx] == classLevel[periodClass]) {
+			for (uint32_t bin = 0; bin < MSF_TUNE_BINS; ++bin) {
+				bins[bin] += tune.bins[idx][bin];
+			}
+			count += tune.counts[idx];
+		}
+	}
+	if (count < MSF_TUNE_MIN_COUNT) {
+		return centre;
+	}
+	int median = medianQuarters(bins, count);
+	count = tune.counts[periodClass];
+	if (count >= MSF_TUNE_MIN_COUNT) {
+		int levelMedian = median;
+		for (uint32_t bin = 0; bin < MSF_TUNE_BINS; ++bin) {
+			bins[bin] = tune.bins[periodClass][bin];
+		}
+		median = medianQuarters(bins, count);
+		if (median > levelMedian + 4) {
+			median = levelMedian + 4;
+		} else if (median < levelMedian - 4) {
+			median = levelMedian - 4;
+		}
+	}
+	int offset = median - 4*centre;
+	if ((offset < 3) && (offset > -3)) {
+		return centre;
+	}
+	return (int8_t)((median >= 0) ? (median + 2)/4 : -((-median + 2)/4));
+}
+
+/*!
+ * Works out the match error limit from the match errors learnt
+ * @return the limit, or MSF_MAX_SECOND_ERROR if too few have been learnt
+ */
+static uint16_t matchErrorLimit(void) {
+	if (tune.costCount < MSF_TUNE_MIN_COUNT) {
+		return MSF_MAX_SECOND_ERROR;
+	}
+	uint32_t below = 0;
+	uint32_t bin;
+	for (bin = 0; bin < MSF_TUNE_COST_BINS - 1; ++bin) {
+		below += tune.costBins[bin];
+		if (100*below >= MSF_TUNE_COST_PERCENTILE*tune.costCount) {
+			break;
+		}
+	}
+	return (uint16_t)(2*(bin + 1)*MSF_TUNE_COST_BIN_WIDTH);
+}
+
+/*!
+ * Forgets all that has been learnt and leaves the classifier untuned
+ */
+void MSFTune_init(void) {
+	struct MSF_CLASSIFY_TUNING tuning;
+	for (unsigned idx = 0; idx < MSF_PERIOD_CLASS_COUNT; ++idx) {
+		for (uint32_t bin = 0; bin < MSF_TUNE_BINS; ++bin) {
+			tune.bins[idx][bin] = 0;
+		}
+		tune.counts[idx] = 0;
+		tuning.centre[idx] = 0;
+	}
+	for (uint32_t bin = 0; bin < MSF_TUNE_COST_BINS; ++bin) {
+		tune.costBins[bin] = 0;
+	}
+	tune.costCount = 0;
+	tune.secondCount = 0;
+	tuning.maxError = MSF_MAX_SECOND_ERROR;
+	msfClassifySetTuning(tuning);
+}
+
+/*!
+ * Learns the periods of one second of a good decode. Only a second made
+ * of just the periods of its pattern is learnt: one read by taking a
+ * glitch as noise tells us nothing certain of its period lengths.
+ * @param type the pattern the second matched
+ * @param pPeriods the second's periods, starting with its low period
+ * @param count the number of periods
+ * @param cost the second's match error
+ */
+void MSFTune_addSecond(
+	enum MSF_SECOND_TYPE type,
+	const uint8_t* pPeriods,
+	unsigned count,
+	uint32_t cost
+) {
+	switch (type) {
+	case MSF_SEC_300_700:
+	case MSF_SEC_200_800:
+	case MSF_SEC_100_900:
+		if (count != 2) {
+			return;
+		}
+		addPeriod((type == MSF_SEC_300_700) ? MSF_PERIOD_LOW_300 :
+				  (type == MSF_SEC_200_800) ? MSF_PERIOD_LOW_200 :
+				  MSF_PERIOD_LOW_100, pPeriods[0]);
+		addPeriod((type == MSF_SEC_300_700) ? MSF_PERIOD_HIGH_700 :
+				  (type == MSF_SEC_200_800) ? MSF_PERIOD_HIGH_800 :
+				  MSF_PERIOD_HIGH_900, pPeriods[1]);
+		break;
+	case MSF_SEC_100_100_100_700:
+		if (count != 4) {
+			return;
+		}
+		addPeriod(MSF_PERIOD_LOW_100, pPeriods[0]);
+		addPeriod(MSF_PERIOD_HIGH_100, pPeriods[1]);
+		addPeriod(MSF_PERIOD_LOW_100, pPeriods[2]);
+		addPeriod(MSF_PERIOD_HIGH_700, pPeriods[3]);
+		break;
+	default:
+		return;
+	}
+	uint32_t bin = cost/MSF_TUNE_COST_BIN_WIDTH;
+	if (bin >= MSF_TUNE_COST_BINS) {
+		bin = MSF_TUNE_COST_BINS - 1;
+	}
+	++tune.costBins[bin];
+	if (++tune.costCount >= MSF_TUNE_MAX_COUNT) {
+		tune.costCount = halveBins(tune.costBins, MSF_TUNE_COST_BINS);
+	}
+	++tune.secondCount;
+}
+
+/*!
+ * Works out the classifier tuning again from what has been learnt. Called
+ * after each good decode.
+ * @return true if the tuning changed
+ */
+bool MSFTune_update(void) {
+	struct MSF_CLASSIFY_TUNING current;
+	struct MSF_CLASSIFY_TUNING tuning;
+	msfClassifyReadTuning(current);
+	for (unsigned idx = 0; idx < MSF_PERIOD_CLASS_COUNT; ++idx) {
+		tuning.centre[idx] = classCentre((enum MSF_PERIOD_CLASS)idx,
+										 current.centre[idx]);
+	}
+	tuning.maxError = matchErrorLimit();
+	msfClassifySetTuning(tuning);
+	msfClassifyReadTuning(tuning);
+	bool changed = (tuning.maxError != current.maxError);
+	for (unsigned idx = 0; idx < MSF_PERIOD_CLASS_COUNT; ++idx) {
+		if (tuning.centre[idx] != current.centre[idx]) {
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+/*!
+ * Appends the tuning in use as text: the centre of each class of period
+ * (in ms from its ideal length), the match error limit and the number of
+ * seconds learnt.
+ * @param output the CMsg into which the text is appended
+ */
+void MSFTune_format(
+	CMsg& output
+) {
+	static const char* classNames[MSF_PERIOD_CLASS_COUNT] = {
+		"L100", "L200", "L300", "H100", "H700", "H800", "H900"
+	};
+	struct MSF_CLASSIFY_TUNING tuning;
+	char str[96];
+	size_t length = 0;
+	msfClassifyReadTuning(tuning);
+	for (unsigned idx = 0; idx < MSF_PERIOD_CLASS_COUNT; ++idx) {
+		length += snprintf(str + length, sizeof(str) - length,
+						   "%s%s%+dms", (idx == 0) ? "" : ",",
+						   classNames[idx],
+						   tuning.centre[idx]*1000/(int)SYSTICK_ONESEC);
+	}
+	output.append(str, "|");
+	snprintf(str, sizeof(str), "max %u|%u secs",
+			 (unsigned)tuning.maxError, (unsigned)tune.secondCount);
+	output.append(str, "|");
+}
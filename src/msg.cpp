@@ -6,7 +6,7 @@
  *      {ACK|NAK}{LLLL}*{msg.8}{CCCC}{CR}
  * where LLLL is the length of the msg as a 16 bit hex-ASCII value, msg.8 is
  * a string of 8 bit characters (UTF-8) with length as indicated by LLLL,
- * CCCC is a 16 bit CRC-16 value for the msg.8 characters,
+ * CCCC is a 16 bit CRC-16 value for the msg.8 characters (see crc16.h),
  * ACK;NAK;CR are the ASCII characters of the same name. Note that the {}
  * characters are field separators and do not actually appear in the protocol.
  *
@@ -21,33 +21,84 @@
  *
  * {NAK}0379B55 parity error Extracted A:B <snip-cos-it-was-long!> 04C7A{CR}
  *
+ * The message is formatted in place in the USB serial transmit ring. The
+ * header is left as a gap until the message is sent, when its type and the
+ * body length are known; the CRC is worked out a character at a time as
+ * the body is appended.
+ *
  */
 
 #include <stdint.h>
-#include <string.h>
 #include <stddef.h>
-#include <stdio.h>
+#include "crc16.h"
 #include "msg.h"
+#include "usb_endp.h"
 
 static const char ACK = '\006';
 static const char NAK = '\025';
 static const char  CR = '\015';
 static const size_t HEADER_LEN = 5;
 static const size_t TOTAL_OVERHEAD = 10;
+/*! Indexes in the transmit ring wrap with this mask */
+static const uint32_t RING_MASK = USB_TX_BUFF_SIZE - 1;
+
+/*!
+ * Writes a 16 bit value as 4 hex-ascii characters into the ring
+ * @param pRing the transmit ring
+ * @param idx the ring index of the first character
+ * @param value the value
+ */
+static void putHex16(
+    uint8_t* pRing,
+    uint32_t idx,
+    uint16_t value
+) {
+    static const char hexDigits[] = "0123456789ABCDEF";
+    for (int shift = 12; shift >= 0; shift -= 4) {
+        pRing[idx++ & RING_MASK] = hexDigits[(value >> shift) & 0xF];
+    }
+}
 
 /*!
  * Default constructor
  */
 CMsg::CMsg() {
+    this->pRing = 0;
     clear();
 }
 
 /*!
- * Removes any message content
+ * Destructor. A message that was never sent gives up the transmit ring.
+ */
+CMsg::~CMsg() {
+    clear();
+}
+
+/*!
+ * Removes any message content, giving up the transmit ring
  */
 void CMsg::clear() {
+    if (this->pRing != 0) {
+        USBCommitTx(0);
+        this->pRing = 0;
+    }
     this->length = 0;
-    this->message[HEADER_LEN] = '\0';
+    this->crc = CRC16_INIT;
+    this->dropped = false;
+}
+
+/*!
+ * Claims the transmit ring for the message, if it does not have it already
+ * @returns false if the ring could not be claimed (the USB is not
+ *          connected, or another message is being written), in which case
+ *          the message is dropped
+ */
+bool CMsg::claim() {
+    if ((this->pRing == 0) && !this->dropped) {
+        this->pRing = USBClaimTx(&this->start);
+        this->dropped = (this->pRing == 0);
+    }
+    return (this->pRing != 0);
 }
 
 /*!
@@ -57,9 +108,8 @@ void CMsg::clear() {
  * @param pSep if not 0, must point to an ASCIZ string used as a field
  *             separator - which means that if the message is not empty, this
  *             string will be added to the content BEFORE the pMsg.
- * @note If the message being appended would overflow the message size. it is
- *       silently truncated. Do not try to add more content than the size of
- *       the message[] array, or it will be silently lost.
+ * @note If the message being appended would overflow the free space in the
+ *       transmit ring, it is silently truncated.
  */
 void CMsg::append(
 	const char* pMsg,
@@ -69,109 +119,61 @@ void CMsg::append(
 		// Need to add separator
 		this->append(pSep, 0);
 	}
-	// this->size = 20
-	// this->length = 16
-	// +--------------------+
-	// |xxxxxxxxxxxxxxxx0---|
-	// +--------------------+
-	// pMsg = "abc"
-	// +--------------------+
-	// |xxxxxxxxxxxxxxxxabc0|
-	// +--------------------+
-	size_t lenAvail = this->size - this->length - TOTAL_OVERHEAD; // = 3
-	if (lenAvail > 0) {
-		size_t appendLength = strlen(pMsg); // = 3
-		if (appendLength <= lenAvail) {
-			strcat(this->message+HEADER_LEN, pMsg);
-			this->length += appendLength;
-		} else {
-			strncat(this->message+HEADER_LEN, pMsg, lenAvail);
-			this->length += lenAvail;
-		}
+	if (!claim()) {
+		return;
 	}
+	uint32_t freeLength = USBFreeTx();
+	size_t lenAvail = (freeLength > this->length + TOTAL_OVERHEAD) ?
+					  freeLength - this->length - TOTAL_OVERHEAD : 0;
+	uint32_t idx = this->start + HEADER_LEN + this->length;
+	uint16_t crc = this->crc;
+	size_t appendLength = 0;
+	while ((appendLength < lenAvail) && (pMsg[appendLength] != '\0')) {
+		uint8_t data = (uint8_t)pMsg[appendLength++];
+		this->pRing[idx++ & RING_MASK] = data;
+		crc = CRC16_add(crc, data);
+	}
+	this->crc = crc;
+	this->length += appendLength;
 }
 
 /*!
- * Fills in the none body message content i.e. the header and trailer
- */
-void CMsg::formMsg() {
-    char numStr[5];
-    snprintf(numStr, sizeof(numStr),
-             "%04X", this->length);
-    this->message[1] = numStr[0];
-    this->message[2] = numStr[1];
-    this->message[3] = numStr[2];
-    this->message[4] = numStr[3];
-    snprintf(numStr, sizeof(numStr),
-             "%04X", calcCRC());
-    this->message[this->length+5] = numStr[0];
-    this->message[this->length+6] = numStr[1];
-    this->message[this->length+7] = numStr[2];
-    this->message[this->length+8] = numStr[3];
-    this->message[this->length+9] = CR;
-}
-
-/*!
- * Gets the message content framed as a 'good' message.
- * @params pTotalLength points to a value assigned the total length of the
- *         message. You _will_ need this as the message returned is not '\0'
- *         terminated.
- * @returns a pointer to the message content
+ * Fills in the none body message content i.e. the header and trailer, and
+ * passes the message to the USB stack to send
+ * @param type ACK or NAK
+ * @returns the total length of the message sent, or 0 if it was dropped
  */
-const char* CMsg::getMsg(size_t* pTotalLength) {
-    this->message[0] = ACK;
-    formMsg();
-    if (pTotalLength)
-        *pTotalLength = this->length + TOTAL_OVERHEAD;
-    return this->message;
+size_t CMsg::send(char type) {
+    if (!claim() || (USBFreeTx() < this->length + TOTAL_OVERHEAD)) {
+        clear();
+        return 0;
+    }
+    uint32_t trailer = this->start + HEADER_LEN + this->length;
+    this->pRing[this->start & RING_MASK] = type;
+    putHex16(this->pRing, this->start + 1, (uint16_t)this->length);
+    putHex16(this->pRing, trailer, this->crc);
+    this->pRing[(trailer + 4) & RING_MASK] = CR;
+    size_t totalLength = this->length + TOTAL_OVERHEAD;
+    USBCommitTx((uint32_t)totalLength);
+    this->pRing = 0;
+    clear();
+    return totalLength;
 }
 
 /*!
- * Gets the message content framed as a 'bad' message.
- * @params pTotalLength points to a value assigned the total length of the
- *         message. You _will_ need this as the message returned is not '\0'
- *         terminated.
- * @returns a pointer to the message content
+ * Sends the message content framed as a 'good' message. The message is
+ * empty afterwards.
+ * @returns the total length of the message sent, or 0 if it was dropped
  */
-const char* CMsg::getErrorMsg(size_t* pTotalLength) {
-    this->message[0] = NAK;
-    formMsg();
-    if (pTotalLength)
-        *pTotalLength = this->length + TOTAL_OVERHEAD;
-    return this->message;
+size_t CMsg::sendMsg() {
+    return send(ACK);
 }
 
 /*!
- * Calculates the CRC-16 value for the message body
- * @returns CRC-16 of the message body
- * @note This code is adapted from code at:
- *          http://srecord.sourceforge.net/crc16-ccitt.html
+ * Sends the message content framed as a 'bad' message. The message is
+ * empty afterwards.
+ * @returns the total length of the message sent, or 0 if it was dropped
  */
-uint16_t CMsg::calcCRC() {
-    uint16_t crc = 0xFFFF;
-    size_t len = this->length;
-    char* pData = this->message + HEADER_LEN;
-    while (len-- ) {
-        uint16_t data = (uint16_t)*pData++;
-        uint16_t v = 0x80;
-        for (int i=0; i<8; i++) {
-            bool xor_flag = ((crc & 0x8000) != 0);
-            crc = crc << 1;
-            if (data & v) {
-                crc = crc + 1;
-            }
-            if (xor_flag) {
-                crc = crc ^ 0x1021;
-            }
-            v = v >> 1;
-        }
-    }
-    for (int i=0; i<16; i++) {
-        bool xor_flag = ((crc & 0x8000) != 0);
-        crc = crc << 1;
-        if (xor_flag) {
-            crc = crc ^ 0x1021;
-        }
-    }
-    return crc;
+size_t CMsg::sendErrorMsg() {
+    return send(NAK);
 }
@@ -0,0 +1,196 @@
+/*
+ * rtcbackup.cpp
+ *
+ * The RTC runs from the 32.768kHz LSE crystal with a 1 second prescale,
+ * on the backup supply, so it keeps counting through resets. The backup
+ * data registers (DR1..DR10, 16 bits each) hold:
+ *   DR1      RTC_BACKUP_MAGIC
+ *   DR2,3    the RTC time the RTC was last set from a decode
+ *   DR4,5    the clock correction (ppb)
+ *   DR6,7    the total good reads
+ *   DR8,9    the total bad reads
+ *   DR10     a check word over DR1..DR9
+ * A reset part way through an update leaves a bad check word, and the
+ * state is then ignored.
+ *
+ */
+
+#include "stm32f10x.h"
+#include "rtcbackup.h"
+
+/*! The RTC is usable */
+static bool rtcRunning = false;
+
+/*!
+ * Gives the check word over the state registers
+ */
+static uint16_t checkWord(void) {
+	uint16_t check = 0xA5A5;
+	check ^= BKP->DR1;
+	check ^= BKP->DR2;
+	check ^= BKP->DR3;
+	check ^= BKP->DR4;
+	check ^= BKP->DR5;
+	check ^= BKP->DR6;
+	check ^= BKP->DR7;
+	check ^= BKP->DR8;
+	check ^= BKP->DR9;
+	return check;
+}
+
+/*!
+ * Waits for the last write to the RTC registers to finish. If it never
+ * does, the RTC is given up on.
+ * @return false if the write timed out
+ */
+static bool waitRTCWrite(void) {
+	uint32_t count = 0;
+	while (!(RTC->CRL & RTC_CRL_RTOFF)) {
+		if (++count == RTC_BACKUP_WRITE_TIMEOUT) {
+			rtcRunning = false;
+			return false;
+		}
+	}
+	return true;
+}
+
+/*!
+ * Sets the RTC counter
+ * @param count the new counter value
+ * @return false if the RTC did not take it
+ */
+static bool setRTCCount(
+	uint32_t count
+) {
+	if (!waitRTCWrite()) {
+		return false;
+	}
+	RTC->CRL |= RTC_CRL_CNF;
+	RTC->CNTH = (uint16_t)(count >> 16);
+	RTC->CNTL = (uint16_t)count;
+	RTC->CRL &= ~RTC_CRL_CNF;
+	return waitRTCWrite();
+}
+
+/*!
+ * Reads the RTC counter
+ */
+static uint32_t readRTCCount(void) {
+	uint16_t high;
+	uint16_t low;
+	do {
+		high = RTC->CNTH;
+		low = RTC->CNTL;
+	} while (high != RTC->CNTH);
+	return ((uint32_t)high << 16) | low;
+}
+
+/*!
+ * Starts the LSE and the RTC from a reset backup domain
+ * @return false if the LSE did not start, or the RTC did not respond
+ */
+static bool startRTC(void) {
+	RCC->BDCR |= RCC_BDCR_BDRST;
+	RCC->BDCR &= ~RCC_BDCR_BDRST;
+	RCC->BDCR |= RCC_BDCR_LSEON;
+	uint32_t count = 0;
+	while (!(RCC->BDCR & RCC_BDCR_LSERDY)) {
+		if (++count == RTC_BACKUP_LSE_TIMEOUT) {
+			RCC->BDCR &= ~RCC_BDCR_LSEON;
+			return false;
+		}
+	}
+	RCC->BDCR |= RCC_BDCR_RTCSEL_LSE | RCC_BDCR_RTCEN;
+	if (!waitRTCWrite()) {
+		return false;
+	}
+	RTC->CRL |= RTC_CRL_CNF;
+	RTC->PRLH = 0;
+	RTC->PRLL = 32767;
+	RTC->CRL &= ~RTC_CRL_CNF;
+	return waitRTCWrite();
+}
+
+/*!
+ * Starts the RTC if it is not already running, and restores the state
+ * saved before the last reset
+ * @param state assigned the saved state, if any
+ * @return true if the state was restored, false if the backup domain had
+ *         lost power (or never held our state), or the RTC did not respond
+ */
+bool RTCBackup_init(
+	struct RTC_BACKUP_STATE& state
+) {
+	RCC->APB1ENR |= RCC_APB1ENR_PWREN | RCC_APB1ENR_BKPEN;
+	PWR->CR |= PWR_CR_DBP;
+	bool warm = ((RCC->BDCR & (RCC_BDCR_RTCEN | RCC_BDCR_LSERDY)) ==
+				 (RCC_BDCR_RTCEN | RCC_BDCR_LSERDY)) &&
+				(BKP->DR1 == RTC_BACKUP_MAGIC) && (BKP->DR10 == checkWord());
+	if (warm) {
+		/* Wait for the APB1 copies of the RTC registers to catch up */
+		RTC->CRL &= ~RTC_CRL_RSF;
+		uint32_t count = 0;
+		while (!(RTC->CRL & RTC_CRL_RSF)) {
+			if (++count == RTC_BACKUP_WRITE_TIMEOUT) {
+				/* Leave the state alone, in case the RTC recovers */
+				rtcRunning = false;
+				return false;
+			}
+		}
+		rtcRunning = true;
+		uint32_t lastFix = ((uint32_t)BKP->DR2 << 16) | BKP->DR3;
+		state.unixTime = readRTCCount();
+		state.fixAge = state.unixTime - lastFix;
+		state.correction = (int32_t)(((uint32_t)BKP->DR4 << 16) | BKP->DR5);
+		state.goodCount = ((uint32_t)BKP->DR6 << 16) | BKP->DR7;
+		state.badCount = ((uint32_t)BKP->DR8 << 16) | BKP->DR9;
+		return true;
+	}
+	rtcRunning = startRTC();
+	/* No time yet, so the state stays invalid until the first fix */
+	BKP->DR1 = 0;
+	return false;
+}
+
+/*!
+ * Sets the RTC from a good decode and saves the clock correction. Neither
+ * is saved if the RTC does not take the time.
+ * @param unixTime the time now, in seconds since 1970
+ * @param correction the clock correction, in ppb
+ */
+void RTCBackup_saveFix(
+	uint32_t unixTime,
+	int32_t correction
+) {
+	if (!rtcRunning) {
+		return;
+	}
+	if (!setRTCCount(unixTime)) {
+		return;
+	}
+	BKP->DR2 = (uint16_t)(unixTime >> 16);
+	BKP->DR3 = (uint16_t)unixTime;
+	BKP->DR4 = (uint16_t)((uint32_t)correction >> 16);
+	BKP->DR5 = (uint16_t)correction;
+	BKP->DR1 = RTC_BACKUP_MAGIC;
+	BKP->DR10 = checkWord();
+}
+
+/*!
+ * Saves the read totals. They are only restored once there has been a fix.
+ * @param goodCount the total good reads
+ * @param badCount the total bad reads
+ */
+void RTCBackup_saveStats(
+	uint32_t goodCount,
+	uint32_t badCount
+) {
+	if (!rtcRunning) {
+		return;
+	}
+	BKP->DR6 = (uint16_t)(goodCount >> 16);
+	BKP->DR7 = (uint16_t)goodCount;
+	BKP->DR8 = (uint16_t)(badCount >> 16);
+	BKP->DR9 = (uint16_t)badCount;
+	BKP->DR10 = checkWord();
+}
@@ -0,0 +1,128 @@
+/*
+ * samplepool.cpp
+ *
+ * Holds the pool of MSF sample buffers. Each buffer carries an ownership
+ * token: the sampler takes a free (MSF_NOONE) buffer to record a minute
+ * into and frees it when the minute ends; the decoder then claims it
+ * (MSF_PROCESSER) while it works on it. The token changes are atomic, so
+ * neither side has to disable interrupts.
+ *
+ */
+
+#include <stdint.h>
+#include "samplepool.h"
+
+/*!
+ * The sample buffers
+ */
+static struct MSF_SAMPLE_BUFFER samplePool[MSF_SAMPLE_POOL_SIZE];
+/*!
+ * The sequence number given to the next minute recorded
+ */
+static uint32_t nextSequence;
+
+/*!
+ * Empties the pool. Must be called before the sampler is started.
+ */
+void SamplePool_init(void) {
+	for (size_t idx = 0; idx < MSF_SAMPLE_POOL_SIZE; ++idx) {
+		samplePool[idx].setOwner(MSF_SAMPLE_BUFFER::MSF_NOONE);
+		samplePool[idx].sampleSequence = 0;
+		samplePool[idx].setStartTime(0);
+		samplePool[idx].setEdgeStart(0);
+		samplePool[idx].setEmpty();
+		samplePool[idx].resetRead();
+	}
+	nextSequence = 1;
+}
+
+/*!
+ * Gets a buffer to record a new minute into. Sampler side only. The
+ * free buffer holding the oldest minute is used.
+ * @return the buffer, now owned by the sampler and empty, or 0 if all of
+ *         the buffers are in use.
+ */
+struct MSF_SAMPLE_BUFFER* SamplePool_startMinute(void) {
+	struct MSF_SAMPLE_BUFFER* pOldest = 0;
+	for (size_t idx = 0; idx < MSF_SAMPLE_POOL_SIZE; ++idx) {
+		struct MSF_SAMPLE_BUFFER* pBuffer = &samplePool[idx];
+		if ((pBuffer->getOwner() == MSF_SAMPLE_BUFFER::MSF_NOONE) &&
+			((pOldest == 0) ||
+			 (pBuffer->sampleSequence < pOldest->sampleSequence))) {
+			pOldest = pBuffer;
+		}
+	}
+	if ((pOldest != 0) &&
+		pOldest->changeOwner(MSF_SAMPLE_BUFFER::MSF_NOONE,
+							 MSF_SAMPLE_BUFFER::MSF_SAMPLER)) {
+		pOldest->setEmpty();
+		pOldest->sampleSequence = nextSequence++;
+		MEMORY_BARRIER();
+		return pOldest;
+	}
+	return 0;
+}
+
+/*!
+ * Frees a buffer once its minute has been recorded. Sampler side only.
+ * @param pBuffer the buffer from SamplePool_startMinute()
+ */
+void SamplePool_endMinute(
+	struct MSF_SAMPLE_BUFFER* pBuffer
+) {
+	MEMORY_BARRIER();
+	pBuffer->setOwner(MSF_SAMPLE_BUFFER::MSF_NOONE);
+}
+
+/*!
+ * Finds the buffer holding a minute. The buffer is not claimed, so it may
+ * still be being recorded, or be reused for a later minute.
+ * @param sequence the minute's sequence number
+ * @return the buffer, or 0 if the minute is no longer held
+ */
+struct MSF_SAMPLE_BUFFER* SamplePool_find(
+	uint32_t sequence
+) {
+	for (size_t idx = 0; idx < MSF_SAMPLE_POOL_SIZE; ++idx) {
+		if ((sequence != 0) && (samplePool[idx].sampleSequence == sequence)) {
+			return &samplePool[idx];
+		}
+	}
+	return 0;
+}
+
+/*!
+ * Claims a buffer so that the sampler leaves it alone. Decoder side
+ * only. This fails if the buffer is still being recorded into or has been
+ * reused for a later minute. A claimed buffer must be handed back with
+ * SamplePool_release().
+ * @param pBuffer the buffer to claim
+ * @param sequence the sequence number of the minute wanted
+ * @return true if the buffer is claimed and holds the wanted minute
+ */
+bool SamplePool_claim(
+	struct MSF_SAMPLE_BUFFER* pBuffer,
+	uint32_t sequence
+) {
+	if (!pBuffer->changeOwner(MSF_SAMPLE_BUFFER::MSF_NOONE,
+							  MSF_SAMPLE_BUFFER::MSF_PROCESSER)) {
+		return false;
+	}
+	if (pBuffer->sampleSequence != sequence) {
+		SamplePool_release(pBuffer);
+		return false;
+	}
+	return true;
+}
+
+/*!
+ * Hands a claimed buffer back to the pool. The minute it holds stays
+ * available until the sampler reuses the buffer.
+ * @param pBuffer the buffer to release
+ */
+void SamplePool_release(
+	struct MSF_SAMPLE_BUFFER* pBuffer
+) {
+	MEMORY_BARRIER();
+	pBuffer->setOwner(MSF_SAMPLE_BUFFER::MSF_NOONE);
+}
@@ -259,6 +259,18 @@ void sFLASH_LowLevel_Init(void) {
  * @retval None
  */
 void LM75_LowLevel_DeInit(void) {
+	GPIO_InitTypeDef GPIO_InitStructure;
+
+	I2C_Cmd(LM75_I2C, DISABLE);
+	I2C_DeInit(LM75_I2C);
+	RCC_APB1PeriphClockCmd(LM75_I2C_CLK, DISABLE);
+
+	/* Leave SCL and SDA floating */
+	GPIO_InitStructure.GPIO_Pin = LM75_I2C_SCL_PIN;
+	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN_FLOATING;
+	GPIO_Init(LM75_I2C_SCL_GPIO_PORT, &GPIO_InitStructure);
+	GPIO_InitStructure.GPIO_Pin = LM75_I2C_SDA_PIN;
+	GPIO_Init(LM75_I2C_SDA_GPIO_PORT, &GPIO_InitStructure);
 }
 
 /**
@@ -267,6 +279,19 @@ void LM75_LowLevel_DeInit(void) {
  * @retval None
  */
 void LM75_LowLevel_Init(void) {
+	GPIO_InitTypeDef GPIO_InitStructure;
+
+	RCC_APB1PeriphClockCmd(LM75_I2C_CLK, ENABLE);
+	RCC_APB2PeriphClockCmd(LM75_I2C_SCL_GPIO_CLK | LM75_I2C_SDA_GPIO_CLK,
+			ENABLE);
+
+	/* SCL and SDA are open drain, driven by the I2C peripheral */
+	GPIO_InitStructure.GPIO_Pin = LM75_I2C_SCL_PIN;
+	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_OD;
+	GPIO_Init(LM75_I2C_SCL_GPIO_PORT, &GPIO_InitStructure);
+	GPIO_InitStructure.GPIO_Pin = LM75_I2C_SDA_PIN;
+	GPIO_Init(LM75_I2C_SDA_GPIO_PORT, &GPIO_InitStructure);
 }
 
 /**
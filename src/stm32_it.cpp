@@ -32,6 +32,7 @@
 #include "stm32_it.h"
 #include "usb_lib.h"
 #include "usb_istr.h"
+#include "usb_endp.h"
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 /* Private macro -------------------------------------------------------------*/
@@ -162,6 +163,8 @@ extern "C" void USB_LP_CAN1_RX0_IRQHandler(void)
 #endif
 {
 	USB_Istr();
+	/* Send anything added to the transmit buffer (see USBKickTx) */
+	USBServiceTx();
 }
 
 /*******************************************************************************
@@ -1,252 +1,90 @@
 /*
  * systick.cpp
  *
- * Holds the ticker IRQ handler and the MSF sampler code.
+ * Holds the ticker IRQ handler which drives the MSF sampler when the
+ * MSF level is polled.
  *
  */
 
-#include <algorithm>
 #include "stm32f10x.h"
 #include "systick.h"
-#include "msf.h"
-#include "samplebuffer.h"
+#include "msf_hal.h"
+#include "msfsampler.h"
+#include "msfcapture.h"
+#include "seqlatch.h"
 
 /*!
- * Holds MSF sampler the state machine state
+ * Holds the system tick counter which is a counter
+ * incremented every 10ms
  */
-enum MSF_SAMPLER_STATE {
-	MSF_IDLE,               /*!< Pauses the sampling */
-	MSF_START,              /*!< Starts sampling */
-    MSF_ZSEC_WAIT_FOR_LOW,  /*!< Waiting for the 0s low period to start */
-	MSF_ZSEC_LOW_PERIOD,    /*!< Whilst in a potential 0s low period */
-	MSF_ZSEC_HIGH_PERIOD,   /*!< Whilst in a potential 0s high period */
-	MSF_SEC_SAMPLING        /*!< Sampling data bits */
-};
-volatile static enum MSF_SAMPLER_STATE msfSampleState = MSF_IDLE;
+volatile static uint32_t tickCount = 0;
 /*!
- * The MSF sample buffer
+ * The 64 bit version of tickCount, which will not wrap. Kept in a latch
+ * so that it can be read from any context.
  */
-static struct MSF_SAMPLE_BUFFER sampleBuffer;
+static uint64_t tickCount64 = 0;
+static SEQ_LATCH<uint64_t> tickLatch;
 /*!
- * Holds the system tick counter which is a counter
- * incremented every 10ms
+ * The nominal number of core clock cycles per tick
  */
-volatile static uint32_t tickCount = 0;
-
+static uint32_t tickReload;
 /*!
- * Stores a period sample into the sampleBuffer
- * @param period the period value (number of 10ms slots) to store
- * @return the next sampler state. This will normally be MSF_SEC_SAMPLING
- *         but if the sample buffer gets full then we will reset the 
- *         sampling state machine ready for the next sample.
+ * The clock correction per tick, in 1/65536ths of a core clock cycle
  */
-static enum MSF_SAMPLER_STATE storeMSFPeriod(
-	uint8_t period
-) {
-	enum MSF_SAMPLER_STATE nextState = MSF_SEC_SAMPLING;
-	/* Is there space in the period buffer? */
-	if (!sampleBuffer.isFull()) {
-		/* yes, so store */
-		sampleBuffer.store(period);
-	} else {
-		/* no, so release ownership of the buffer */
-		sampleBuffer.setOwner(MSF_SAMPLE_BUFFER::MSF_NOONE);
-		/* and restart the state machine */
-		nextState = MSF_START;
-	}
-	return nextState;
-}
-
+volatile static int32_t tickAdjust = 0;
 /*!
- * The MSF sample state machine
- *
- *  +0   +100 +200 +300 +400 +500 +600 +700 +800 +900 +1000  ms
- *   +----+----+----+----+----+----+----+----+----+----+
- * The zero secs marker looks like:
- *                             _________________________
- * 0 |________________________|
- *
- * Following that the rest of the secs look like:
- *          ____ ____ __________________________________
- * x |_____|_Ax_|_Bx_|
- *
+ * The fractional cycles owed to (or by) the tick period, in 1/65536ths
+ * of a core clock cycle
  */
-static void msfSampler(void) {
-    const uint32_t NOISE_REJECT_PERIOD = 5;
-	/*!
-	 * The ticker time associated with the falling edge of a
-	 * start of a zero second marker
-	 */
-	static uint32_t zeroSecStartTime;
-	/*! The ticker time a 1->0 transition was observed */
-	static uint32_t lowTransitionTime;
-	/*! The ticker time a 0->1 transition was observed */
-	static uint32_t highTransitionTime;
-	/*! The previous sample level */
-	static uint8_t lastMSFLevel = 1;
-	/*! The current sample level */
-	uint8_t msfLevel = msfSample();
-	/*! The level transition identified at this sample */
-	enum {none, high, low} transitionType = none;
-	/*! The ticker period the previous level was seen for */
-	uint32_t period = 0;
-	/*
-	 * Figure out any level transition.
-     * Reject small periods as noise, so we effectively
-     * replace _____    __________________
-     *              |__|                  |________________
-     * with    ___________________________
-     *                                    |________________
-     * and replace   __                    _________________
-     *         _____|  |__________________|
-     * with                                _________________
-     *         ___________________________|
-	 */
-	if (msfLevel == 1) {
-		if (lastMSFLevel == 0) {
-		    /* 0 -> 1 transition */
-            period = tickCount-lowTransitionTime;
-		    if (period > NOISE_REJECT_PERIOD) {
-		        highTransitionTime = tickCount;
-		        transitionType = high;
-		    } else {
-                if (msfSampleState == MSF_SEC_SAMPLING) {
-                    sampleBuffer.unstore();
-                }
-		    }
-		}
-	} else {
-		if (lastMSFLevel == 1) {
-            /* 1 -> 0 */
-            period = tickCount-highTransitionTime;
-            if (period > NOISE_REJECT_PERIOD) {
-                lowTransitionTime = tickCount;
-                transitionType = low;
-            } else {
-                if (msfSampleState == MSF_SEC_SAMPLING) {
-                    sampleBuffer.unstore();
-                }
-            }
-		}
-	}
-	/*
-	 * Process any transition with the state machine
-	 */
-	switch (msfSampleState) {
-		case MSF_IDLE:
-			break;
-		case MSF_START:
-		case MSF_ZSEC_WAIT_FOR_LOW:
-			if (transitionType == low) {
-				zeroSecStartTime = tickCount;
-				msfSampleState = MSF_ZSEC_LOW_PERIOD;
-			}
-			break;
-		case MSF_ZSEC_LOW_PERIOD:
-			if (transitionType == high) {
-				if (msfPeriodLengthMatch(period, SYSTICK_ONESEC/2)) {
-					msfSampleState = MSF_ZSEC_HIGH_PERIOD;
-				} else {
-					msfSampleState = MSF_ZSEC_WAIT_FOR_LOW;
-				}
-			}
-			break;
-		case MSF_ZSEC_HIGH_PERIOD:
-			if (transitionType == low) {
-				if (msfPeriodLengthMatch(period, SYSTICK_ONESEC/2)) {
-					if ((sampleBuffer.getOwner() == MSF_SAMPLE_BUFFER::MSF_SAMPLER) ||
-						(sampleBuffer.getOwner() == MSF_SAMPLE_BUFFER::MSF_NOONE)) {
-						sampleBuffer.setOwner(MSF_SAMPLE_BUFFER::MSF_SAMPLER);
-						sampleBuffer.setEmpty();
-						msfSampleState = MSF_SEC_SAMPLING;
-					} else {
-						msfSampleState = MSF_START;
-					}
-				} else {
-					zeroSecStartTime = tickCount;
-					msfSampleState = MSF_ZSEC_LOW_PERIOD;
-				}
-			}
-			break;
-		case MSF_SEC_SAMPLING:
-			if (transitionType == low) {
-				if (sampleBuffer.getOwner() == MSF_SAMPLE_BUFFER::MSF_SAMPLER) {
-                    msfSampleState = storeMSFPeriod(period);
-				}
-			} else if (transitionType == high) {
-				if (msfPeriodLengthMatch(period, SYSTICK_ONESEC/2)) {
-					zeroSecStartTime = lowTransitionTime;
-					if (sampleBuffer.getOwner() == MSF_SAMPLE_BUFFER::MSF_SAMPLER) {
-						sampleBuffer.setStartTime(zeroSecStartTime);
-						sampleBuffer.setOwner(MSF_SAMPLE_BUFFER::MSF_NOONE);
-					}
-					msfSampleState = MSF_ZSEC_HIGH_PERIOD;
-				}
-				else {
-					if (sampleBuffer.getOwner() == MSF_SAMPLE_BUFFER::MSF_SAMPLER) {
-                        msfSampleState = storeMSFPeriod(period);
-					}
-				}
-			}
-			break;
-		default:
-			msfSampleState = MSF_START;
-			break;
-	}
-	lastMSFLevel = msfLevel;
-}
+static int32_t tickAdjustAccum = 0;
 
 /*!
- * The Systick Interrupt Handler, should be invoked every 10ms
+ * The Systick Interrupt Handler, should be invoked every 10ms. Unless
+ * MSF edges are captured by a timer, this polls the MSF level.
  */
 extern "C"
 void SysTick_Handler(void) {
 	++tickCount;
-	msfSampler();
+	tickLatch.write(++tickCount64);
+	/*
+	 * Dither the reload value so that the average tick period includes
+	 * the fractional clock correction. The new value is used from the
+	 * next reload.
+	 */
+	tickAdjustAccum += tickAdjust;
+	int32_t wholeCycles = tickAdjustAccum >> 16;
+	tickAdjustAccum -= wholeCycles * 65536;
+	SysTick->LOAD = tickReload - 1 + wholeCycles;
+#if !MSF_EDGE_CAPTURE
+	MSFSampler_sample(tickCount, msfSample());
+#endif
 }
 
 /*!
  * Initialises the system tick IRQ rate and prepares the MSF sampling
- * state machine and its sample buffer.
+ * state machine and its sample buffers. If MSF edges are captured by a
+ * timer, the capture is started too.
  */
 void SysTick_init(void) {
-	sampleBuffer.setOwner(MSF_SAMPLE_BUFFER::MSF_NOONE);
-	sampleBuffer.setEmpty();
-	SysTick_Config(SystemCoreClock / 100); /* Generate interrupt each 10 ms */
-	msfSampleState = MSF_START;
+	MSFSampler_init();
+	tickReload = SystemCoreClock / 100;
+	SysTick_Config(tickReload); /* Generate interrupt each 10 ms */
+#if MSF_EDGE_CAPTURE
+	MSFCapture_init();
+#endif
 }
 
 /*!
- * Attempts to get ownership of the MSF sample buffer. If successful it is
- * important that it is returned to the sampler by calling
- * SysTick_releaseMSFSample(). Once the caller gets a non-zero pointer value
- * the sample buffer is deemed owned by a client and no further sampling
- * is performed. A client typically has just less then 500ms to decode the
- * buffer and return it to the sampler if we are to successfully sample the
- * next minutes data. If this schedule is missed we will not be able to sample
- * the next minute and will get the following one.
- * @returns 0 if the buffer is not currently available, or a pointer to
- *          the sample buffer available for decoding.
+ * Sets the tick clock correction. A positive value lengthens the tick
+ * period, to make up for a crystal which runs fast.
+ * @param correction the correction in ppb
  */
-struct MSF_SAMPLE_BUFFER* SysTick_getMSFSample(void) {
-	struct MSF_SAMPLE_BUFFER* pSample = 0;
-	if ((sampleBuffer.getOwner() == MSF_SAMPLE_BUFFER::MSF_NOONE) &&
-		!sampleBuffer.isEmpty()) {
-		sampleBuffer.setOwner(MSF_SAMPLE_BUFFER::MSF_PROCESSER);
-		pSample = &sampleBuffer;
-	} else if (sampleBuffer.getOwner() == MSF_SAMPLE_BUFFER::MSF_PROCESSER) {
-		sampleBuffer.setEmpty();
-		sampleBuffer.setOwner(MSF_SAMPLE_BUFFER::MSF_NOONE);
-	}
-	return pSample;
-}
-
-/*!
- * Returns ownership of the sample buffer to the sampler.
- */
-void SysTick_releaseMSFSample(void) {
-	sampleBuffer.setEmpty();
-	sampleBuffer.setOwner(MSF_SAMPLE_BUFFER::MSF_NOONE);
+void SysTick_setCorrection(
+	int32_t correction
+) {
+	/* cycles per tick * correction / 1e9, as a 16.16 fixed point value */
+	tickAdjust = (int32_t)(((int64_t)tickReload * correction * 65536) /
+						   1000000000);
 }
 
 /*!
@@ -256,3 +94,44 @@ void SysTick_releaseMSFSample(void) {
 uint32_t SysTick_readTicks(void) {
 	return tickCount;
 }
+
+/*!
+ * Returns the current system tick count value as a 64 bit value, which
+ * does not wrap. May be called from any context.
+ */
+uint64_t SysTick_readTicks64(void) {
+	uint64_t ticks;
+	tickLatch.read(ticks);
+	return ticks;
+}
+
+/*!
+ * Returns the time since SysTick_init() in us, interpolated within the
+ * current tick from the SysTick counter. May be called from any context;
+ * if called with the SysTick IRQ pending (from a higher priority IRQ)
+ * the tick it has yet to count is allowed for.
+ */
+uint64_t SysTick_readMicros(void) {
+	uint64_t ticks;
+	uint32_t count;
+	bool pending;
+	while (true) {
+		bool pendingBefore = (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) != 0;
+		tickLatch.read(ticks);
+		count = SysTick->VAL;
+		pending = (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) != 0;
+		uint64_t ticksAfter;
+		tickLatch.read(ticksAfter);
+		/* Retry if the counter reloaded while we read it */
+		if ((ticks == ticksAfter) && (pending == pendingBefore)) {
+			break;
+		}
+	}
+	if (pending) {
+		++ticks;
+	}
+	/* The counter counts down from the reload value */
+	uint32_t elapsed = (count < tickReload) ? tickReload - 1 - count : 0;
+	return ticks*SYSTICK_US_PER_TICK +
+		   (uint64_t)elapsed*SYSTICK_US_PER_TICK/tickReload;
+}
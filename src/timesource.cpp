@@ -0,0 +1,160 @@
+/*
+ * timesource.cpp
+ *
+ * Holds the time reference set from each good MSF decode: the local time
+ * (from SysTick_readMicros()) at which a minute started, and the UTC time
+ * of that minute. The current UTC time is the reference UTC time plus the
+ * local time elapsed since. The reference is kept in a latch, so the time
+ * can be read from any context.
+ *
+ */
+
+#include <stdint.h>
+#include "systick.h"
+#include "msf_hal.h"
+#include "seqlatch.h"
+#include "timesource.h"
+
+/*! One second, in us */
+const uint64_t US_PER_SEC = 1000000;
+
+/*!
+ * A UTC time and the local time at the same instant
+ */
+struct TIME_REFERENCE {
+	bool valid;             /*!< The reference has been set */
+	bool approximate;       /*!< Not from a decode, so errorBound applies */
+	uint32_t errorBound;    /*!< How far out an approximate time is, in s */
+	uint64_t localTime;     /*!< The local time, in us */
+	uint64_t utcTime;       /*!< The UTC time, in us since 1970 */
+};
+static SEQ_LATCH<TIME_REFERENCE> referenceLatch;
+
+/*!
+ * Gives the number of days from 1970-01-01 to a date
+ * @param year the year (>= 1970)
+ * @param month the month [1..12]
+ * @param day the day of the month [1..31]
+ */
+static uint32_t daysSinceEpoch(
+	uint32_t year,
+	uint32_t month,
+	uint32_t day
+) {
+	/* Count from March, so the leap day is at the end of the year */
+	if (month <= 2) {
+		year -= 1;
+		month += 12;
+	}
+	uint32_t dayOfYear = (153*(month - 3) + 2)/5 + day - 1;
+	uint32_t days = year*365 + year/4 - year/100 + year/400 + dayOfYear;
+	/* Days from 0000-03-01 to 1970-01-01 */
+	return days - 719468;
+}
+
+/*!
+ * Gives the UTC time a decoded minute starts at
+ * @param dateTime the decoded date/time, which is in UK civil time
+ * @return the seconds since 1970-01-01 00:00 UTC
+ */
+uint32_t TimeSource_unixTime(
+	const struct MSF_DATE_TIME& dateTime
+) {
+	uint32_t seconds = daysSinceEpoch(2000 + dateTime.year,
+									  dateTime.month, dateTime.day)*86400UL +
+					   dateTime.hour*3600UL + dateTime.min*60UL;
+	if (dateTime.BST) {
+		seconds -= 3600;
+	}
+	return seconds;
+}
+
+/*!
+ * Clears the time reference. Until the first TimeSource_setMinute() the
+ * time is not available.
+ */
+void TimeSource_init(void) {
+	struct TIME_REFERENCE reference;
+	reference.valid = false;
+	reference.approximate = false;
+	reference.errorBound = 0;
+	reference.localTime = 0;
+	reference.utcTime = 0;
+	referenceLatch.write(reference);
+}
+
+/*!
+ * Sets the time reference from a good decode. Main line code only.
+ * @param dateTime the decoded date/time
+ */
+void TimeSource_setMinute(
+	const struct MSF_DATE_TIME& dateTime
+) {
+	struct TIME_REFERENCE reference;
+	if (dateTime.usAtTimeError != 0) {
+		reference.localTime = msfSamplerToLocal(dateTime.usAtTime);
+	} else {
+		/* No fitted minute start, so use the marker tick */
+		uint64_t ticks = SysTick_readTicks64();
+		ticks -= (uint32_t)((uint32_t)ticks - dateTime.ticksAtTime);
+		reference.localTime = ticks*SYSTICK_US_PER_TICK;
+	}
+	if ((dateTime.month < 1) || (dateTime.month > 12) || (dateTime.day < 1)) {
+		return;
+	}
+	reference.utcTime = TimeSource_unixTime(dateTime)*US_PER_SEC;
+	reference.valid = true;
+	reference.approximate = false;
+	reference.errorBound = 0;
+	referenceLatch.write(reference);
+}
+
+/*!
+ * Sets an approximate time reference, e.g. from the RTC after a reset.
+ * It is replaced by the first good decode. Main line code only.
+ * @param unixTime the time now, in whole seconds since 1970-01-01 00:00
+ * @param errorBound how far out unixTime may be, in seconds
+ */
+void TimeSource_setApproximate(
+	uint32_t unixTime,
+	uint32_t errorBound
+) {
+	struct TIME_REFERENCE reference;
+	reference.localTime = SysTick_readMicros();
+	/* Centre the unknown fraction of the second */
+	reference.utcTime = unixTime*US_PER_SEC + US_PER_SEC/2;
+	reference.valid = true;
+	reference.approximate = true;
+	reference.errorBound = errorBound;
+	referenceLatch.write(reference);
+}
+
+/*!
+ * Gives the current UTC time. May be called from any context.
+ * @param utcTime assigned the UTC time, in us since 1970-01-01 00:00
+ * @param pApproximate if not 0, assigned true if the time is only an
+ *        approximation from TimeSource_setApproximate()
+ * @param pErrorBound if not 0, assigned how far out an approximate time may
+ *        be, in seconds (0 for a time from a decode)
+ * @return false if there is no time yet
+ */
+bool TimeSource_readUTC(
+	uint64_t& utcTime,
+	bool* pApproximate,
+	uint32_t* pErrorBound
+) {
+	struct TIME_REFERENCE reference;
+	referenceLatch.read(reference);
+	if (!reference.valid) {
+		return false;
+	}
+	if (pApproximate != 0) {
+		*pApproximate = reference.approximate;
+	}
+	if (pErrorBound != 0) {
+		*pErrorBound = reference.errorBound;
+	}
+	utcTime = reference.utcTime +
+			  (SysTick_readMicros() - reference.localTime);
+	return true;
+}
@@ -3,7 +3,6 @@
  */
 
 #include <algorithm>
-#include <cstring>
 #include "usb_lib.h"
 #include "usb_mem.h"
 #include "usb_desc.h"
@@ -11,52 +10,104 @@
 #include "usb_istr.h"
 #include "usb_pwr.h"
 #include "usb_endp.h"
+#include "spscring.h"
 
-#define USB_TX_BUFF_SIZE   2048
 #define USB_RX_BUFF_SIZE   1024
-/* Interval between sending IN packets in frame number (1 frame = 1ms) */
-#define VCOMPORT_IN_FRAME_INTERVAL 5
+/*
+ * The serial buffers are lock-free rings: the USB interrupt only adds to
+ * the receive ring and only takes from the transmit ring, so neither side
+ * has to disable the USB interrupt.
+ */
 /* USB Receive buffer - data received _from_ the USB port */
-static uint8_t  USB_RxBuffer[USB_TX_BUFF_SIZE];
-static uint32_t USB_RxWrIdx = 0;
-static uint32_t USB_RxRdIdx = 0;
-static uint32_t USB_RxLength = 0;
-static uint8_t  USB_RxHoldingBuffer[VIRTUAL_COM_PORT_DATA_SIZE];
+static SPSC_RING<uint8_t, USB_RX_BUFF_SIZE> USB_Rx;
 /* USB Transmit buffer - data to be sent _to_ the USB port */
-static uint8_t  USB_TxBuffer[USB_TX_BUFF_SIZE];
-static uint32_t USB_TxWrIdx = 0;
-static uint32_t USB_TxRdIdx = 0;
-static uint32_t USB_TxLength = 0;
-static uint8_t  USB_TxHoldingBuffer[VIRTUAL_COM_PORT_DATA_SIZE];
+static SPSC_RING<uint8_t, USB_TX_BUFF_SIZE> USB_Tx;
+/* The free space of USB_Tx is claimed by a writer (see USBClaimTx) */
+static bool     USB_TxClaimed = false;
+/*
+ * EP1 is double buffered: while the packet in one PMA buffer is sent, the
+ * next is copied into the other, the one SW_BUF points to. The endpoint
+ * NAKs once DTOG_TX catches up with SW_BUF, which it also does with both
+ * buffers released, so only one packet is released at a time and the
+ * next stays staged until the first has gone. These are only used from
+ * the USB interrupt.
+ */
+static bool     USB_TxStaged = false;
+static bool     USB_TxQueued = false;
+
+/*!
+ * Function Name  : USBStageTx
+ * Description    : Copies the next packet from the transmit buffer straight
+ *                  into the EP1 PMA buffer that SW_BUF points to, if that
+ *                  is free. A packet stops at the end of the transmit
+ *                  buffer, as the PMA is written a half word at a time.
+ */
+static void USBStageTx(void) {
+	uint32_t spanLength;
+	const uint8_t* pSpan = USB_Tx.readSpan(spanLength);
+	if (USB_TxStaged || (spanLength == 0)) {
+		return;
+	}
+	uint32_t txSize = std::min(spanLength,
+							   (uint32_t)VIRTUAL_COM_PORT_DATA_SIZE);
+	if ((GetENDPOINT(ENDP1) & EP_DTOG_RX) != 0) {
+		UserToPMABufferCopy((uint8_t *)pSpan, ENDP1_BUF1ADDR, txSize);
+		SetEPDblBuf1Count(ENDP1, EP_DBUF_IN, txSize);
+	} else {
+		UserToPMABufferCopy((uint8_t *)pSpan, ENDP1_BUF0ADDR, txSize);
+		SetEPDblBuf0Count(ENDP1, EP_DBUF_IN, txSize);
+	}
+	USB_Tx.commitRead(txSize);
+	USB_TxStaged = true;
+}
+
+/*!
+ * Function Name  : USBReleaseTx
+ * Description    : Releases the staged packet to be sent, if none is being
+ *                  sent, and stages the next
+ */
+static void USBReleaseTx(void) {
+	if (USB_TxStaged && !USB_TxQueued) {
+		FreeUserBuffer(ENDP1, EP_DBUF_IN);
+		USB_TxStaged = false;
+		USB_TxQueued = true;
+		USBStageTx();
+	}
+}
+
+/*!
+ * Function Name  : USBServiceTx
+ * Description    : Starts sending what has been added to the transmit
+ *                  buffer, if EP1 is idle. Called from the USB interrupt,
+ *                  which USBKickTx() raises for this.
+ */
+extern "C"
+void USBServiceTx(void) {
+	if (USBDeviceState == CONFIGURED) {
+		USBStageTx();
+		USBReleaseTx();
+	}
+}
+
+/*!
+ * Function Name  : USBKickTx
+ * Description    : Has the USB interrupt start sending what has just been
+ *                  added to the transmit buffer. An interrupt with no USB
+ *                  event pending does nothing else.
+ */
+static void USBKickTx(void) {
+	NVIC_SetPendingIRQ(USB_LP_CAN1_RX0_IRQn);
+}
 
 /*!
- * Function Name  : USBAsynchSend.
- * Description    : sends a block of data to USB end point 1
+ * Function Name  : USBResetTx
+ * Description    : Forgets any packets staged or being sent, once EP1 has
+ *                  been set up again after a USB reset
  */
-static void USBAsynchSend(void) {
-    if (USB_TxLength != 0) {
-        uint32_t txSize = std::min(USB_TxLength,
-                                   (uint32_t)VIRTUAL_COM_PORT_DATA_SIZE);
-        uint32_t b1Size = std::min(txSize,
-                                   (uint32_t)(USB_TX_BUFF_SIZE-USB_TxRdIdx));
-        uint32_t b2Size = txSize - b1Size;
-        if (b1Size > 0) {
-            std::memcpy(USB_TxHoldingBuffer, USB_TxBuffer+USB_TxRdIdx, b1Size);
-            if (b2Size > 0) {
-                std::memcpy(USB_TxHoldingBuffer+b1Size, USB_TxBuffer, b2Size);
-                USB_TxRdIdx = b2Size;
-            } else {
-                USB_TxRdIdx += b1Size;
-                if (USB_TxRdIdx == USB_TX_BUFF_SIZE) {
-                    USB_TxRdIdx = 0;
-                }
-            }
-            UserToPMABufferCopy(USB_TxHoldingBuffer, ENDP1_TXADDR, txSize);
-            USB_TxLength -= txSize;
-            SetEPTxCount(ENDP1, txSize);
-            SetEPTxValid(ENDP1);
-        }
-    }
+extern "C"
+void USBResetTx(void) {
+	USB_TxStaged = false;
+	USB_TxQueued = false;
 }
 
 /*!
@@ -68,27 +119,65 @@ static void USBAsynchSend(void) {
  */
 extern "C"
 uint32_t USBPutSerial(const uint8_t *pBuffer, uint32_t length) {
-	uint32_t availLen = std::min(length, USB_TX_BUFF_SIZE-USB_TxLength);
-	uint32_t b1Size = std::min(availLen, USB_TX_BUFF_SIZE-USB_TxWrIdx);
-	uint32_t b2Size = availLen - b1Size;
-	if (b1Size > 0) {
-		std::memcpy(USB_TxBuffer+USB_TxWrIdx, pBuffer, b1Size);
-		if (b2Size > 0) {
-			std::memcpy(USB_TxBuffer, pBuffer+b1Size, b2Size);
-			USB_TxWrIdx = b2Size;
-		} else {
-			USB_TxWrIdx += b1Size;
-			if (USB_TxWrIdx == USB_TX_BUFF_SIZE) {
-				USB_TxWrIdx = 0;
-			}
-		}
-	    NVIC_DisableIRQ (USB_LP_CAN1_RX0_IRQn);
-	    USB_TxLength += availLen;
-	    NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+	if (USB_TxClaimed) {
+		return 0;
+	}
+	uint32_t availLen = USB_Tx.write(pBuffer, length);
+	if (availLen > 0) {
+		USBKickTx();
 	}
 	return availLen;
 }
 
+/*!
+ * Function Name  : USBClaimTx
+ * Description    : Claims the free space of the transmit buffer, so that data
+ *                  can be written into it in place and sent later with
+ *                  USBCommitTx(). Data written at index i goes at
+ *                  [i & (USB_TX_BUFF_SIZE-1)], from index *pStart up to
+ *                  USBFreeTx() bytes. USBPutSerial() sends nothing while the
+ *                  space is claimed.
+ * Input          : pStart - receives the index of the first free byte
+ * Return         : The transmit buffer, or 0 if the USB is not configured or
+ *                  the space has already been claimed
+ */
+extern "C"
+uint8_t* USBClaimTx(uint32_t *pStart) {
+	if ((USBDeviceState != CONFIGURED) || USB_TxClaimed) {
+		return 0;
+	}
+	USB_TxClaimed = true;
+	*pStart = USB_Tx.head;
+	return USB_Tx.items;
+}
+
+/*!
+ * Function Name  : USBFreeTx
+ * Description    : Gives the free space in the transmit buffer. This only
+ *                  grows as the buffer is sent.
+ * Return         : The number of bytes free
+ */
+extern "C"
+uint32_t USBFreeTx(void) {
+	return USB_Tx.space();
+}
+
+/*!
+ * Function Name  : USBCommitTx
+ * Description    : Sends the data written into the claimed space of the
+ *                  transmit buffer, and gives up the claim
+ * Input          : length - number of bytes written from the claimed start,
+ *                  at most USBFreeTx(); 0 just gives up the claim
+ */
+extern "C"
+void USBCommitTx(uint32_t length) {
+	if (USB_TxClaimed && (length > 0)) {
+		USB_Tx.commitWrite(length);
+		USBKickTx();
+	}
+	USB_TxClaimed = false;
+}
+
 /*!
  * Function Name  : USBGetSerial
  * Description    : Gets a block of data from the USB serial port buffer
@@ -98,34 +187,17 @@ uint32_t USBPutSerial(const uint8_t *pBuffer, uint32_t length) {
  */
 extern "C"
 uint32_t USBGetSerial(uint8_t *pBuffer, uint32_t bufferLength) {
-	uint32_t availLen = std::min(bufferLength, USB_RxLength);
-	uint32_t b1Size = std::min(availLen, USB_RX_BUFF_SIZE-USB_RxRdIdx);
-	uint32_t b2Size = availLen - b1Size;
-	if (b1Size > 0) {
-		std::memcpy(pBuffer, USB_RxBuffer+USB_RxRdIdx, b1Size);
-		if (b2Size > 0) {
-			std::memcpy(pBuffer+b1Size, USB_RxBuffer, b2Size);
-			USB_RxRdIdx = b2Size;
-		} else {
-			USB_RxRdIdx += b1Size;
-			if (USB_RxRdIdx == USB_RX_BUFF_SIZE) {
-				USB_RxRdIdx = 0;
-			}
-		}
-	    NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
-	    USB_RxLength -= availLen;
-	    NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
-	}
-	return availLen;
+	return USB_Rx.read(pBuffer, bufferLength);
 }
 
 /*!
  * Function Name  : EP1_IN_Callback
- * Description    : USB End point 1 IN processing - host PC wants data _from_
- * 					us
+ * Description    : USB End point 1 IN processing - the host PC has taken a
+ * 					packet of data _from_ us, so we release the next
  */
 void EP1_IN_Callback(void) {
-	USBAsynchSend();
+	USB_TxQueued = false;
+	USBReleaseTx();
 }
 
 /*!
@@ -134,44 +206,19 @@ void EP1_IN_Callback(void) {
  *                  for us _from_ the host PC.
  */
 void EP3_OUT_Callback(void) {
-	/* Extract received data */
-	uint32_t rxCount = USB_SIL_Read(EP3_OUT, USB_RxHoldingBuffer);
+	uint32_t rxCount = GetEPRxCount(ENDP3);
+	uint32_t spanLength;
+	uint8_t* pSpan = USB_Rx.writeSpan(spanLength);
+	if (spanLength >= rxCount) {
+		/* Read the packet straight into USB_Rx */
+		PMAToUserBufferCopy(pSpan, GetEPRxAddr(ENDP3), rxCount);
+		USB_Rx.commitWrite(rxCount);
+	} else {
+		/* It wraps, or does not all fit: what does not fit is lost */
+		uint8_t holdingBuffer[VIRTUAL_COM_PORT_DATA_SIZE];
+		PMAToUserBufferCopy(holdingBuffer, GetEPRxAddr(ENDP3), rxCount);
+		USB_Rx.write(holdingBuffer, rxCount);
+	}
 	/* Enable the receive of data on EP3 */
 	SetEPRxValid(ENDP3);
-	/* Now move into USB_RxBuffer */
-	uint32_t availLen = std::min(rxCount,
-						    USB_RX_BUFF_SIZE-USB_RxLength);
-	uint32_t b1Size = std::min(availLen, USB_RX_BUFF_SIZE-USB_RxWrIdx);
-	uint32_t b2Size = availLen - b1Size;
-	if (b1Size > 0) {
-		std::memcpy(USB_RxBuffer+USB_RxWrIdx, USB_RxHoldingBuffer, b1Size);
-		if (b2Size > 0) {
-			std::memcpy(USB_RxBuffer, USB_RxHoldingBuffer+b1Size, b2Size);
-			USB_RxWrIdx = b2Size;
-		} else {
-			USB_RxWrIdx += b1Size;
-			if (USB_RxWrIdx == USB_TX_BUFF_SIZE) {
-				USB_RxWrIdx = 0;
-			}
-		}
-	    USB_RxLength += availLen;
-	}
 }
-
-/*!
- * Function Name  : SOF_Callback / INTR_SOFINTR_Callback
- * Description    :
- */
-void SOF_Callback(void) {
-	static uint32_t FrameCount = 0;
-	if (USBDeviceState == CONFIGURED) {
-		if (FrameCount++ == VCOMPORT_IN_FRAME_INTERVAL) {
-			/* Reset the frame counter */
-			FrameCount = 0;
-			/* Check the data to be sent through IN pipe */
-			USBAsynchSend();
-		}
-	}
-}
-
-
@@ -33,6 +33,7 @@
 #include "usb_desc.h"
 #include "usb_pwr.h"
 #include "hw_config.h"
+#include "usb_endp.h"
 #include <cstddef>
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
@@ -148,9 +149,15 @@ void Virtual_Com_Port_Reset(void) {
 	SetEPRxValid(ENDP0);
 	/* Initialize Endpoint 1 */
 	SetEPType(ENDP1, EP_BULK);
-	SetEPTxAddr(ENDP1, ENDP1_TXADDR);
-	SetEPTxStatus(ENDP1, EP_TX_NAK);
+	SetEPDoubleBuff(ENDP1);
+	SetEPDblBuffAddr(ENDP1, ENDP1_BUF0ADDR, ENDP1_BUF1ADDR);
+	SetEPDblBuffCount(ENDP1, EP_DBUF_IN, 0);
+	/* DTOG_TX == SW_BUF: NAK until a packet is released (see usb_endp) */
+	ClearDTOG_RX(ENDP1);
+	ClearDTOG_TX(ENDP1);
 	SetEPRxStatus(ENDP1, EP_RX_DIS);
+	SetEPTxStatus(ENDP1, EP_TX_VALID);
+	USBResetTx();
 	/* Initialize Endpoint 2 */
 	SetEPType(ENDP2, EP_INTERRUPT);
 	SetEPTxAddr(ENDP2, ENDP2_TXADDR);